@@ -6,10 +6,31 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <iterator>
+#include <vector>
+#include <future>
+#include <thread>
 #include "bst.h"
+#include "frozen_avlbst.h"
+#include "snapshot_avlbst.h"
 
 struct KeyError { };
 
+/**
+* True when It is at least a forward iterator, i.e. a range can be walked
+* twice. Iterators without iterator_traits count as single pass.
+*/
+template <typename It, typename = void>
+struct IsForwardIterator : std::false_type
+{
+};
+
+template <typename It>
+struct IsForwardIterator<It, std::void_t<typename std::iterator_traits<It>::iterator_category> > :
+    std::is_base_of<std::forward_iterator_tag, typename std::iterator_traits<It>::iterator_category>
+{
+};
+
 /**
 * A special kind of node for an AVL tree, which adds the balance as a data member, plus
 * other additional helper functions. You do NOT need to implement any functionality or
@@ -21,19 +42,21 @@ class AVLNode : public Node<Key, Value>
 public:
     // Constructor/destructor.
     AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    template<typename KeyArgs, typename ValueArgs>
+    AVLNode(std::piecewise_construct_t, KeyArgs keyArgs, ValueArgs valueArgs, AVLNode<Key, Value>* parent);
+    ~AVLNode();
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
 
-    // Getters for parent, left, and right. These need to be redefined since they
+    // Getters for parent, left, and right. These hide the Node versions since they
     // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
     // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    AVLNode<Key, Value>* getParent() const;
+    AVLNode<Key, Value>* getLeft() const;
+    AVLNode<Key, Value>* getRight() const;
 
 protected:
     int8_t balance_;    // effectively a signed char
@@ -56,6 +79,18 @@ AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Va
 
 }
 
+/**
+* A piecewise constructor that builds the key and value in place. See the
+* matching Node constructor.
+*/
+template<class Key, class Value>
+template<typename KeyArgs, typename ValueArgs>
+AVLNode<Key, Value>::AVLNode(std::piecewise_construct_t, KeyArgs keyArgs, ValueArgs valueArgs, AVLNode<Key, Value> *parent) :
+    Node<Key, Value>(std::piecewise_construct, std::move(keyArgs), std::move(valueArgs), parent), balance_(0)
+{
+
+}
+
 /**
 * A destructor which does nothing.
 */
@@ -93,8 +128,8 @@ void AVLNode<Key, Value>::updateBalance(int8_t diff)
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* A getter for the parent that hides Node::getParent, since a static_cast is necessary to make sure
+* that our node is a AVLNode. The AVLTree only ever links AVLNodes together, so the cast is free.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
@@ -103,7 +138,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Hidden for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
@@ -112,7 +147,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Hidden for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
@@ -127,122 +162,1125 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
   -----------------------------------------------
 */
 
+/**
+* An AVLNode that also keeps the number of nodes in its subtree (itself
+* included), which lets an AVLTree answer size, rank and select queries in
+* O(log n) instead of walking the tree. Pass it as AVLTree's NodeType, or
+* use CountedAVLTree. The count is 32 bits and sits in the padding behind
+* the balance, so most nodes get no bigger than a plain AVLNode; a single
+* tree is limited to 2^32 - 1 entries.
+*/
+template <typename Key, typename Value>
+class CountedAVLNode : public AVLNode<Key, Value>
+{
+public:
+    CountedAVLNode(const Key& key, const Value& value, CountedAVLNode<Key, Value>* parent);
+    template<typename KeyArgs, typename ValueArgs>
+    CountedAVLNode(std::piecewise_construct_t, KeyArgs keyArgs, ValueArgs valueArgs, CountedAVLNode<Key, Value>* parent);
+
+    // Getter/setter for the number of nodes in the subtree rooted here.
+    uint32_t getSize() const;
+    void setSize(uint32_t size);
+
+    // Hidden for the same reason AVLNode hides the Node versions.
+    CountedAVLNode<Key, Value>* getParent() const;
+    CountedAVLNode<Key, Value>* getLeft() const;
+    CountedAVLNode<Key, Value>* getRight() const;
+
+protected:
+    uint32_t size_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the CountedAVLNode class.
+  -------------------------------------------------
+*/
+
+/**
+* A new node is always a leaf, so its subtree is just itself.
+*/
+template<class Key, class Value>
+CountedAVLNode<Key, Value>::CountedAVLNode(const Key& key, const Value& value, CountedAVLNode<Key, Value> *parent) :
+    AVLNode<Key, Value>(key, value, parent), size_(1)
+{
+
+}
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+/**
+* Piecewise constructor, see Node.
+*/
+template<class Key, class Value>
+template<typename KeyArgs, typename ValueArgs>
+CountedAVLNode<Key, Value>::CountedAVLNode(std::piecewise_construct_t, KeyArgs keyArgs, ValueArgs valueArgs, CountedAVLNode<Key, Value> *parent) :
+    AVLNode<Key, Value>(std::piecewise_construct, std::move(keyArgs), std::move(valueArgs), parent), size_(1)
+{
+
+}
+
+/**
+* A getter for the subtree size.
+*/
+template<class Key, class Value>
+uint32_t CountedAVLNode<Key, Value>::getSize() const
+{
+    return size_;
+}
+
+/**
+* A setter for the subtree size.
+*/
+template<class Key, class Value>
+void CountedAVLNode<Key, Value>::setSize(uint32_t size)
+{
+    size_ = size;
+}
+
+/**
+* Parent getter returning a CountedAVLNode; see AVLNode::getParent.
+*/
+template<class Key, class Value>
+CountedAVLNode<Key, Value> *CountedAVLNode<Key, Value>::getParent() const
+{
+    return static_cast<CountedAVLNode<Key, Value>*>(this->parent_);
+}
+
+/**
+* Hidden for the same reasons as above.
+*/
+template<class Key, class Value>
+CountedAVLNode<Key, Value> *CountedAVLNode<Key, Value>::getLeft() const
+{
+    return static_cast<CountedAVLNode<Key, Value>*>(this->left_);
+}
+
+/**
+* Hidden for the same reasons as above.
+*/
+template<class Key, class Value>
+CountedAVLNode<Key, Value> *CountedAVLNode<Key, Value>::getRight() const
+{
+    return static_cast<CountedAVLNode<Key, Value>*>(this->right_);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the CountedAVLNode class.
+  -----------------------------------------------
+*/
+
+/**
+* An AVL node that keeps its balance in the low bits of the parent pointer
+* instead of a byte of its own. Nodes are at least pointer aligned, so the
+* bottom three bits of a node address are always zero; three bits rather
+* than two because rotateLeftAt and the joins briefly store a balance of
+* +2 or -2. The children stay plain pointers, so lookups, which never look
+* at the parent, pay nothing for the packing. With int keys and values a
+* node is 32 bytes where an AVLNode is 40. Pass it as AVLTree's NodeType,
+* or use PackedAVLTree.
+*/
+template <typename Key, typename Value>
+class PackedAVLNode
 {
 public:
-    virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
-    virtual void remove(const Key& key);  // TODO
+    PackedAVLNode(const Key& key, const Value& value, PackedAVLNode<Key, Value>* parent);
+    template<typename KeyArgs, typename ValueArgs>
+    PackedAVLNode(std::piecewise_construct_t, KeyArgs keyArgs, ValueArgs valueArgs, PackedAVLNode<Key, Value>* parent);
+
+    const std::pair<const Key, Value>& getItem() const;
+    std::pair<const Key, Value>& getItem();
+    const Key& getKey() const;
+    const Value& getValue() const;
+    Value& getValue();
+    void setValue(const Value &value);
+
+    PackedAVLNode<Key, Value>* getParent() const;
+    PackedAVLNode<Key, Value>* getLeft() const;
+    PackedAVLNode<Key, Value>* getRight() const;
+
+    void setParent(PackedAVLNode<Key, Value>* parent);
+    void setLeft(PackedAVLNode<Key, Value>* left);
+    void setRight(PackedAVLNode<Key, Value>* right);
+
+    int8_t getBalance () const;
+    void setBalance (int8_t balance);
+    void updateBalance(int8_t diff);
+
 protected:
-    virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
-    // Add helper functions here
-    void leftRotation(AVLNode<Key, Value>* node); 
-    void rightRotation(AVLNode<Key, Value>* node); 
-    void insertionRebalance(AVLNode<Key, Value> *parent, AVLNode<Key, Value>* node);
-    void removalRebalance(AVLNode<Key, Value>* node, int difference);
+    static const uintptr_t BalanceMask = 7; //balance + BalanceBias, 0 to 4
+    static const int BalanceBias = 2;
 
+    std::pair<const Key, Value> item_;
+    uintptr_t parentAndBalance_;
+    PackedAVLNode<Key, Value>* left_;
+    PackedAVLNode<Key, Value>* right_;
 };
 
 /*
- * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
- */
+  -------------------------------------------------
+  Begin implementations for the PackedAVLNode class.
+  -------------------------------------------------
+*/
+
+template<class Key, class Value>
+PackedAVLNode<Key, Value>::PackedAVLNode(const Key& key, const Value& value, PackedAVLNode<Key, Value>* parent) :
+    item_(key, value),
+    parentAndBalance_(reinterpret_cast<uintptr_t>(parent) | BalanceBias),
+    left_(NULL),
+    right_(NULL)
+{
+    static_assert(alignof(PackedAVLNode<Key, Value>) > BalanceMask, "the balance needs three free bits in a node address");
+}
+
+/**
+* Piecewise constructor, see Node.
+*/
+template<class Key, class Value>
+template<typename KeyArgs, typename ValueArgs>
+PackedAVLNode<Key, Value>::PackedAVLNode(std::piecewise_construct_t, KeyArgs keyArgs, ValueArgs valueArgs, PackedAVLNode<Key, Value>* parent) :
+    item_(std::piecewise_construct, std::move(keyArgs), std::move(valueArgs)),
+    parentAndBalance_(reinterpret_cast<uintptr_t>(parent) | BalanceBias),
+    left_(NULL),
+    right_(NULL)
+{
+    static_assert(alignof(PackedAVLNode<Key, Value>) > BalanceMask, "the balance needs three free bits in a node address");
+}
+
+template<class Key, class Value>
+const std::pair<const Key, Value>& PackedAVLNode<Key, Value>::getItem() const
+{
+    return item_;
+}
+
+template<class Key, class Value>
+std::pair<const Key, Value>& PackedAVLNode<Key, Value>::getItem()
+{
+    return item_;
+}
+
+template<class Key, class Value>
+const Key& PackedAVLNode<Key, Value>::getKey() const
+{
+    return item_.first;
+}
+
+template<class Key, class Value>
+const Value& PackedAVLNode<Key, Value>::getValue() const
+{
+    return item_.second;
+}
+
+template<class Key, class Value>
+Value& PackedAVLNode<Key, Value>::getValue()
+{
+    return item_.second;
+}
+
+template<class Key, class Value>
+void PackedAVLNode<Key, Value>::setValue(const Value& value)
+{
+    item_.second = value;
+}
+
+/**
+* Masks the balance off the parent word.
+*/
+template<class Key, class Value>
+PackedAVLNode<Key, Value>* PackedAVLNode<Key, Value>::getParent() const
+{
+    return reinterpret_cast<PackedAVLNode<Key, Value>*>(parentAndBalance_ & ~BalanceMask);
+}
+
+template<class Key, class Value>
+PackedAVLNode<Key, Value>* PackedAVLNode<Key, Value>::getLeft() const
+{
+    return left_;
+}
+
+template<class Key, class Value>
+PackedAVLNode<Key, Value>* PackedAVLNode<Key, Value>::getRight() const
+{
+    return right_;
+}
+
+/**
+* Replaces the parent and keeps the balance.
+*/
 template<class Key, class Value>
-void AVLTree<Key, Value>::insert(const std::pair<const Key, Value> &new_item)
+void PackedAVLNode<Key, Value>::setParent(PackedAVLNode<Key, Value>* parent)
 {
-  //copied from bst.h and modified. Modified things will have comments. See bst.h comments for more detail 
-    AVLNode<Key, Value>* newNode = new AVLNode<Key, Value>(new_item.first, new_item.second, NULL); 
-    newNode->setBalance(0); //default balance 0 
-    if(this->root_ == NULL) 
+    parentAndBalance_ = reinterpret_cast<uintptr_t>(parent) | (parentAndBalance_ & BalanceMask);
+}
+
+template<class Key, class Value>
+void PackedAVLNode<Key, Value>::setLeft(PackedAVLNode<Key, Value>* left)
+{
+    left_ = left;
+}
+
+template<class Key, class Value>
+void PackedAVLNode<Key, Value>::setRight(PackedAVLNode<Key, Value>* right)
+{
+    right_ = right;
+}
+
+template<class Key, class Value>
+int8_t PackedAVLNode<Key, Value>::getBalance() const
+{
+    return (int8_t)((int)(parentAndBalance_ & BalanceMask) - BalanceBias);
+}
+
+template<class Key, class Value>
+void PackedAVLNode<Key, Value>::setBalance(int8_t balance)
+{
+    parentAndBalance_ = (parentAndBalance_ & ~BalanceMask) | (uintptr_t)(balance + BalanceBias);
+}
+
+/**
+* The balance stays in range, so adding diff never carries into the parent
+* bits.
+*/
+template<class Key, class Value>
+void PackedAVLNode<Key, Value>::updateBalance(int8_t diff)
+{
+    parentAndBalance_ += (uintptr_t)(intptr_t)diff;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the PackedAVLNode class.
+  -----------------------------------------------
+*/
+
+/**
+* True when NodeType keeps subtree sizes (has getSize), which turns on the
+* order statistic queries of AVLTree and the bookkeeping behind them.
+*/
+template <typename NodeType, typename = void>
+struct CountsSubtrees : std::false_type
+{
+};
+
+template <typename NodeType>
+struct CountsSubtrees<NodeType, std::void_t<decltype(std::declval<const NodeType&>().getSize())> > : std::true_type
+{
+};
+
+
+template <class Key, class Value,
+          class Compare = std::less<Key>,
+          class Alloc = std::allocator<std::pair<const Key, Value> >,
+          class NodeType = AVLNode<Key, Value> >
+class AVLTree : public BinarySearchTree<Key, Value, Compare, Alloc, NodeType>
+{
+public:
+    typedef typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator iterator;
+
+    AVLTree();
+    explicit AVLTree(const Compare& comp, const Alloc& alloc = Alloc());
+    template<typename InputIt>
+    AVLTree(InputIt first, InputIt last, const Compare& comp = Compare(), const Alloc& alloc = Alloc());
+    virtual bool remove(const Key& key);  // TODO
+    template<typename InputIt>
+    void build(InputIt first, InputIt last);
+    template<typename InputIt>
+    void parallel_build(InputIt first, InputIt last, unsigned threads = 0);
+    template<typename InputIt>
+    void insert_batch(InputIt first, InputIt last);
+    std::pair<AVLTree, AVLTree> split(const Key& key);
+    static AVLTree join(AVLTree&& left, AVLTree&& right);
+    FrozenAVLTree<Key, Value, Compare> freeze() const;
+    void save(const std::string& path) const;
+    void load(const std::string& path);
+
+    // Order statistics, O(log n). These need a node type that counts its
+    // subtree, such as CountedAVLNode (see CountedAVLTree).
+    std::size_t size() const;
+    iterator select(std::size_t k) const;
+    std::size_t rank(const Key& key) const;
+    std::size_t count_range(const Key& lo, const Key& hi) const;
+protected:
+    typedef typename std::vector<std::pair<Key, Value> >::iterator ItemIterator;
+    static const std::size_t PrefetchedPaths = 16; //keys whose paths prefetchPaths walks side by side
+
+    virtual void afterInsert(NodeType* node);
+    virtual void nodeSwap( NodeType* n1, NodeType* n2);
+    // Add helper functions here
+    void leftRotation(NodeType* node); 
+    void rightRotation(NodeType* node); 
+    void insertionRebalance(NodeType *parent, NodeType* node);
+    void removalRebalance(NodeType* node, int difference);
+    template<typename InputIt>
+    void buildFrom(InputIt first, InputIt last, unsigned tasks);
+    template<typename ForwardIt>
+    NodeType* buildSubtree(ForwardIt& it, std::size_t count, int& height);
+    template<typename ForwardIt>
+    NodeType* forkBuildSubtree(ForwardIt first, std::size_t count, int& height, unsigned tasks);
+    template<typename ForwardIt>
+    bool strictlyIncreasing(ForwardIt first, ForwardIt last, std::size_t& count) const;
+    void sortUnique(std::vector<std::pair<Key, Value> >& items) const;
+    template<typename ForwardIt>
+    void mergeSorted(ForwardIt first, ForwardIt last);
+    template<typename ForwardIt>
+    NodeType* mergeBatch(NodeType* node, int height, ForwardIt first, ForwardIt last, int& newHeight,
+                         bool prefetched = false);
+    template<typename RandomIt>
+    void prefetchPaths(NodeType* node, RandomIt first, RandomIt last) const;
+    NodeType* joinSubtrees(NodeType* left, int leftHeight, NodeType* mid,
+                           NodeType* right, int rightHeight, int& height);
+    NodeType* joinRight(NodeType* left, int leftHeight, NodeType* mid,
+                        NodeType* right, int rightHeight, int& height);
+    NodeType* joinLeft(NodeType* left, int leftHeight, NodeType* mid,
+                       NodeType* right, int rightHeight, int& height);
+    static NodeType* rotateLeftAt(NodeType* node);
+    static NodeType* rotateRightAt(NodeType* node);
+    static int subtreeHeight(NodeType* node);
+    static std::size_t subtreeSize(NodeType* node);
+    static void recount(NodeType* node);
+    static void adjustSizes(NodeType* node, int delta);
+    void splitSubtree(NodeType* node, int height, const Key& key,
+                      NodeType*& less, int& lessHeight, NodeType*& rest, int& restHeight);
+    NodeType* splitLast(NodeType* node, int height, NodeType*& last, int& newHeight);
+    void relinkBalanced();
+    static NodeType* relinkSubtree(typename std::vector<NodeType*>::iterator& it,
+                                   std::size_t count, int& height);
+
+};
+
+/**
+* An AVLTree whose nodes count their subtrees, for size, select, rank and
+* count_range.
+*/
+template <class Key, class Value,
+          class Compare = std::less<Key>,
+          class Alloc = std::allocator<std::pair<const Key, Value> > >
+using CountedAVLTree = AVLTree<Key, Value, Compare, Alloc, CountedAVLNode<Key, Value> >;
+
+/**
+* An AVLTree whose nodes keep their balance in spare parent pointer bits.
+*/
+template <class Key, class Value,
+          class Compare = std::less<Key>,
+          class Alloc = std::allocator<std::pair<const Key, Value> > >
+using PackedAVLTree = AVLTree<Key, Value, Compare, Alloc, PackedAVLNode<Key, Value> >;
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+AVLTree<Key, Value, Compare, Alloc, NodeType>::AVLTree()
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+AVLTree<Key, Value, Compare, Alloc, NodeType>::AVLTree(const Compare& comp, const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>(comp, alloc)
+{
+
+}
+
+/**
+* Range constructor. Builds the tree from the key/value pairs in
+* [first, last) in one go; see build.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename InputIt>
+AVLTree<Key, Value, Compare, Alloc, NodeType>::AVLTree(InputIt first, InputIt last, const Compare& comp, const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>(comp, alloc)
+{
+    build(first, last);
+}
+
+/**
+* Replaces the contents of the tree with the key/value pairs in [first, last).
+* When the range is already sorted by key with no repeats, the nodes are
+* linked up in order into a perfectly height-balanced tree in O(n), with no
+* comparisons beyond the sortedness check and no rotations. Anything else
+* (unsorted input, repeated keys, or a single pass range) is first copied
+* out, sorted and deduplicated, keeping the last value given for a key just
+* like repeated insert would. If building throws, the tree is left as it was.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename InputIt>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::build(InputIt first, InputIt last)
+{
+    buildFrom(first, last, 1);
+}
+
+/**
+* build, with the nodes created and linked by up to threads threads (0 means
+* one per hardware thread). The sorted items are split the same way build
+* splits them: the middle item becomes the root, the two halves are built
+* as independent subtrees on forked tasks, and the root is linked over them
+* once both are done, so the resulting shape, balances and parent pointers
+* are exactly those of build. Only the node construction runs in parallel;
+* the sortedness check, and the sort for input that needs one, do not.
+* Trees whose allocator has state (SlabAllocator's pools are not locked)
+* and ranges without random access build on the calling thread.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename InputIt>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::parallel_build(InputIt first, InputIt last, unsigned threads)
+{
+    if (threads == 0)
     {
-        this->root_ = newNode; 
-        return; 
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    buildFrom(first, last, threads);
+}
+
+/**
+* The body of build and parallel_build, building on up to tasks threads.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename InputIt>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::buildFrom(InputIt first, InputIt last, unsigned tasks)
+{
+    typedef typename std::iterator_traits<InputIt>::value_type Item;
+    NodeType* built = NULL;
+    int height = 0;
+    bool sorted = false;
+    std::size_t count = 0;
+    if constexpr (IsForwardIterator<InputIt>::value &&
+                  std::is_same<typename std::decay<typename Item::first_type>::type, Key>::value)
+    {
+        sorted = strictlyIncreasing(first, last, count);
+        if (sorted)
+        {
+            built = forkBuildSubtree(first, count, height, tasks);
+        }
+    }
+    if (!sorted)
+    {
+        std::vector<std::pair<Key, Value> > items(first, last);
+        sortUnique(items);
+        count = items.size();
+        built = forkBuildSubtree(std::move_iterator<ItemIterator>(items.begin()), count, height, tasks);
+    }
+
+    NodeType* old = this->root_;
+    this->root_ = built;
+    this->clearHelper(old); //the pool now holds the new nodes too, so the old ones go one by one
+}
+
+/**
+* Returns true if the keys of [first, last) strictly increase, with count
+* set to the number of items. Stops at the first key out of order.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename ForwardIt>
+bool AVLTree<Key, Value, Compare, Alloc, NodeType>::strictlyIncreasing(ForwardIt first, ForwardIt last,
+                                                                       std::size_t& count) const
+{
+    count = 0;
+    for (ForwardIt prev = first, it = first; it != last; prev = it)
+    {
+        ++count;
+        if (++it != last && !this->comp_(prev->first, it->first))
+        {
+            return false;
+        }
     }
-    else 
+    return true;
+}
+
+/**
+* Consumes count items from it, which must be in strictly increasing key
+* order, and returns the root of a tree holding them. The middle item
+* becomes the root (the right half gets the extra one when count is even)
+* so the two halves differ in size by at most one and every balance ends up
+* 0 or +1. height is set to the height of the returned subtree. Nodes are
+* created in key order, which also lays them out in order in a slab pool.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename ForwardIt>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::buildSubtree(ForwardIt& it, std::size_t count, int& height)
+{
+    if (count == 0)
     {
-        AVLNode<Key, Value>* current = static_cast<AVLNode<Key,Value>*>(this->root_); 
+        height = 0;
+        return NULL;
+    }
+    std::size_t leftCount = (count - 1) / 2;
+    int leftHeight = 0;
+    int rightHeight = 0;
+    NodeType* left = buildSubtree(it, leftCount, leftHeight);
 
-        while(true) //using break statements to get out of this while loop instead of clear condition 
+    NodeType* node = NULL;
+    try
+    {
+        auto&& item = *it;
+        node = this->createNode(NULL, std::forward_as_tuple(std::forward<decltype(item)>(item).first),
+                                std::forward_as_tuple(std::forward<decltype(item)>(item).second));
+    }
+    catch (...)
+    {
+        this->clearHelper(left);
+        throw;
+    }
+    ++it;
+    node->setLeft(left);
+    if (left != NULL)
+    {
+        left->setParent(node);
+    }
+
+    NodeType* right = NULL;
+    try
+    {
+        right = buildSubtree(it, count - 1 - leftCount, rightHeight);
+    }
+    catch (...)
+    {
+        this->clearHelper(node);
+        throw;
+    }
+    node->setRight(right);
+    if (right != NULL)
+    {
+        right->setParent(node);
+    }
+    node->setBalance((int8_t)(rightHeight - leftHeight));
+    recount(node);
+    height = std::max(leftHeight, rightHeight) + 1;
+    return node;
+}
+
+/**
+* buildSubtree split across up to tasks threads. The left half goes to a new
+* task while this thread builds the right half, and the middle node is
+* created once both have finished. Below a few thousand items, or once the
+* task budget is spent, the rest is left to buildSubtree. If any part
+* throws, the subtrees already built are freed and the exception is passed
+* on once every task has finished.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename ForwardIt>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::forkBuildSubtree(ForwardIt first, std::size_t count, int& height, unsigned tasks)
+{
+    const std::size_t minForkCount = 4096; //smaller subtrees are cheaper to build than to hand to a thread
+    typedef typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::NodeAllocatorTraits NodeAllocatorTraits;
+    if constexpr (std::is_base_of<std::random_access_iterator_tag,
+                                  typename std::iterator_traits<ForwardIt>::iterator_category>::value &&
+                  NodeAllocatorTraits::is_always_equal::value) //stateless allocators share the thread safe global heap
+    {
+        if (tasks > 1 && count >= minForkCount)
         {
-            if(newNode->getKey() < current->getKey()) 
+            std::size_t leftCount = (count - 1) / 2;
+            int leftHeight = 0;
+            int rightHeight = 0;
+            std::future<NodeType*> leftTask = std::async(std::launch::async, [this, first, leftCount, &leftHeight, tasks]()
             {
-                if(current->getLeft() != NULL) //no room on the left, go down more left 
-                {
-                    current = current->getLeft(); 
-                }
-                else if (current->getLeft() == NULL) //room on the left 
-                {
-                    newNode->setParent(current); 
-                    current->setLeft(newNode); 
-                    break; 
-                }
+                return forkBuildSubtree(first, leftCount, leftHeight, tasks / 2);
+            });
+
+            NodeType* right = NULL;
+            try
+            {
+                right = forkBuildSubtree(first + (leftCount + 1), count - 1 - leftCount, rightHeight, tasks - tasks / 2);
             }
-            else if (newNode->getKey() > current->getKey())
+            catch (...)
             {
-                if (current->getRight() != NULL) 
+                try
                 {
-                    current = current->getRight(); 
+                    this->clearHelper(leftTask.get());
                 }
-                else if (current->getRight() == NULL)
+                catch (...)
                 {
-                    newNode->setParent(current); 
-                    current->setRight(newNode);
-                    break; 
                 }
+                throw;
+            }
+            NodeType* left = NULL;
+            try
+            {
+                left = leftTask.get();
+            }
+            catch (...)
+            {
+                this->clearHelper(right);
+                throw;
             }
-            else if (newNode->getKey() == current->getKey()) 
+
+            NodeType* node = NULL;
+            try
             {
-                current->setValue(newNode->getValue());
-                delete newNode; 
-                break; 
+                ForwardIt middle = first + leftCount;
+                auto&& item = *middle;
+                node = this->createNode(NULL, std::forward_as_tuple(std::forward<decltype(item)>(item).first),
+                                        std::forward_as_tuple(std::forward<decltype(item)>(item).second));
             }
+            catch (...)
+            {
+                this->clearHelper(left);
+                this->clearHelper(right);
+                throw;
+            }
+            node->setLeft(left);
+            left->setParent(node); //both halves are non-empty this far up
+            node->setRight(right);
+            right->setParent(node);
+            node->setBalance((int8_t)(rightHeight - leftHeight));
+            recount(node);
+            height = std::max(leftHeight, rightHeight) + 1;
+            return node;
         }
+    }
+    return buildSubtree(first, count, height);
+}
 
-        if (current->getBalance() == -1 || current->getBalance() == 1) 
+/**
+* Inserts every key/value pair in [first, last), overwriting the value of keys
+* already present just like insert. The batch is sorted once and merged into
+* the tree from the top down: each node splits what is left of the batch
+* around its own key, so neighbouring keys share the walk from the root, a
+* run of new keys that lands in one empty slot is built there as a balanced
+* subtree, and every subtree the batch touched is rebalanced once, when its
+* two halves are joined back together. m keys go into n in
+* O(m log(n/m + 1)) steps rather than O(m log n). A forward range whose
+* keys already strictly increase is merged as it is, without a copy or a
+* sort. Below the shared part of the walk, where a few keys are left for
+* a tall subtree, their paths are fetched side by side so the cache misses
+* overlap; that is what keeps sparse batches (10k keys into 10M) well
+* ahead of an insert loop.
+* If a key or value constructor throws, the keys merged so far stay in and
+* the tree is relinked so it is balanced again.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename InputIt>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::insert_batch(InputIt first, InputIt last)
+{
+    typedef typename std::iterator_traits<InputIt>::value_type Item;
+    if constexpr (IsForwardIterator<InputIt>::value &&
+                  std::is_same<typename std::decay<typename Item::first_type>::type, Key>::value)
+    {
+        std::size_t count = 0;
+        if (strictlyIncreasing(first, last, count)) //merge straight from the caller's range
         {
-          current->setBalance(0); //if parent of new node was unbalanced by 1 before it is now balanced. 
-          return; //nothing needs to be done 
+            mergeSorted(first, last);
+            return;
         }
-        else //if parent of new node was originally balanced 
+    }
+    std::vector<std::pair<Key, Value> > items(first, last);
+    sortUnique(items);
+    mergeSorted(std::move_iterator<ItemIterator>(items.begin()), std::move_iterator<ItemIterator>(items.end()));
+}
+
+/**
+* The body of insert_batch, for items already in strictly increasing key
+* order. Values are taken from the items the way the iterator hands them
+* out, so a move_iterator moves them.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename ForwardIt>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::mergeSorted(ForwardIt first, ForwardIt last)
+{
+    if (first == last)
+    {
+        return;
+    }
+    try
+    {
+        int height = 0;
+        this->root_ = mergeBatch(this->root_, subtreeHeight(this->root_), first, last, height);
+        this->root_->setParent(NULL);
+    }
+    catch (...)
+    {
+        relinkBalanced();
+        throw;
+    }
+}
+
+/**
+* Splits the tree in two around key: the first tree gets every key less than
+* key, the second every other key. Runs in O(log n) by cutting along the
+* search path for key and joining the pieces back up; nodes are relinked,
+* never copied or reallocated. This tree is left empty, and both halves
+* share its comparator and allocator. With a SlabAllocator both halves
+* hold its arena, so clearing the first one frees its nodes one at a time
+* and the last one to be cleared releases the arena at once.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+std::pair<AVLTree<Key, Value, Compare, Alloc, NodeType>, AVLTree<Key, Value, Compare, Alloc, NodeType> >
+AVLTree<Key, Value, Compare, Alloc, NodeType>::split(const Key& key)
+{
+    Alloc alloc(this->alloc_); //both parts share this tree's allocator, as the nodes must go back where they came from
+    std::pair<AVLTree, AVLTree> parts(AVLTree(this->comp_, alloc), AVLTree(this->comp_, alloc));
+    int lessHeight = 0;
+    int restHeight = 0;
+    splitSubtree(this->root_, subtreeHeight(this->root_), key,
+                 parts.first.root_, lessHeight, parts.second.root_, restHeight);
+    this->root_ = NULL;
+    if (parts.first.root_ != NULL)
+    {
+        parts.first.root_->setParent(NULL);
+    }
+    if (parts.second.root_ != NULL)
+    {
+        parts.second.root_->setParent(NULL);
+    }
+    parts.first.passHold(*this);
+    parts.second.passHold(*this);
+    return parts;
+}
+
+/**
+* Concatenates two trees, every key of left being less than every key of
+* right, and returns the result. The largest node of left is detached and
+* used to join the rest of left to right in O(log n), relinking nodes
+* without copying them; both arguments are left empty. Throws
+* std::invalid_argument if the key ranges overlap, or if the allocators
+* differ so that one tree could not free the other's nodes.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+AVLTree<Key, Value, Compare, Alloc, NodeType>
+AVLTree<Key, Value, Compare, Alloc, NodeType>::join(AVLTree&& left, AVLTree&& right)
+{
+    if (!(left.alloc_ == right.alloc_))
+    {
+        throw std::invalid_argument("AVLTree::join: trees use different allocators");
+    }
+    if (left.root_ != NULL && right.root_ != NULL)
+    {
+        NodeType* largest = left.root_;
+        while (largest->getRight() != NULL)
+        {
+            largest = largest->getRight();
+        }
+        if (!left.comp_(largest->getKey(), right.getSmallestNode()->getKey()))
         {
-          if (current->getLeft() == newNode) 
-          {
-            current->setBalance(-1); //-1 balance going left 
-          }
-          else 
-          {
-            current->setBalance(1); //+1 balance going right 
-          }
-          insertionRebalance(current, newNode); //call to balancing helper function at the end to see if new_node causes it's parent to be unbalanced 
+            throw std::invalid_argument("AVLTree::join: key ranges overlap");
         }
     }
+
+    AVLTree joined(std::move(left));
+    if (right.root_ == NULL)
+    {
+        return joined;
+    }
+    if (joined.root_ == NULL)
+    {
+        std::swap(joined.root_, right.root_);
+        joined.passHold(right);
+        return joined;
+    }
+    NodeType* mid = NULL;
+    int restHeight = 0;
+    int height = 0;
+    NodeType* rest = joined.splitLast(joined.root_, subtreeHeight(joined.root_), mid, restHeight);
+    joined.root_ = joined.joinSubtrees(rest, restHeight, mid, right.root_, subtreeHeight(right.root_), height);
+    joined.root_->setParent(NULL);
+    right.root_ = NULL;
+    joined.passHold(right);
+    return joined;
+}
+
+/**
+* Returns a read-only copy of the tree in Eytzinger order for fast lookups;
+* see FrozenAVLTree. The tree itself is unchanged and later changes to it
+* do not show up in the copy.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+FrozenAVLTree<Key, Value, Compare> AVLTree<Key, Value, Compare, Alloc, NodeType>::freeze() const
+{
+    return FrozenAVLTree<Key, Value, Compare>(this->begin(), this->end(), this->comp_);
+}
+
+/**
+* Writes every item to path in the snapshot format (see SnapshotHeader), in
+* key order and through one large buffer. The file is first written under a
+* temporary name and renamed over path once complete, so a failed save
+* leaves any earlier snapshot at path intact.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::save(const std::string& path) const
+{
+    std::string tempPath = path + ".tmp";
+    std::FILE* file = std::fopen(tempPath.c_str(), "wb");
+    if (file == NULL)
+    {
+        throw std::runtime_error("AVLTree::save: cannot open " + tempPath);
+    }
+    try
+    {
+        SnapshotHeader header;
+        std::memcpy(header.magic, "AVLSNAP", 8);
+        header.version = SnapshotHeader::Version;
+        header.byteOrder = SnapshotHeader::ByteOrderMark;
+        header.keySize = SnapshotFieldSize<Key>::value;
+        header.valueSize = SnapshotFieldSize<Value>::value;
+        header.count = 0;
+        if (std::fwrite(&header, sizeof(header), 1, file) != 1) //the count is filled in at the end
+        {
+            throw std::runtime_error("AVLTree::save: write failed");
+        }
+
+        SnapshotWriter writer(file);
+        for (NodeType* node = this->getSmallestNode(); node != NULL; node = this->successor(node))
+        {
+            writeSnapshotField(writer, node->getKey());
+            writeSnapshotField(writer, node->getValue());
+            ++header.count;
+        }
+        SnapshotChecksum checksum = writer.checksum();
+        checksum.update(&header, sizeof(header));
+        std::uint64_t sum = checksum.value();
+        writer.write(&sum, sizeof(sum));
+        writer.flush();
+        if (std::fseek(file, 0, SEEK_SET) != 0 || std::fwrite(&header, sizeof(header), 1, file) != 1)
+        {
+            throw std::runtime_error("AVLTree::save: write failed");
+        }
+    }
+    catch (...)
+    {
+        std::fclose(file);
+        std::remove(tempPath.c_str());
+        throw;
+    }
+    if (std::fclose(file) != 0 || std::rename(tempPath.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tempPath.c_str());
+        throw std::runtime_error("AVLTree::save: cannot write " + path);
+    }
+}
+
+/**
+* Replaces the tree's contents with a snapshot written by save. The items
+* arrive sorted, so they go straight into the linear build one at a time as
+* they are read, with no sorting and no copy of the whole file. Throws
+* std::runtime_error, leaving the tree unchanged, if the file cannot be
+* read, is not a snapshot of this key and value type, or fails its
+* checksum or order check.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::load(const std::string& path)
+{
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == NULL)
+    {
+        throw std::runtime_error("AVLTree::load: cannot open " + path);
+    }
+    NodeType* built = NULL;
+    try
+    {
+        SnapshotHeader header;
+        if (std::fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, "AVLSNAP", 8) != 0)
+        {
+            throw std::runtime_error("AVLTree::load: " + path + " is not a snapshot");
+        }
+        if (header.version != SnapshotHeader::Version || header.byteOrder != SnapshotHeader::ByteOrderMark)
+        {
+            throw std::runtime_error("AVLTree::load: unsupported snapshot version or byte order");
+        }
+        if (header.keySize != SnapshotFieldSize<Key>::value || header.valueSize != SnapshotFieldSize<Value>::value)
+        {
+            throw std::runtime_error("AVLTree::load: snapshot has different key or value types");
+        }
+
+        long start = std::ftell(file);
+        if (start < 0 || std::fseek(file, 0, SEEK_END) != 0)
+        {
+            throw std::runtime_error("AVLTree::load: cannot seek in " + path);
+        }
+        long fileSize = std::ftell(file);
+        if (fileSize < start || std::fseek(file, start, SEEK_SET) != 0)
+        {
+            throw std::runtime_error("AVLTree::load: cannot seek in " + path);
+        }
+        SnapshotReader reader(file, (std::uint64_t)(fileSize - start));
+        std::uint64_t itemBytes = reader.remaining() < sizeof(std::uint64_t) ? 0 : reader.remaining() - sizeof(std::uint64_t);
+        std::uint64_t minItemSize = SnapshotFieldMinSize<Key>::value + SnapshotFieldMinSize<Value>::value;
+        if (minItemSize != 0 && header.count > itemBytes / minItemSize)
+        {
+            throw std::runtime_error("AVLTree::load: item count does not fit in " + path);
+        }
+
+        int height = 0;
+        bool checkOrder = true;
+        if constexpr (SnapshotFieldSize<Key>::value != 0 && SnapshotFieldSize<Value>::value != 0)
+        {
+            FixedSnapshotItemIterator<Key, Value, Compare> reading(reader, header.count, this->comp_);
+            built = buildSubtree(reading, header.count, height); //the items are trivially copyable, so there is nothing to move
+            checkOrder = false; //done while reading
+        }
+        else
+        {
+            SnapshotItemIterator<Key, Value> reading(reader);
+            std::move_iterator<SnapshotItemIterator<Key, Value> > items(reading);
+            built = buildSubtree(items, header.count, height);
+        }
+        SnapshotChecksum checksum = reader.checksum();
+        checksum.update(&header, sizeof(header));
+        std::uint64_t sum = 0;
+        reader.read(&sum, sizeof(sum));
+        if (sum != checksum.value() || reader.remaining() != 0)
+        {
+            throw std::runtime_error("AVLTree::load: checksum mismatch in " + path);
+        }
+        NodeType* first = checkOrder ? built : NULL;
+        while (first != NULL && first->getLeft() != NULL)
+        {
+            first = first->getLeft();
+        }
+        NodeType* previous = NULL;
+        for (NodeType* node = first; node != NULL; node = this->successor(node))
+        {
+            if (previous != NULL && !this->comp_(previous->getKey(), node->getKey()))
+            {
+                throw std::runtime_error("AVLTree::load: keys are not in order");
+            }
+            previous = node;
+        }
+    }
+    catch (...)
+    {
+        std::fclose(file);
+        this->clearHelper(built);
+        throw;
+    }
+    std::fclose(file);
+
+    NodeType* old = this->root_;
+    this->root_ = built;
+    this->clearHelper(old);
+}
+
+/**
+* Returns the number of keys in the tree, in O(1).
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+std::size_t AVLTree<Key, Value, Compare, Alloc, NodeType>::size() const
+{
+    static_assert(CountsSubtrees<NodeType>::value, "size() needs a node type that counts its subtree, see CountedAVLTree");
+    return subtreeSize(this->root_);
+}
+
+/**
+* Returns an iterator to the k-th smallest key (counting from 0), or end()
+* if the tree holds k keys or fewer. Steers by the left subtree sizes, so it
+* takes one step per level.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename AVLTree<Key, Value, Compare, Alloc, NodeType>::iterator
+AVLTree<Key, Value, Compare, Alloc, NodeType>::select(std::size_t k) const
+{
+    static_assert(CountsSubtrees<NodeType>::value, "select() needs a node type that counts its subtree, see CountedAVLTree");
+    NodeType* node = this->root_;
+    while (node != NULL)
+    {
+        std::size_t leftSize = subtreeSize(node->getLeft());
+        if (k < leftSize)
+        {
+            node = node->getLeft();
+        }
+        else if (k == leftSize)
+        {
+            break;
+        }
+        else
+        {
+            k -= leftSize + 1; //skip the left subtree and node itself 
+            node = node->getRight();
+        }
+    }
+    return this->makeIterator(node);
+}
+
+/**
+* Returns how many keys in the tree are less than key, whether or not key
+* itself is present. Makes one comparison per level.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+std::size_t AVLTree<Key, Value, Compare, Alloc, NodeType>::rank(const Key& key) const
+{
+    static_assert(CountsSubtrees<NodeType>::value, "rank() needs a node type that counts its subtree, see CountedAVLTree");
+    std::size_t less = 0;
+    NodeType* node = this->root_;
+    while (node != NULL)
+    {
+        if (this->comp_(node->getKey(), key)) //node and everything left of it are less 
+        {
+            less += subtreeSize(node->getLeft()) + 1;
+            node = node->getRight();
+        }
+        else
+        {
+            node = node->getLeft();
+        }
+    }
+    return less;
+}
+
+/**
+* Returns how many keys k satisfy lo <= k < hi.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+std::size_t AVLTree<Key, Value, Compare, Alloc, NodeType>::count_range(const Key& lo, const Key& hi) const
+{
+    if (!this->comp_(lo, hi))
+    {
+        return 0;
+    }
+    return rank(hi) - rank(lo);
+}
+
+/*
+ * Insertion itself is shared with the BST (see emplaceUnique in bst.h), which
+ * only allocates once it knows the key is new. This fixes up the balances
+ * once the new leaf is linked in.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::afterInsert(NodeType* newNode)
+{
+    NodeType* current = newNode->getParent(); 
+    adjustSizes(current, 1); //sizes first, so rotations below recount from correct children 
+    if (current == NULL) //new root, nothing to balance 
+    {
+        return; 
+    }
+    if (current->getBalance() == -1 || current->getBalance() == 1) 
+    {
+      current->setBalance(0); //if parent of new node was unbalanced by 1 before it is now balanced. 
+      return; //nothing needs to be done 
+    }
+    else //if parent of new node was originally balanced 
+    {
+      if (current->getLeft() == newNode) 
+      {
+        current->setBalance(-1); //-1 balance going left 
+      }
+      else 
+      {
+        current->setBalance(1); //+1 balance going right 
+      }
+      insertionRebalance(current, newNode); //call to balancing helper function at the end to see if new_node causes it's parent to be unbalanced 
+    }
 }
 
 /*
  * Recall: The writeup specifies that if a node has 2 children you
  * should swap with the predecessor and then remove.
+ * Returns true if key was present.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>::remove(const Key& key)
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+bool AVLTree<Key, Value, Compare, Alloc, NodeType>::remove(const Key& key)
 {
-    AVLNode<Key, Value>* target = static_cast<AVLNode<Key,Value>*>(this->internalFind(key)); //point to node to be deleted 
-    int difference; //tracks differences in height 
+    NodeType* target = this->internalFind(key); //point to node to be deleted 
+    int difference = 0; //tracks differences in height 
     if (target == NULL) 
     {
-        return;  //if not found 
+        return false;  //if not found 
     }
     if (target->getLeft() && target->getRight()) //if two children, first swap. Other cases will handle the rest 
     {
-        AVLNode<Key, Value>* pred = static_cast<AVLNode<Key,Value>*>(this->predecessor(target));
+        NodeType* pred = this->predecessor(target);
         nodeSwap(target, pred);
     }
-    AVLNode<Key, Value>* child = target->getLeft(); //defaults to left but checks right since we want the largest child
+    NodeType* child = target->getLeft(); //defaults to left but checks right since we want the largest child
     if (target->getRight() != NULL) 
     {
         child = target->getRight(); //child will either be NULL or right child. 
     }
-    AVLNode<Key, Value>* parent = target->getParent();
+    NodeType* parent = target->getParent();
     if (child != NULL)
     {
         child->setParent(parent); // if there is a right child it's parent will be the target's (now swapped) parent
@@ -264,19 +1302,21 @@ void AVLTree<Key, Value>::remove(const Key& key)
             difference = -1; //height going right is positive, but since we removed the difference is -1 
         }
     }
-    delete target; //actual deletion 
+    this->destroyNode(target); //actual deletion 
+    adjustSizes(parent, -1); //every ancestor lost one node 
 
   removalRebalance(parent, difference); //call to helper to see if parent of removed node is now unbalanced 
+  return true;
 }
 
-template <typename Key, typename Value> 
-void AVLTree<Key, Value>::leftRotation(AVLNode<Key, Value>* node)
+template <typename Key, typename Value, typename Compare, typename Alloc, typename NodeType> 
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::leftRotation(NodeType* node)
 {
   //to be used on a node with balance 2, meaning it's child has a balance of 1 and is the pivot of rotation. 
   //function takes in node and makes it the left subtree of its right child. 
     
-    AVLNode<Key, Value>* rightChild = node->getRight(); //copy of right child 
-    AVLNode<Key, Value>* parent = node->getParent(); //copy of parent
+    NodeType* rightChild = node->getRight(); //copy of right child 
+    NodeType* parent = node->getParent(); //copy of parent
     rightChild->setParent(parent); //"promotion"
 
     if (parent == NULL) //if parent is null that means it was our root that was inbalanced 
@@ -292,7 +1332,7 @@ void AVLTree<Key, Value>::leftRotation(AVLNode<Key, Value>* node)
         parent->setLeft(rightChild);
     }    
 
-    AVLNode<Key, Value>* temp = rightChild->getLeft();
+    NodeType* temp = rightChild->getLeft();
     rightChild->setLeft(node); //makes node the left subtree of pivot 
     node->setParent(rightChild); //closure of pointers
     node->setRight(temp); //makes any left grandchild now the right child of left subtree 
@@ -301,14 +1341,16 @@ void AVLTree<Key, Value>::leftRotation(AVLNode<Key, Value>* node)
     {
         temp->setParent(node); //if there is actually a left grandchild set its parent to the rotated node to complete 
     }
+    recount(node); //node is now below rightChild, so it goes first 
+    recount(rightChild); 
 }
 
-template <typename Key, typename Value> 
-void AVLTree<Key, Value>::rightRotation(AVLNode<Key, Value>* node)
+template <typename Key, typename Value, typename Compare, typename Alloc, typename NodeType> 
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::rightRotation(NodeType* node)
 {
   //this is a direct copy of leftRotation except right and left are switched idk 
-    AVLNode<Key, Value>* leftChild = node->getLeft(); 
-    AVLNode<Key, Value>* parent = node->getParent(); 
+    NodeType* leftChild = node->getLeft(); 
+    NodeType* parent = node->getParent(); 
     leftChild->setParent(parent); 
 
     if (parent == NULL) 
@@ -324,7 +1366,7 @@ void AVLTree<Key, Value>::rightRotation(AVLNode<Key, Value>* node)
         parent->setRight(leftChild);
     }    
 
-    AVLNode<Key, Value>* temp = leftChild->getRight();
+    NodeType* temp = leftChild->getRight();
     leftChild->setRight(node); 
     node->setParent(leftChild);
     node->setLeft(temp); 
@@ -333,246 +1375,667 @@ void AVLTree<Key, Value>::rightRotation(AVLNode<Key, Value>* node)
     {
         temp->setParent(node); 
     }
+    recount(node); 
+    recount(leftChild); 
 }
 
-template <typename Key, typename Value> 
-void AVLTree<Key, Value>::insertionRebalance(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* node)
+/*
+ * Called once node, a child of parent, has made parent's subtree one taller
+ * (parent's own balance is already updated). Walks up one grandparent at a
+ * time for as long as the subtrees keep growing, and stops at the first one
+ * that absorbs the growth or is rotated back to its old height.
+ */
+template <typename Key, typename Value, typename Compare, typename Alloc, typename NodeType> 
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::insertionRebalance(NodeType* parent, NodeType* node)
 {
-  if (parent == NULL || parent->getParent() == NULL) //edge case preventing sigsegv
+  NodeType* grandparent = parent->getParent(); 
+  while (grandparent != NULL) 
   {
-    return; 
-  }
-  AVLNode<Key, Value>* grandparent = parent->getParent(); //copy of grandparent for reference
-  
-  if (parent == grandparent->getLeft()) // if parent is the left child of grandparent
-  { 
-    grandparent->setBalance(grandparent->getBalance() - 1); //first subtract 1 from balance to reflect added grandchild
-    if (grandparent->getBalance() == 0) //if grandparent is now 0, its balanced--just return
-    {
+    if (parent == grandparent->getLeft()) // if parent is the left child of grandparent
+    { 
+      grandparent->updateBalance(-1); //reflect the taller left subtree 
+      int8_t balance = grandparent->getBalance(); 
+      if (balance == 0) //if grandparent is now 0, its balanced--just return
+      {
+        return; 
+      }
+      if (balance == -1) //grandparent got taller too, so carry on up the family tree 
+      {
+        node = parent; 
+        parent = grandparent; 
+        grandparent = grandparent->getParent(); 
+        continue; 
+      }
+      if (node == parent->getLeft()) //if added node is a left child, and balance of grandparent is -2  
+      {
+        rightRotation(grandparent); //call a single right rotation on the unbalanced grandparent
+        AVLBST_STAT(this->stats_.insertRotation(false);)
+        parent->setBalance(0); //after rightrotation, should be balanced. Set parent and gp balance to 0 
+        grandparent->setBalance(0);
+      } 
+      else //left-right rotation 
+      {
+        leftRotation(parent); 
+        rightRotation(grandparent);
+        AVLBST_STAT(this->stats_.insertRotation(true);)
+        int8_t nodeBalance = node->getBalance(); 
+        parent->setBalance(nodeBalance == 1 ? -1 : 0); //parent keeps node's left subtree 
+        grandparent->setBalance(nodeBalance == -1 ? 1 : 0); //grandparent takes node's right subtree 
+        node->setBalance(0); //at the end of left-right rotation the node should have 2 subtrees with balance 0 
+      }
+      return; //the rotated subtree is back to its height before the insert 
+    }
+    else //the mirror image, parent is the right child of grandparent 
+    { 
+      grandparent->updateBalance(1); 
+      int8_t balance = grandparent->getBalance(); 
+      if (balance == 0) 
+      {
+        return; 
+      }
+      if (balance == 1) 
+      {
+        node = parent; 
+        parent = grandparent; 
+        grandparent = grandparent->getParent(); 
+        continue; 
+      }
+      if (node == parent->getRight()) 
+      { 
+        leftRotation(grandparent); 
+        AVLBST_STAT(this->stats_.insertRotation(false);)
+        parent->setBalance(0); 
+        grandparent->setBalance(0);
+      } 
+      else //right-left rotation 
+      { 
+        rightRotation(parent); 
+        leftRotation(grandparent); 
+        AVLBST_STAT(this->stats_.insertRotation(true);)
+        int8_t nodeBalance = node->getBalance(); 
+        parent->setBalance(nodeBalance == -1 ? 1 : 0); 
+        grandparent->setBalance(nodeBalance == 1 ? -1 : 0); 
+        node->setBalance(0); 
+      }
       return; 
     }
-    if (grandparent->getBalance() == -1) //otherwise if grandparent is now -1 balance then recursively go up the family tree to fix above, which will be unbalanced now 
+  }
+}
+
+/*
+ * Called after a subtree of node lost one level of height: difference is +1
+ * when it was the left subtree and -1 when it was the right one. Fixes
+ * node's balance, rotating if it reached +-2, and carries on up the tree
+ * for as long as the subtree keeps getting shorter. It stops at the first
+ * node whose height is unchanged: one that was even, or one rotated around
+ * a child that was even.
+ */
+template <typename Key, typename Value, typename Compare, typename Alloc, typename NodeType> 
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::removalRebalance(NodeType* node, int difference)
+{
+  while (node != NULL) //NULL once we went past the root 
+  {
+    NodeType* parent = node->getParent(); //copy of parent for reference 
+    int differenceAfterRemoval = -1; //worked out now since a rotation will move node out from under parent
+    if (parent != NULL && node == parent->getLeft()) 
     {
-      insertionRebalance(grandparent, parent);
-      return;
+      differenceAfterRemoval = 1; 
     }
-    if (node == parent->getLeft()) //if added node is a left child, and balance of grandparent is neither 0 or +-1  
+    int balance = node->getBalance() + difference; 
+
+    if (balance == -1 || balance == 1) //was balanced, now leans one way but is just as tall 
     {
-      rightRotation(grandparent); //call a single right rotation on the unbalanced grandparent
-      parent->setBalance(0); //after rightrotation, should be balanced. Set parent and gp balance to 0 
-      grandparent->setBalance(0);
-    } 
-    else //under all other cases, grandparent is unbalanced by 2 or more and node is also unbalanced 
+      node->setBalance((int8_t)balance); 
+      return; 
+    }
+    if (balance == -2) //left side is now two taller 
     {
-      leftRotation(parent); //left-right rotation 
-      rightRotation(grandparent);
-
-      if (node->getBalance() == -1) //if after left-right node is -1
+      NodeType* child = node->getLeft(); 
+      int8_t childBalance = child->getBalance(); 
+      if (childBalance <= 0) //single right rotation 
       {
-        parent->setBalance(0); //parent is balanced since it now has a left subtree 
-        grandparent->setBalance(1); //grandparent is unbalanced 
-      } 
-      else if (node->getBalance() == 0) //if node is balanced after left-right 
+        rightRotation(node); 
+        AVLBST_STAT(this->stats_.removeRotation(false);)
+        if (childBalance == 0) //height is unchanged, stop here 
+        {
+          node->setBalance(-1); 
+          child->setBalance(1); 
+          return; 
+        }
+        node->setBalance(0); 
+        child->setBalance(0); 
+      }
+      else //left-right rotation 
       {
-        parent->setBalance(0); //set balances to 0 to reflect this 
-        grandparent->setBalance(0);
-      } 
+        NodeType* grandChild = child->getRight(); 
+        int8_t grandChildBalance = grandChild->getBalance(); 
+        leftRotation(child); 
+        rightRotation(node); 
+        AVLBST_STAT(this->stats_.removeRotation(true);)
+        node->setBalance(grandChildBalance == -1 ? 1 : 0); 
+        child->setBalance(grandChildBalance == 1 ? -1 : 0); 
+        grandChild->setBalance(0); 
+      }
+    }
+    else if (balance == 2) //the mirror image 
+    {
+      NodeType* child = node->getRight(); 
+      int8_t childBalance = child->getBalance(); 
+      if (childBalance >= 0) 
+      {
+        leftRotation(node); 
+        AVLBST_STAT(this->stats_.removeRotation(false);)
+        if (childBalance == 0) 
+        {
+          node->setBalance(1); 
+          child->setBalance(-1); 
+          return; 
+        }
+        node->setBalance(0); 
+        child->setBalance(0); 
+      }
       else 
       {
-        parent->setBalance(-1); //parent is the unbalanced one now with the only child being the node's child 
-        grandparent->setBalance(0); //grandparent remains balanced however. 
+        NodeType* grandChild = child->getLeft(); 
+        int8_t grandChildBalance = grandChild->getBalance(); 
+        rightRotation(child); 
+        leftRotation(node); 
+        AVLBST_STAT(this->stats_.removeRotation(true);)
+        node->setBalance(grandChildBalance == 1 ? -1 : 0); 
+        child->setBalance(grandChildBalance == -1 ? 1 : 0); 
+        grandChild->setBalance(0); 
       }
-            
-      node->setBalance(0); //at the end of left-right rotation the node should have 2 subtrees with balance 0 
     }
+    else //was leaning towards the side that shrank, so node got shorter too 
+    {
+      node->setBalance(0); 
+    }
+    node = parent; //in every case that gets here the subtree is one shorter than before 
+    difference = differenceAfterRemoval; 
   }
+}
 
-  else //otherwise if parent is the right child of grandparent 
-  { 
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::sortUnique(std::vector<std::pair<Key, Value> >& items) const
+{
+    std::stable_sort(items.begin(), items.end(),
+                     [this](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b)
+                     { return this->comp_(a.first, b.first); });
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < items.size(); ++i) //equal keys are adjacent and in input order
+    {
+        if (count > 0 && !this->comp_(items[count - 1].first, items[i].first))
+        {
+            items[count - 1].second = std::move(items[i].second);
+        }
+        else
+        {
+            if (count != i)
+            {
+                items[count] = std::move(items[i]);
+            }
+            ++count;
+        }
+    }
+    items.erase(items.begin() + count, items.end());
+}
 
-    grandparent->setBalance(grandparent->getBalance() + 1); //add 1 to the balance of grandparent since node was added to right subtree
-    if (grandparent->getBalance() == 0) 
+/**
+* Merges the sorted, duplicate free items [first, last) into the subtree at
+* node, whose height is given, and returns the new root of the subtree with
+* newHeight set to its height. The caller links the returned root to its
+* parent. Each child is relinked as soon as its half is merged, so the tree
+* stays a valid search tree (if not a balanced one) should a later half throw.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename ForwardIt>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::mergeBatch(NodeType* node, int height,
+                                                                    ForwardIt first, ForwardIt last, int& newHeight,
+                                                                    bool prefetched)
+{
+    typedef typename std::iterator_traits<ForwardIt>::value_type Item;
+    if (first == last) //nothing lands here, leave the subtree alone
     {
-      return; 
+        newHeight = height;
+        return node;
+    }
+    if (node == NULL) //a run of new keys with nothing between them in the tree
+    {
+        ForwardIt it(first);
+        return buildSubtree(it, std::distance(first, last), newHeight);
+    }
+    if constexpr (std::is_base_of<std::random_access_iterator_tag,
+                                  typename std::iterator_traits<ForwardIt>::iterator_category>::value)
+    {
+        //a few keys left for a tall subtree mostly walk paths of their own,
+        //one cache miss after another, so fetch those paths side by side first
+        if (!prefetched && height >= 8 && (std::size_t)(last - first) <= PrefetchedPaths)
+        {
+            prefetchPaths(node, first, last);
+            prefetched = true;
+        }
     }
 
-    if (grandparent->getBalance() == 1) //if balance of grandparent is 1 the it was balanced before and requires recursive call 
+    ForwardIt split = std::lower_bound(first, last, node->getKey(),
+                                       [this](const Item& item, const Key& key)
+                                       { return this->comp_(item.first, key); });
+    ForwardIt rightFirst = split;
+    if (split != last && !this->comp_(node->getKey(), split->first)) //key already here, overwrite like insert
     {
-      insertionRebalance(grandparent, parent); 
-      return;
+        node->getValue() = (*split).second; //moves if split is a move_iterator
+        ++rightFirst;
     }
 
-    if (node == parent->getRight()) //if added node is on the right AND grandparent balance is more than 1 
-    { 
-      leftRotation(grandparent); //left rotation once only 
-      parent->setBalance(0); //now balanced 
-      grandparent->setBalance(0);
-    } 
-    else //if added node is on the left and grandparent balance is more than 1
-    { 
-      rightRotation(parent); //right-left rotation 
-      leftRotation(grandparent); 
+    int leftHeight = height - 1 - (node->getBalance() > 0 ? 1 : 0);
+    int rightHeight = height - 1 - (node->getBalance() < 0 ? 1 : 0);
+    NodeType* left = mergeBatch(node->getLeft(), leftHeight, first, split, leftHeight, prefetched);
+    if (left != node->getLeft()) //an untouched child is left alone, it is usually not in cache
+    {
+        node->setLeft(left);
+        left->setParent(node);
+    }
+    NodeType* right = mergeBatch(node->getRight(), rightHeight, rightFirst, last, rightHeight, prefetched);
+    if (right != node->getRight())
+    {
+        node->setRight(right);
+        right->setParent(node);
+    }
+    return joinSubtrees(left, leftHeight, node, right, rightHeight, newHeight);
+}
 
-      if (node->getBalance() == 1) //now if node is still balance 1 
-      {
-        parent->setBalance(0); //parent is balanced after right-left 
-        grandparent->setBalance(-1); //grandparent still isn't 
-      } 
-      else if (node->getBalance() == 0) //if totally balanced 
-      {
-        parent->setBalance(0);
-        grandparent->setBalance(0);
-      } 
-      else //if node is "squiggled"
-      {
-        parent->setBalance(1); //parents have unequal subtrees 
-        grandparent->setBalance(0); //grandparents are balanced now. 
-      }
-            
-      node->setBalance(0); //set balance to 0 once process is over
+/**
+* Walks the search paths of the keys of [first, last), at most
+* PrefetchedPaths of them, down from node in lockstep: each round takes
+* every path one level further and prefetches the node it reaches, so the
+* cache misses of the paths overlap rather than queueing one behind the
+* other. mergeBatch then finds them in cache.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename RandomIt>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::prefetchPaths(NodeType* node, RandomIt first, RandomIt last) const
+{
+    NodeType* at[PrefetchedPaths];
+    std::size_t count = last - first;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        at[i] = node;
+    }
+    for (std::size_t active = count; active != 0; )
+    {
+        active = 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (at[i] == NULL)
+            {
+                continue;
+            }
+            const Key& key = first[i].first;
+            bool goLeft = this->comp_(key, at[i]->getKey());
+            if (!goLeft && !this->comp_(at[i]->getKey(), key)) //found, the path ends here
+            {
+                at[i] = NULL;
+                continue;
+            }
+            at[i] = childOf(at[i], goLeft);
+            if (at[i] != NULL)
+            {
+                __builtin_prefetch(at[i]);
+                asm volatile("" : : "r"(at[i])); //a walk that only prefetches has no side effects, so keep the compiler from dropping it
+                ++active;
+            }
+        }
     }
+}
 
-  }
+/**
+* Joins two AVL subtrees whose heights are given, every key in left being
+* less than mid's key and every key in right greater, into one AVL subtree
+* with mid between them. mid's old links are overwritten. Costs
+* O(|leftHeight - rightHeight|): the shorter tree is hung off the spine of
+* the taller one and balance is restored on the way back up. Returns the
+* new root (its parent pointer is for the caller to set) and its height.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::joinSubtrees(NodeType* left, int leftHeight,
+                                                                      NodeType* mid,
+                                                                      NodeType* right, int rightHeight,
+                                                                      int& height)
+{
+    if (leftHeight > rightHeight + 1)
+    {
+        return joinRight(left, leftHeight, mid, right, rightHeight, height);
+    }
+    if (rightHeight > leftHeight + 1)
+    {
+        return joinLeft(left, leftHeight, mid, right, rightHeight, height);
+    }
+    if (mid->getLeft() != left) //close enough in height to sit side by side under mid
+    {
+        mid->setLeft(left);
+        if (left != NULL)
+        {
+            left->setParent(mid);
+        }
+    }
+    if (mid->getRight() != right)
+    {
+        mid->setRight(right);
+        if (right != NULL)
+        {
+            right->setParent(mid);
+        }
+    }
+    mid->setBalance((int8_t)(rightHeight - leftHeight));
+    recount(mid);
+    height = std::max(leftHeight, rightHeight) + 1;
+    return mid;
+}
 
+/**
+* joinSubtrees for a left tree at least two taller than the right one: mid
+* and right are joined onto the right spine of left, fixing left up with a
+* single or double rotation if the spine grew too tall.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::joinRight(NodeType* left, int leftHeight,
+                                                                   NodeType* mid,
+                                                                   NodeType* right, int rightHeight,
+                                                                   int& height)
+{
+    int innerHeight = leftHeight - 1 - (left->getBalance() < 0 ? 1 : 0); //the spine side
+    int outerHeight = leftHeight - 1 - (left->getBalance() > 0 ? 1 : 0);
+    int joinedHeight = 0;
+    NodeType* joined = joinSubtrees(left->getRight(), innerHeight, mid, right, rightHeight, joinedHeight);
+    left->setRight(joined);
+    joined->setParent(left);
+    recount(left);
+    left->setBalance((int8_t)(joinedHeight - outerHeight));
+    if (joinedHeight <= outerHeight + 1)
+    {
+        height = std::max(outerHeight, joinedHeight) + 1;
+        return left;
+    }
+    if (joined->getBalance() < 0) //heavy on the inside, so rotate it outward first
+    {
+        left->setRight(rotateRightAt(joined));
+    }
+    NodeType* top = rotateLeftAt(left);
+    height = outerHeight + (top->getBalance() == 0 ? 2 : 3);
+    return top;
 }
 
-template <typename Key, typename Value> 
-void AVLTree<Key, Value>::removalRebalance(AVLNode<Key, Value>* node, int difference)
+/**
+* The mirror image of joinRight, for a right tree at least two taller.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::joinLeft(NodeType* left, int leftHeight,
+                                                                  NodeType* mid,
+                                                                  NodeType* right, int rightHeight,
+                                                                  int& height)
 {
-  if (node == NULL) //edge case 
-  {
-    return; 
-  }
-  AVLNode<Key, Value>* parent = node->getParent(); //copy of parent for reference 
-  AVLNode<Key, Value>* child; //temp to copy children onto 
-  int differenceAfterRemoval = -1;
-  if (parent != NULL && node == parent->getLeft()) //if removed node was left, difference will increase by 1, otherwise decrease by 1
-  {
-    differenceAfterRemoval = 1; 
-  }
+    int innerHeight = rightHeight - 1 - (right->getBalance() > 0 ? 1 : 0);
+    int outerHeight = rightHeight - 1 - (right->getBalance() < 0 ? 1 : 0);
+    int joinedHeight = 0;
+    NodeType* joined = joinSubtrees(left, leftHeight, mid, right->getLeft(), innerHeight, joinedHeight);
+    right->setLeft(joined);
+    joined->setParent(right);
+    recount(right);
+    right->setBalance((int8_t)(outerHeight - joinedHeight));
+    if (joinedHeight <= outerHeight + 1)
+    {
+        height = std::max(outerHeight, joinedHeight) + 1;
+        return right;
+    }
+    if (joined->getBalance() > 0)
+    {
+        right->setLeft(rotateLeftAt(joined));
+    }
+    NodeType* top = rotateRightAt(right);
+    height = outerHeight + (top->getBalance() == 0 ? 2 : 3);
+    return top;
+}
 
-  if (node->getBalance() + difference == -2) //negative balance of 2 
-  {
-    child = node->getLeft(); //set child as the left one since -2 balance
-    if (child->getBalance() == -1 || child->getBalance() == 0) //if child is -1 or 0 it means that 1 right rotation will fix things
+/**
+* Rotates the subtree at node to the left and returns its new root. Unlike
+* leftRotation it leaves node's parent (and root_) pointing where they did,
+* and it works out both new balances from the old ones, whatever they were.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::rotateLeftAt(NodeType* node)
+{
+    NodeType* pivot = node->getRight();
+    NodeType* inner = pivot->getLeft();
+    node->setRight(inner);
+    if (inner != NULL)
     {
-      rightRotation(node);
-      if(child->getBalance() == -1) //if child is still unbalanced it means that it is on a subtree that is unbalanced
-      {
-        node->setBalance(0); //node however will be balanced after right rotation
-        child->setBalance(0); //so will child 
-        removalRebalance(parent,differenceAfterRemoval); //but the grandparent of the node that was removed is unbalanced still and requires fixing
-      }
-      if(child->getBalance() == 0) //if the left child is now balanced 
-      {
-        node->setBalance(-1); //the node will have -1 balance 
-        child->setBalance(1); //the child will have +1 after right rotation 
+        inner->setParent(node);
+    }
+    pivot->setParent(node->getParent());
+    pivot->setLeft(node);
+    node->setParent(pivot);
+
+    int nodeBalance = node->getBalance() - 1 - std::max<int>(pivot->getBalance(), 0);
+    int pivotBalance = pivot->getBalance() - 1 + std::min(nodeBalance, 0);
+    node->setBalance((int8_t)nodeBalance);
+    pivot->setBalance((int8_t)pivotBalance);
+    recount(node);
+    recount(pivot);
+    return pivot;
+}
+
+/**
+* The mirror image of rotateLeftAt.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::rotateRightAt(NodeType* node)
+{
+    NodeType* pivot = node->getLeft();
+    NodeType* inner = pivot->getRight();
+    node->setLeft(inner);
+    if (inner != NULL)
+    {
+        inner->setParent(node);
+    }
+    pivot->setParent(node->getParent());
+    pivot->setRight(node);
+    node->setParent(pivot);
+
+    int nodeBalance = node->getBalance() + 1 - std::min<int>(pivot->getBalance(), 0);
+    int pivotBalance = pivot->getBalance() + 1 + std::max(nodeBalance, 0);
+    node->setBalance((int8_t)nodeBalance);
+    pivot->setBalance((int8_t)pivotBalance);
+    recount(node);
+    recount(pivot);
+    return pivot;
+}
+
+/**
+* Height of an AVL subtree in O(log n), following the balances down the
+* taller side.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+int AVLTree<Key, Value, Compare, Alloc, NodeType>::subtreeHeight(NodeType* node)
+{
+    int height = 0;
+    while (node != NULL)
+    {
+        ++height;
+        node = node->getBalance() < 0 ? node->getLeft() : node->getRight();
+    }
+    return height;
+}
+
+/**
+* Number of nodes in the subtree at node, which may be NULL. Only for node
+* types that count their subtrees.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+std::size_t AVLTree<Key, Value, Compare, Alloc, NodeType>::subtreeSize(NodeType* node)
+{
+    return node != NULL ? node->getSize() : 0;
+}
+
+/**
+* Recomputes node's subtree size from its children. A no-op for node types
+* that keep no sizes, so the balancing code can call it unconditionally.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::recount(NodeType* node)
+{
+    if constexpr (CountsSubtrees<NodeType>::value)
+    {
+        node->setSize((uint32_t)(1 + subtreeSize(node->getLeft()) + subtreeSize(node->getRight())));
+    }
+}
+
+/**
+* Adds delta to the subtree size of node and every ancestor of it, after a
+* node was linked in below node or unlinked from below it. A no-op for node
+* types that keep no sizes.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::adjustSizes(NodeType* node, int delta)
+{
+    if constexpr (CountsSubtrees<NodeType>::value)
+    {
+        for (; node != NULL; node = node->getParent())
+        {
+            node->setSize((uint32_t)(node->getSize() + delta));
+        }
+    }
+}
+
+/**
+* Splits the subtree at node, of the given height, into the keys less than
+* key and the rest, returning both roots and heights. On the way back up
+* each node is joined to the side it belongs on together with its other
+* subtree, and the join costs telescope to O(log n) in total.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::splitSubtree(NodeType* node, int height, const Key& key,
+                                                                 NodeType*& less, int& lessHeight,
+                                                                 NodeType*& rest, int& restHeight)
+{
+    if (node == NULL)
+    {
+        less = NULL;
+        rest = NULL;
+        lessHeight = 0;
+        restHeight = 0;
         return;
-      }
     }
-    else //if child has unbalance of +-2 
+    int leftHeight = height - 1 - (node->getBalance() > 0 ? 1 : 0);
+    int rightHeight = height - 1 - (node->getBalance() < 0 ? 1 : 0);
+    if (this->comp_(node->getKey(), key)) //node and its left subtree are all less than key
     {
-      AVLNode<Key, Value>* rightGrandChild = child->getRight();
-      leftRotation(child); //left-right rotation 
-      rightRotation(node);
-      if (rightGrandChild->getBalance() == 1) //if rightgrandchild had a balance of 1 
-      {
-        node->setBalance(0); //rebalance node to 0 after left-right 
-        child->setBalance(-1); //now -1 since child now has node has a left subtree 
-        rightGrandChild->setBalance(0); //now balanced 
-      }
-      if (rightGrandChild->getBalance() == 0) //if all balanced all good. 
-      {
-        node->setBalance(0);
-        child->setBalance(0);
-        rightGrandChild->setBalance(0);
-      }
-      if (rightGrandChild->getBalance() == 1) //possible error here 
-      {
-        node->setBalance(1);
-        child->setBalance(0);
-        rightGrandChild->setBalance(0);
-      }
-      removalRebalance(parent,differenceAfterRemoval);
+        NodeType* lessRight = NULL;
+        int lessRightHeight = 0;
+        splitSubtree(node->getRight(), rightHeight, key, lessRight, lessRightHeight, rest, restHeight);
+        less = joinSubtrees(node->getLeft(), leftHeight, node, lessRight, lessRightHeight, lessHeight);
     }
-  }
-  else if (node->getBalance() == 0)
-  {
-    node->setBalance(node->getBalance() + difference);
-    return;
-  }
-  else
-  {
-    node->setBalance(0);
-    removalRebalance(parent,differenceAfterRemoval);
-  }
+    else //node and its right subtree all belong to the rest
+    {
+        NodeType* restLeft = NULL;
+        int restLeftHeight = 0;
+        splitSubtree(node->getLeft(), leftHeight, key, less, lessHeight, restLeft, restLeftHeight);
+        rest = joinSubtrees(restLeft, restLeftHeight, node, node->getRight(), rightHeight, restHeight);
+    }
+}
 
-  if (node->getBalance() + difference == 2) //positive balance of 2 
-  {
-    child = node->getRight();
-    if (child->getBalance() == 1 || child->getBalance() == 0)
+/**
+* Detaches the largest node of the subtree at node into last and returns
+* the root and height of what remains.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::splitLast(NodeType* node, int height,
+                                                                   NodeType*& last, int& newHeight)
+{
+    if (node->getRight() == NULL)
+    {
+        NodeType* left = node->getLeft();
+        node->setLeft(NULL); //last is about to be reused as a join point, so it must not keep stale links
+        last = node;
+        newHeight = height - 1;
+        return left;
+    }
+    int leftHeight = height - 1 - (node->getBalance() > 0 ? 1 : 0);
+    int rightHeight = height - 1 - (node->getBalance() < 0 ? 1 : 0);
+    int restHeight = 0;
+    NodeType* rest = splitLast(node->getRight(), rightHeight, last, restHeight);
+    return joinSubtrees(node->getLeft(), leftHeight, node, rest, restHeight, newHeight);
+}
+
+/**
+* Relinks every node into a perfectly balanced shape, without moving any
+* items. Used to get the balances right again when a batch merge was cut
+* short by an exception.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::relinkBalanced()
+{
+    if (this->root_ == NULL)
     {
-      leftRotation(node);
-      if(child->getBalance() == 1)
-      {
-        node->setBalance(0);
-        child->setBalance(0);
-        removalRebalance(parent,differenceAfterRemoval);
-      }
-      if(child->getBalance() == 0)
-      {
-        node->setBalance(1);
-        child->setBalance(-1);
         return;
-      }
     }
-    else
+    std::vector<NodeType*> nodes;
+    for (NodeType* node = this->getSmallestNode(); node != NULL; node = this->successor(node))
     {
-      AVLNode<Key, Value>* leftGrandChild = child->getLeft();
-      rightRotation(child);
-      leftRotation(node);            
-      if (leftGrandChild->getBalance() == -1)
-      {
-        node->setBalance(0);
-        child->setBalance(1);
-        leftGrandChild->setBalance(0);
-      }
-      if(leftGrandChild->getBalance() == 0)
-      {
-        node->setBalance(0);
-        child->setBalance(0);
-        leftGrandChild->setBalance(0);
-      }
-      if (leftGrandChild->getBalance() == -1)
-      {
-        node->setBalance(-1);
-        child->setBalance(0);
-        leftGrandChild->setBalance(0);
-      }
-      removalRebalance(parent,differenceAfterRemoval);
+        nodes.push_back(node);
     }
-  }
-  else if (node->getBalance() == 0)
-  {
-    node->setBalance(node->getBalance() + difference);
-    return;
-  }
-  else
-  {
-    node->setBalance(0);
-    removalRebalance(parent,differenceAfterRemoval);
-  }
+    typename std::vector<NodeType*>::iterator it = nodes.begin();
+    int height = 0;
+    this->root_ = relinkSubtree(it, nodes.size(), height);
+    this->root_->setParent(NULL);
+}
 
+/**
+* buildSubtree for nodes that already exist: links count nodes taken in
+* order from it into a perfectly balanced subtree and returns its root.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::relinkSubtree(typename std::vector<NodeType*>::iterator& it,
+                                                                       std::size_t count, int& height)
+{
+    if (count == 0)
+    {
+        height = 0;
+        return NULL;
+    }
+    std::size_t leftCount = (count - 1) / 2;
+    int leftHeight = 0;
+    int rightHeight = 0;
+    NodeType* left = relinkSubtree(it, leftCount, leftHeight);
+    NodeType* node = *it++;
+    NodeType* right = relinkSubtree(it, count - 1 - leftCount, rightHeight);
+    node->setLeft(left);
+    node->setRight(right);
+    if (left != NULL)
+    {
+        left->setParent(node);
+    }
+    if (right != NULL)
+    {
+        right->setParent(node);
+    }
+    node->setBalance((int8_t)(rightHeight - leftHeight));
+    recount(node);
+    height = std::max(leftHeight, rightHeight) + 1;
+    return node;
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::nodeSwap( NodeType* n1, NodeType* n2)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::nodeSwap(n1, n2);
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
+    if constexpr (CountsSubtrees<NodeType>::value) //like the balance, a size belongs to the position 
+    {
+        uint32_t tempS = n1->getSize();
+        n1->setSize(n2->getSize());
+        n2->setSize(tempS);
+    }
 }
 
-
 #endif
@@ -0,0 +1,1538 @@
+#include <iostream>
+#include <string>
+#include <map>
+#include <string_view>
+#include <cstdio>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+#include <cstdint>
+#include <sys/resource.h>
+#include "bst.h"
+#include "avlbst.h"
+#include "concurrent_avlbst.h"
+#include "persistent_avlbst.h"
+#include "rcu_avlbst.h"
+#include "simd_avlbst.h"
+#include "compact_avlbst.h"
+#include "stack_avlbst.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start)
+{
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Peak resident set size of this process in MiB.
+static double peakRssMiB()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+// Inserts, overwrites, looks up and clears n random keys, printing throughput for each phase.
+template<typename Tree>
+void runInsertFindClear(const char* label, size_t n)
+{
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)i;
+    }
+    mt19937 gen(12345);
+    shuffle(keys.begin(), keys.end(), gen);
+
+    Tree* tree = new Tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree->insert(make_pair(keys[i], (int)i));
+    }
+    double insertSecs = secondsSince(start);
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree->insert(make_pair(keys[i], (int)i));
+    }
+    double overwriteSecs = secondsSince(start);
+
+    start = Clock::now();
+    long long checksum = 0;
+    for(size_t i = 0; i < n; ++i) {
+        checksum += (*tree)[keys[i]];
+    }
+    double findSecs = secondsSince(start);
+
+    start = Clock::now();
+    tree->clear();
+    double clearSecs = secondsSince(start);
+    double rss = peakRssMiB();
+    delete tree;
+
+    cout << label << " n=" << n
+         << " insert=" << n / insertSecs / 1e6 << "Mops/s"
+         << " overwrite=" << n / overwriteSecs / 1e6 << "Mops/s"
+         << " find=" << n / findSecs / 1e6 << "Mops/s"
+         << " clear=" << clearSecs * 1e3 << "ms"
+         << " peakRSS=" << rss << "MiB"
+         << " (checksum " << checksum << ")" << endl;
+}
+
+// A transparent std::less that counts how often it is called.
+struct CountingLess
+{
+    typedef void is_transparent;
+    static unsigned long long calls;
+
+    template<typename A, typename B>
+    bool operator()(const A& a, const B& b) const
+    {
+        ++calls;
+        return a < b;
+    }
+};
+unsigned long long CountingLess::calls = 0;
+
+// Inserts and looks up n string keys sharing a long common prefix, reporting
+// key comparisons per operation. Lookups are made both with std::string and
+// with string_view, which goes through the heterogeneous find.
+void runStringKeys(size_t n)
+{
+    vector<string> keys(n);
+    char buf[32];
+    for(size_t i = 0; i < n; ++i) {
+        snprintf(buf, sizeof(buf), "user:%012zu", i);
+        keys[i] = buf;
+    }
+    mt19937 gen(12345);
+    shuffle(keys.begin(), keys.end(), gen);
+
+    AVLTree<string, int, CountingLess> tree;
+    CountingLess::calls = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    double insertSecs = secondsSince(start);
+    double insertCmps = (double)CountingLess::calls / n;
+
+    CountingLess::calls = 0;
+    start = Clock::now();
+    long long checksum = 0;
+    for(size_t i = 0; i < n; ++i) {
+        checksum += tree.find(keys[i])->second;
+    }
+    double findSecs = secondsSince(start);
+    double findCmps = (double)CountingLess::calls / n;
+
+    CountingLess::calls = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        checksum += tree.find(string_view(keys[i]))->second;
+    }
+    double viewSecs = secondsSince(start);
+
+    cout << "AVLTree/string n=" << n
+         << " insert=" << n / insertSecs / 1e6 << "Mops/s (" << insertCmps << " cmp/op)"
+         << " find=" << n / findSecs / 1e6 << "Mops/s (" << findCmps << " cmp/op)"
+         << " find(string_view)=" << n / viewSecs / 1e6 << "Mops/s"
+         << " (checksum " << checksum << ")" << endl;
+}
+
+// Loads n already sorted keys once by calling insert per key and once with
+// the linear time AVLTree::build.
+void runSortedLoad(size_t n)
+{
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)i, (int)i);
+    }
+
+    AVLTree<int, int>* tree = new AVLTree<int, int>;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree->insert(items[i]);
+    }
+    double insertSecs = secondsSince(start);
+    delete tree;
+
+    tree = new AVLTree<int, int>;
+    start = Clock::now();
+    tree->build(items.begin(), items.end());
+    double buildSecs = secondsSince(start);
+    long long checksum = (*tree)[(int)(n / 2)];
+    delete tree;
+
+    reverse(items.begin(), items.end());
+    tree = new AVLTree<int, int>;
+    start = Clock::now();
+    tree->build(items.begin(), items.end());
+    double unsortedSecs = secondsSince(start);
+    checksum += (*tree)[(int)(n / 2)];
+    delete tree;
+
+    cout << "AVLTree/sorted-load n=" << n
+         << " insert-loop=" << insertSecs * 1e3 << "ms"
+         << " build=" << buildSecs * 1e3 << "ms"
+         << " build(reversed)=" << unsortedSecs * 1e3 << "ms"
+         << " (checksum " << checksum << ")" << endl;
+}
+
+// Ingests batches of random keys into a tree already holding n keys, once with
+// an insert per key and once with insert_batch, for a few batch sizes.
+void runBatchIngest(size_t n)
+{
+    const size_t batchSizes[] = { 10000, 100000, 1000000 };
+    mt19937 gen(12345);
+    vector<pair<int, int> > base(n);
+    for(size_t i = 0; i < n; ++i) {
+        base[i] = make_pair((int)(i * 2), (int)i); // batches use odd keys, so every batch key is new
+    }
+    for(size_t b = 0; b < sizeof(batchSizes) / sizeof(batchSizes[0]); ++b) {
+        size_t m = batchSizes[b];
+        vector<pair<int, int> > batch(m);
+        for(size_t i = 0; i < m; ++i) {
+            batch[i] = make_pair((int)(gen() % n) * 2 + 1, (int)i);
+        }
+
+        double loopSecs;
+        {
+            AVLTree<int, int> loopTree(base.begin(), base.end()); // freed before the batch tree is built
+            Clock::time_point start = Clock::now();
+            for(size_t i = 0; i < m; ++i) {
+                loopTree.insert(batch[i]);
+            }
+            loopSecs = secondsSince(start);
+        }
+
+        AVLTree<int, int> batchTree(base.begin(), base.end());
+        Clock::time_point start = Clock::now();
+        batchTree.insert_batch(batch.begin(), batch.end());
+        double batchSecs = secondsSince(start);
+
+        cout << "AVLTree/batch n=" << n << " batch=" << m
+             << " insert-loop=" << m / loopSecs / 1e6 << "Mops/s"
+             << " insert_batch=" << m / batchSecs / 1e6 << "Mops/s"
+             << " speedup=" << loopSecs / batchSecs << "x" << endl;
+    }
+}
+
+// Splits a tree of n keys at random keys and joins the halves back together,
+// against carving it in two by walking it and inserting into two new trees.
+void runSplitJoin(size_t n)
+{
+    const size_t rounds = 1000;
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)i, (int)i);
+    }
+    typedef AVLTree<int, int> Tree;
+    Tree tree(items.begin(), items.end());
+    mt19937 gen(12345);
+
+    double splitSecs = 0;
+    double joinSecs = 0;
+    for(size_t r = 0; r < rounds; ++r) {
+        Clock::time_point start = Clock::now();
+        pair<Tree, Tree> parts = tree.split((int)(gen() % n));
+        splitSecs += secondsSince(start);
+        start = Clock::now();
+        tree = Tree::join(std::move(parts.first), std::move(parts.second));
+        joinSecs += secondsSince(start);
+    }
+
+    Clock::time_point start = Clock::now();
+    Tree lower;
+    Tree upper;
+    for(Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+        if(it->first < (int)(n / 2)) {
+            lower.insert(*it);
+        }
+        else {
+            upper.insert(*it);
+        }
+    }
+    double carveSecs = secondsSince(start);
+
+    cout << "AVLTree/split-join n=" << n
+         << " split=" << splitSecs / rounds * 1e6 << "us"
+         << " join=" << joinSecs / rounds * 1e6 << "us"
+         << " carve-by-insert=" << carveSecs * 1e6 << "us" << endl;
+}
+
+// Answers percentile queries (the key at rank k) and rank queries on a counted
+// tree of n keys, against walking k successors from begin() in the plain tree.
+void runRankSelect(size_t n)
+{
+    const size_t queries = 1000;
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)i, (int)i);
+    }
+    AVLTree<int, int> plain(items.begin(), items.end());
+    CountedAVLTree<int, int> counted(items.begin(), items.end());
+    mt19937 gen(12345);
+    vector<size_t> ranks(queries);
+    for(size_t i = 0; i < queries; ++i) {
+        ranks[i] = gen() % n;
+    }
+
+    Clock::time_point start = Clock::now();
+    long long checksum = 0;
+    for(size_t i = 0; i < queries; ++i) {
+        AVLTree<int, int>::iterator it = plain.begin();
+        for(size_t k = 0; k < ranks[i]; ++k) {
+            ++it;
+        }
+        checksum += it->first;
+    }
+    double walkSecs = secondsSince(start);
+
+    start = Clock::now();
+    for(size_t i = 0; i < queries; ++i) {
+        checksum -= counted.select(ranks[i])->first;
+    }
+    double selectSecs = secondsSince(start);
+
+    start = Clock::now();
+    for(size_t i = 0; i < queries; ++i) {
+        checksum += counted.rank((int)ranks[i]) - ranks[i];
+    }
+    double rankSecs = secondsSince(start);
+
+    cout << "AVLTree/rank n=" << n
+         << " successor-walk=" << walkSecs / queries * 1e6 << "us"
+         << " select=" << selectSecs / queries * 1e6 << "us"
+         << " rank=" << rankSecs / queries * 1e6 << "us"
+         << " (checksum " << checksum << ")" << endl;
+}
+
+// Scans ranges of 100 keys starting at random keys in a tree of n keys, once
+// by walking from begin() to the start of the range and once from lower_bound.
+void runRangeScan(size_t n)
+{
+    const size_t queries = 1000;
+    const int width = 100;
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)i, (int)i);
+    }
+    typedef AVLTree<int, int> Tree;
+    Tree tree(items.begin(), items.end());
+    mt19937 gen(12345);
+    vector<int> starts(queries);
+    for(size_t i = 0; i < queries; ++i) {
+        starts[i] = (int)(gen() % n);
+    }
+
+    Clock::time_point start = Clock::now();
+    long long checksum = 0;
+    for(size_t i = 0; i < queries; ++i) {
+        Tree::iterator it = tree.begin();
+        while(it != tree.end() && it->first < starts[i]) {
+            ++it;
+        }
+        for(; it != tree.end() && it->first < starts[i] + width; ++it) {
+            checksum += it->second;
+        }
+    }
+    double walkSecs = secondsSince(start);
+
+    start = Clock::now();
+    for(size_t i = 0; i < queries; ++i) {
+        Tree::iterator last = tree.lower_bound(starts[i] + width);
+        for(Tree::iterator it = tree.lower_bound(starts[i]); it != last; ++it) {
+            checksum -= it->second;
+        }
+    }
+    double boundSecs = secondsSince(start);
+
+    cout << "AVLTree/range n=" << n << " width=" << width
+         << " walk-from-begin=" << walkSecs / queries * 1e6 << "us"
+         << " lower_bound=" << boundSecs / queries * 1e6 << "us"
+         << " (checksum " << checksum << ")" << endl;
+}
+
+// Reads the latest 100 keys of a tree of n keys, newest first, once by
+// copying the whole tree into a vector and reversing it and once with rbegin.
+void runLatestEntries(size_t n)
+{
+    const size_t rounds = 100;
+    const size_t latest = 100;
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)i, (int)i);
+    }
+    typedef AVLTree<int, int> Tree;
+    Tree tree(items.begin(), items.end());
+
+    Clock::time_point start = Clock::now();
+    long long checksum = 0;
+    for(size_t r = 0; r < rounds; ++r) {
+        vector<pair<int, int> > copy(tree.begin(), tree.end());
+        reverse(copy.begin(), copy.end());
+        for(size_t i = 0; i < latest; ++i) {
+            checksum += copy[i].first;
+        }
+    }
+    double copySecs = secondsSince(start);
+
+    start = Clock::now();
+    for(size_t r = 0; r < rounds; ++r) {
+        Tree::reverse_iterator it = tree.rbegin();
+        for(size_t i = 0; i < latest; ++i, ++it) {
+            checksum -= it->first;
+        }
+    }
+    double reverseSecs = secondsSince(start);
+
+    cout << "AVLTree/latest n=" << n << " latest=" << latest
+         << " copy-and-reverse=" << copySecs / rounds * 1e6 << "us"
+         << " rbegin=" << reverseSecs / rounds * 1e6 << "us"
+         << " (checksum " << checksum << ")" << endl;
+}
+
+// Builds a tree from n sorted keys with build and with parallel_build on
+// 1, 2, 4, ... threads up to the number of hardware threads.
+void runParallelBuild(size_t n)
+{
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)i, (int)i);
+    }
+    typedef AVLTree<int, int> Tree;
+
+    Tree* tree = new Tree;
+    Clock::time_point start = Clock::now();
+    tree->build(items.begin(), items.end());
+    double buildSecs = secondsSince(start);
+    delete tree;
+    cout << "AVLTree/parallel-build n=" << n << " build=" << buildSecs * 1e3 << "ms";
+
+    unsigned hardware = max(1u, thread::hardware_concurrency());
+    for(unsigned threads = 1; ; threads *= 2) {
+        threads = min(threads, hardware);
+        tree = new Tree;
+        start = Clock::now();
+        tree->parallel_build(items.begin(), items.end(), threads);
+        double parallelSecs = secondsSince(start);
+        delete tree;
+        cout << " threads=" << threads << ":" << parallelSecs * 1e3 << "ms";
+        if(threads == hardware) {
+            break;
+        }
+    }
+    cout << endl;
+}
+
+// The baseline for runConcurrent: one AVLTree behind one mutex.
+struct LockedTree
+{
+    mutex lock;
+    AVLTree<int, int> tree;
+
+    bool find(int key, int& value)
+    {
+        lock_guard<mutex> guard(lock);
+        AVLTree<int, int>::iterator it = tree.find(key);
+        if(it == tree.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+    void insert(const pair<const int, int>& item)
+    {
+        lock_guard<mutex> guard(lock);
+        tree.insert(item);
+    }
+    void remove(int key)
+    {
+        lock_guard<mutex> guard(lock);
+        tree.remove(key);
+    }
+};
+
+// Runs opsPerThread operations on each of threads threads against map, 90%
+// lookups of existing keys and 10% insert/remove pairs of fresh keys, and
+// returns the total throughput in Mops/s.
+template<typename Map>
+double runMixedOps(Map& map, size_t n, unsigned threads, size_t opsPerThread)
+{
+    atomic<long long> checksum(0); //keeps the lookups from being optimized away
+    vector<thread> workers;
+    Clock::time_point start = Clock::now();
+    for(unsigned t = 0; t < threads; ++t) {
+        workers.push_back(thread([&map, &checksum, n, t, opsPerThread]() {
+            mt19937 gen(t + 1);
+            int value = 0;
+            long long sum = 0;
+            for(size_t i = 0; i < opsPerThread; ++i) {
+                int key = (int)(gen() % n);
+                if(i % 10 == 0) {
+                    int fresh = (int)(n + t * opsPerThread + i);
+                    map.insert(make_pair(fresh, key));
+                    map.remove(fresh);
+                }
+                else if(map.find(key, value)) {
+                    sum += value;
+                }
+            }
+            checksum += sum;
+        }));
+    }
+    for(size_t t = 0; t < workers.size(); ++t) {
+        workers[t].join();
+    }
+    double mops = threads * opsPerThread / secondsSince(start) / 1e6;
+    if(checksum == -1) {
+        cout << "impossible checksum" << endl;
+    }
+    return mops;
+}
+
+// Scales a read-mostly workload on a map of n keys from 1 thread up to the
+// number of hardware threads, for a globally locked AVLTree and for the
+// sharded ConcurrentAVLTree.
+void runConcurrent(size_t n)
+{
+    const size_t opsPerThread = 1000000;
+    LockedTree locked;
+    ConcurrentAVLTree<int, int> sharded;
+    for(size_t i = 0; i < n; ++i) {
+        locked.tree.insert(make_pair((int)i, (int)i));
+        sharded.insert(make_pair((int)i, (int)i));
+    }
+    unsigned hardware = max(1u, thread::hardware_concurrency());
+    for(unsigned threads = 1; ; threads *= 2) {
+        threads = min(threads, hardware);
+        cout << "AVLTree/concurrent n=" << n << " threads=" << threads
+             << " global-mutex=" << runMixedOps(locked, n, threads, opsPerThread) << "Mops/s"
+             << " sharded=" << runMixedOps(sharded, n, threads, opsPerThread) << "Mops/s" << endl;
+        if(threads == hardware) {
+            break;
+        }
+    }
+}
+
+// Takes 100 point-in-time copies of a tree of n keys while writing to it,
+// once by deep copying an AVLTree and once with PersistentAVLTree::snapshot,
+// and compares random insert throughput of the two trees.
+void runSnapshots(size_t n)
+{
+    const size_t snapshots = 100;
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)i;
+    }
+    mt19937 gen(12345);
+    shuffle(keys.begin(), keys.end(), gen);
+
+    typedef AVLTree<int, int> Tree;
+    Tree tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    double treeInsertSecs = secondsSince(start);
+
+    PersistentAVLTree<int, int> persistent;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        persistent.insert(make_pair(keys[i], (int)i));
+    }
+    double persistentInsertSecs = secondsSince(start);
+
+    start = Clock::now();
+    long long checksum = 0;
+    for(size_t s = 0; s < snapshots; ++s) {
+        Tree copy(tree.begin(), tree.end());
+        tree.insert(make_pair((int)(n + s), 0));
+        checksum += copy.begin()->first;
+    }
+    double copySecs = secondsSince(start);
+
+    start = Clock::now();
+    for(size_t s = 0; s < snapshots; ++s) {
+        PersistentAVLTree<int, int> copy = persistent.snapshot();
+        persistent.insert(make_pair((int)(n + s), 0));
+        checksum -= copy.begin()->first;
+    }
+    double snapshotSecs = secondsSince(start);
+
+    cout << "AVLTree/snapshot n=" << n
+         << " insert=" << n / treeInsertSecs / 1e6 << "Mops/s"
+         << " persistent-insert=" << n / persistentInsertSecs / 1e6 << "Mops/s"
+         << " deep-copy=" << copySecs / snapshots * 1e3 << "ms"
+         << " snapshot=" << snapshotSecs / snapshots * 1e6 << "us"
+         << " (checksum " << checksum << ")" << endl;
+}
+
+// Looks up random keys in a map of n keys from 1 up to the number of
+// hardware threads for a fixed time while one more thread keeps writing,
+// once with ConcurrentAVLTree and once with RcuAVLTree, and prints the total
+// lookup throughput.
+template<typename Lookup>
+double runReaders(unsigned threads, size_t n, Lookup lookup, function<void()> write)
+{
+    const double seconds = 0.5;
+    atomic<bool> stop(false);
+    atomic<unsigned long long> lookups(0);
+    vector<thread> readers;
+    for(unsigned t = 0; t < threads; ++t) {
+        readers.push_back(thread([&, t]() {
+            unsigned long long done = lookup(t, n, stop);
+            lookups += done;
+        }));
+    }
+    Clock::time_point start = Clock::now();
+    while(secondsSince(start) < seconds) {
+        write();
+    }
+    stop = true;
+    for(size_t t = 0; t < readers.size(); ++t) {
+        readers[t].join();
+    }
+    return lookups / secondsSince(start) / 1e6;
+}
+
+void runReadMostly(size_t n)
+{
+    atomic<long long> sink(0); //keeps the lookups from being optimized away
+    ConcurrentAVLTree<int, int> sharded;
+    RcuAVLTree<int, int> rcu;
+    for(size_t i = 0; i < n; ++i) {
+        sharded.insert(make_pair((int)i, (int)i));
+        rcu.insert(make_pair((int)i, (int)i));
+    }
+    mt19937 writeGen(1);
+    auto shardedWrite = [&]() {
+        int key = (int)(writeGen() % n);
+        sharded.insert(make_pair(key, key));
+        this_thread::sleep_for(chrono::microseconds(10));
+    };
+    auto rcuWrite = [&]() {
+        int key = (int)(writeGen() % n);
+        rcu.insert(make_pair(key, key));
+        this_thread::sleep_for(chrono::microseconds(10));
+    };
+    auto shardedLookup = [&](unsigned t, size_t keys, atomic<bool>& stop) {
+        mt19937 gen(t + 1);
+        unsigned long long done = 0;
+        int value = 0;
+        long long sum = 0;
+        while(!stop.load(memory_order_relaxed)) {
+            if(sharded.find((int)(gen() % keys), value)) {
+                sum += value;
+            }
+            ++done;
+        }
+        sink += sum;
+        return done;
+    };
+    auto rcuLookup = [&](unsigned t, size_t keys, atomic<bool>& stop) {
+        RcuAVLTree<int, int>::Reader reader(rcu);
+        mt19937 gen(t + 1);
+        unsigned long long done = 0;
+        int value = 0;
+        long long sum = 0;
+        while(!stop.load(memory_order_relaxed)) {
+            if(reader.find((int)(gen() % keys), value)) {
+                sum += value;
+            }
+            ++done;
+        }
+        sink += sum;
+        return done;
+    };
+    unsigned hardware = max(1u, thread::hardware_concurrency());
+    for(unsigned threads = 1; ; threads *= 2) {
+        threads = min(threads, hardware);
+        cout << "AVLTree/read-mostly n=" << n << " readers=" << threads
+             << " shared-mutex=" << runReaders(threads, n, shardedLookup, shardedWrite) << "Mops/s"
+             << " rcu=" << runReaders(threads, n, rcuLookup, rcuWrite) << "Mops/s" << endl;
+        if(threads == hardware) {
+            break;
+        }
+    }
+    cout << "(checksum " << sink << ")" << endl;
+}
+
+// Looks up n random keys, present and absent, in a tree of n keys and in a
+// frozen copy of it.
+void runFrozenLookup(size_t n)
+{
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(2 * (int)i, (int)i);
+    }
+    AVLTree<int, int> tree(items.begin(), items.end());
+    Clock::time_point start = Clock::now();
+    FrozenAVLTree<int, int> frozen = tree.freeze();
+    double freezeSecs = secondsSince(start);
+    mt19937 gen(12345);
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)(gen() % (2 * n));
+    }
+
+    start = Clock::now();
+    long long checksum = 0;
+    for(size_t i = 0; i < n; ++i) {
+        AVLTree<int, int>::iterator it = tree.find(keys[i]);
+        if(it != tree.end()) {
+            checksum += it->second;
+        }
+    }
+    double treeSecs = secondsSince(start);
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        FrozenAVLTree<int, int>::const_iterator it = frozen.find(keys[i]);
+        if(it != frozen.end()) {
+            checksum -= it.value();
+        }
+    }
+    double frozenSecs = secondsSince(start);
+
+    cout << "AVLTree/freeze n=" << n
+         << " freeze=" << freezeSecs * 1e3 << "ms"
+         << " tree-find=" << n / treeSecs / 1e6 << "Mops/s"
+         << " frozen-find=" << n / frozenSecs / 1e6 << "Mops/s"
+         << " (checksum " << checksum << ")" << endl;
+}
+
+// Looks up n random int64 keys, present and absent, in a std::map, an
+// AVLTree and the static indexes built from it, each block search
+// instruction set in turn for SimdSearchTree.
+void runSimdLookup(size_t n)
+{
+    map<int64_t, int> stdmap;
+    vector<pair<int64_t, int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(2 * (int64_t)i, (int)i);
+        stdmap.insert(stdmap.end(), items[i]);
+    }
+    AVLTree<int64_t, int> tree(items.begin(), items.end());
+    FrozenAVLTree<int64_t, int> frozen = tree.freeze();
+    SimdSearchTree<int64_t, int> simd(tree.begin(), tree.end());
+    mt19937_64 gen(12345);
+    vector<int64_t> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int64_t)(gen() % (2 * n));
+    }
+    long long checksum = 0;
+
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        map<int64_t, int>::iterator it = stdmap.find(keys[i]);
+        if(it != stdmap.end()) {
+            checksum += it->second;
+        }
+    }
+    cout << "AVLTree/simd n=" << n << " std::map-find=" << n / secondsSince(start) / 1e6 << "Mops/s";
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        AVLTree<int64_t, int>::iterator it = tree.find(keys[i]);
+        if(it != tree.end()) {
+            checksum += it->second;
+        }
+    }
+    cout << " tree-find=" << n / secondsSince(start) / 1e6 << "Mops/s";
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        FrozenAVLTree<int64_t, int>::const_iterator it = frozen.find(keys[i]);
+        if(it != frozen.end()) {
+            checksum += it.value();
+        }
+    }
+    cout << " frozen-find=" << n / secondsSince(start) / 1e6 << "Mops/s" << endl;
+
+    const char* names[] = {"scalar", "sse4.2", "avx2"};
+    SimdSearchTree<int64_t, int>::Isa isas[] = {SimdSearchTree<int64_t, int>::SCALAR,
+                                                SimdSearchTree<int64_t, int>::SSE42,
+                                                SimdSearchTree<int64_t, int>::AVX2};
+    for(size_t k = 0; k < 3; ++k) {
+        if(!simd.supports(isas[k])) {
+            continue;
+        }
+        simd.useIsa(isas[k]);
+        start = Clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            SimdSearchTree<int64_t, int>::const_iterator it = simd.find(keys[i]);
+            if(it != simd.end()) {
+                checksum += it.value();
+            }
+        }
+        double findSecs = secondsSince(start);
+        start = Clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            checksum += simd.lower_bound(keys[i]) != simd.end();
+        }
+        double lowerBoundSecs = secondsSince(start);
+        cout << "  simd-" << names[k] << " find=" << n / findSecs / 1e6 << "Mops/s"
+             << " lower_bound=" << n / lowerBoundSecs / 1e6 << "Mops/s" << endl;
+    }
+    cout << "(checksum " << checksum << ")" << endl;
+}
+
+// Inserts n random keys and removes them all again in a different random order.
+template<typename Tree>
+void runRemoveAll(const char* label, size_t n)
+{
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)i;
+    }
+    mt19937 gen(12345);
+    shuffle(keys.begin(), keys.end(), gen);
+
+    Tree tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    shuffle(keys.begin(), keys.end(), gen);
+
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.remove(keys[i]);
+    }
+    double removeSecs = secondsSince(start);
+
+    cout << label << " n=" << n
+         << " remove=" << n / removeSecs / 1e6 << "Mops/s"
+         << " empty=" << tree.empty() << endl;
+}
+
+// A plain BinarySearchTree that can be given the shape sorted inserts
+// produce, one long right spine, in O(n) rather than O(n^2).
+struct ChainTree : public BinarySearchTree<int, int>
+{
+    void appendChain(size_t n)
+    {
+        Node<int, int>* tail = NULL;
+        for(size_t i = 0; i < n; ++i) {
+            Node<int, int>* node = createNode(tail, forward_as_tuple((int)i), forward_as_tuple((int)i));
+            if(tail == NULL) {
+                root_ = node;
+            }
+            else {
+                tail->setRight(node);
+            }
+            tail = node;
+        }
+    }
+};
+
+// Times tearing down n keys: a degenerate chain (which a recursive teardown
+// would overflow the stack on), a balanced tree node by node, and a balanced
+// tree whose slab pool is dropped whole.
+void runTeardown(size_t n)
+{
+    ChainTree* chain = new ChainTree;
+    chain->appendChain(n);
+    Clock::time_point start = Clock::now();
+    delete chain;
+    cout << "BinarySearchTree/chain n=" << n << " destroy=" << secondsSince(start) * 1000 << "ms" << endl;
+
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)i, (int)i);
+    }
+    AVLTree<int, int> tree;
+    tree.build(items.begin(), items.end());
+    start = Clock::now();
+    tree.clear();
+    cout << "AVLTree/new n=" << n << " clear=" << secondsSince(start) * 1000 << "ms" << endl;
+
+    AVLTree<int, int, less<int>, SlabAllocator<pair<const int, int> > > slabTree;
+    slabTree.build(items.begin(), items.end());
+    start = Clock::now();
+    slabTree.clear();
+    cout << "AVLTree/slab n=" << n << " clear=" << secondsSince(start) * 1000 << "ms" << endl;
+}
+
+// Runs insert/find/clear and a remove-all pass on a plain AVLTree, then
+// prints its built-in counters. Build once as usual and once with
+// "make bst-bench DEFS=-DAVLBST_STATS" to see what the counting costs;
+// the plain build should match "new".
+void runStatistics(size_t n)
+{
+    runInsertFindClear<AVLTree<int, int> >("AVLTree/new", n);
+    runRemoveAll<AVLTree<int, int> >("AVLTree/new", n);
+
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)i;
+    }
+    mt19937 gen(12345);
+    shuffle(keys.begin(), keys.end(), gen);
+    AVLTree<int, int> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    for(size_t i = 0; i < n; ++i) {
+        tree.find(keys[i]);
+    }
+    for(size_t i = 0; i < n; i += 2) {
+        tree.remove(keys[i]);
+    }
+    TreeStatistics stats = tree.statistics();
+    if(!stats.enabled) {
+        cout << "statistics disabled (build with -DAVLBST_STATS)" << endl;
+        return;
+    }
+    cout << "lookups=" << stats.lookups
+         << " comparisons/lookup=" << stats.comparisonsPerLookup()
+         << " insert rotations=" << stats.insertSingleRotations << "+" << stats.insertDoubleRotations << " double"
+         << " remove rotations=" << stats.removeSingleRotations << "+" << stats.removeDoubleRotations << " double"
+         << " allocations=" << stats.allocations << " frees=" << stats.frees << endl;
+    cout << "lookup depths:";
+    for(int d = 0; d <= TreeStatistics::MaxDepth; ++d) {
+        if(stats.lookupDepths[d] != 0) {
+            cout << " " << d << ":" << stats.lookupDepths[d];
+        }
+    }
+    cout << endl;
+}
+
+// Times one validate() pass over an AVLTree of n random keys, built by
+// inserts so the shape is a typical one rather than a perfect one.
+void runValidate(size_t n)
+{
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)i;
+    }
+    mt19937 gen(12345);
+    shuffle(keys.begin(), keys.end(), gen);
+    AVLTree<int, int, less<int>, SlabAllocator<pair<const int, int> > > tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+
+    Clock::time_point start = Clock::now();
+    TreeShape shape = tree.validate();
+    double validateSecs = secondsSince(start);
+    cout << "AVLTree/slab n=" << n
+         << " validate=" << validateSecs * 1e3 << "ms (" << validateSecs * 1e9 / n << "ns/node)"
+         << " valid=" << shape.valid << " balanced=" << shape.balanced
+         << " height=" << shape.height << " averageDepth=" << shape.averageDepth << endl;
+}
+
+// What TracedAVLNode has seen since the counters were last reset.
+struct RebalanceCounts
+{
+    static unsigned long long op;        // stamp of the operation in progress
+    static unsigned long long visited;   // distinct nodes whose balance was read or written
+    static unsigned long long rotations; // nodes moved below one of their own children
+    static unsigned long long reads;     // calls to getBalance
+    static bool paused;
+};
+unsigned long long RebalanceCounts::op = 0;
+unsigned long long RebalanceCounts::visited = 0;
+unsigned long long RebalanceCounts::rotations = 0;
+unsigned long long RebalanceCounts::reads = 0;
+bool RebalanceCounts::paused = false;
+
+// An AVLNode that reports to RebalanceCounts, so rebalancing work can be
+// measured from outside the tree. A rotation is the one place a node is
+// given one of its own children as parent.
+template <typename Key, typename Value>
+class TracedAVLNode : public AVLNode<Key, Value>
+{
+public:
+    template<typename KeyArgs, typename ValueArgs>
+    TracedAVLNode(piecewise_construct_t, KeyArgs keyArgs, ValueArgs valueArgs, TracedAVLNode* parent) :
+        AVLNode<Key, Value>(piecewise_construct, std::move(keyArgs), std::move(valueArgs), parent),
+        seenIn_(0)
+    {
+    }
+
+    TracedAVLNode* getParent() const { return static_cast<TracedAVLNode*>(this->parent_); }
+    TracedAVLNode* getLeft() const { return static_cast<TracedAVLNode*>(this->left_); }
+    TracedAVLNode* getRight() const { return static_cast<TracedAVLNode*>(this->right_); }
+
+    void setParent(TracedAVLNode* parent)
+    {
+        if(!RebalanceCounts::paused && parent != NULL && (parent == this->left_ || parent == this->right_)) {
+            ++RebalanceCounts::rotations;
+        }
+        this->parent_ = parent;
+    }
+
+    int8_t getBalance() const
+    {
+        if(!RebalanceCounts::paused) {
+            ++RebalanceCounts::reads;
+        }
+        visit();
+        return this->balance_;
+    }
+    void setBalance(int8_t balance) { visit(); this->balance_ = balance; }
+    void updateBalance(int8_t diff) { visit(); this->balance_ += diff; }
+
+protected:
+    void visit() const
+    {
+        if(!RebalanceCounts::paused && seenIn_ != RebalanceCounts::op) {
+            seenIn_ = RebalanceCounts::op;
+            ++RebalanceCounts::visited;
+        }
+    }
+
+    mutable unsigned long long seenIn_;
+};
+
+// The tree for TracedAVLNode. Swapping a node with its predecessor before a
+// removal relinks nodes the way a rotation does, so it is left uncounted.
+struct TracedAVLTree : public AVLTree<int, int, less<int>, allocator<pair<const int, int> >, TracedAVLNode<int, int> >
+{
+protected:
+    void nodeSwap(TracedAVLNode<int, int>* n1, TracedAVLNode<int, int>* n2) override
+    {
+        RebalanceCounts::paused = true;
+        AVLTree<int, int, less<int>, allocator<pair<const int, int> >, TracedAVLNode<int, int> >::nodeSwap(n1, n2);
+        RebalanceCounts::paused = false;
+    }
+};
+
+// A delete-heavy mix on a tree of n keys: n operations, three in four
+// removing a random present key and the rest inserting a fresh one. Prints
+// the nodes visited, rotations and balance reads per removal and per insert,
+// counted on a TracedAVLTree, then times the same sequence on a plain
+// AVLTree.
+void runRebalance(size_t n)
+{
+    mt19937 gen(12345);
+    vector<int> live(n);
+    for(size_t i = 0; i < n; ++i) {
+        live[i] = (int)(2 * i);
+    }
+    shuffle(live.begin(), live.end(), gen);
+    vector<pair<bool, int> > ops(n); // (remove?, key)
+    vector<int> pool = live;
+    int fresh = 1;
+    for(size_t i = 0; i < n; ++i) {
+        if(gen() % 4 != 0 && !pool.empty()) {
+            size_t at = gen() % pool.size();
+            ops[i] = make_pair(true, pool[at]);
+            pool[at] = pool.back();
+            pool.pop_back();
+        }
+        else {
+            ops[i] = make_pair(false, fresh);
+            pool.push_back(fresh);
+            fresh += 2;
+        }
+    }
+
+    TracedAVLTree traced;
+    for(size_t i = 0; i < n; ++i) {
+        traced.insert(make_pair(live[i], 0));
+    }
+    unsigned long long counts[2][4] = {{0, 0, 0, 0}, {0, 0, 0, 0}}; // [remove?][ops, visited, rotations, reads]
+    for(size_t i = 0; i < n; ++i) {
+        ++RebalanceCounts::op;
+        RebalanceCounts::visited = 0;
+        RebalanceCounts::rotations = 0;
+        RebalanceCounts::reads = 0;
+        if(ops[i].first) {
+            traced.remove(ops[i].second);
+        }
+        else {
+            traced.insert(make_pair(ops[i].second, 0));
+        }
+        unsigned long long* row = counts[ops[i].first ? 1 : 0];
+        row[0] += 1;
+        row[1] += RebalanceCounts::visited;
+        row[2] += RebalanceCounts::rotations;
+        row[3] += RebalanceCounts::reads;
+    }
+    const char* names[2] = {"insert", "remove"};
+    for(int r = 1; r >= 0; --r) {
+        cout << "AVLTree/" << names[r] << " n=" << n << " ops=" << counts[r][0]
+             << " visited/op=" << (double)counts[r][1] / counts[r][0]
+             << " rotations/op=" << (double)counts[r][2] / counts[r][0]
+             << " balanceReads/op=" << (double)counts[r][3] / counts[r][0] << endl;
+    }
+
+    AVLTree<int, int> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(live[i], 0));
+    }
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        if(ops[i].first) {
+            tree.remove(ops[i].second);
+        }
+        else {
+            tree.insert(make_pair(ops[i].second, 0));
+        }
+    }
+    cout << "AVLTree/delete-heavy n=" << n << " " << n / secondsSince(start) / 1e6 << "Mops/s" << endl;
+}
+
+// ---------------------------------------------------------------------------
+// The suite behind "make bench": one workload on one tree and key type per
+// process, reported as a single line of JSON.
+// ---------------------------------------------------------------------------
+
+// Keys for the suite are built from integers. Strings look like the keys of
+// runStringKeys, zero padded so their order matches the integers'.
+template<typename K>
+K suiteKey(size_t i);
+
+template<>
+int suiteKey<int>(size_t i)
+{
+    return (int)i;
+}
+
+template<>
+string suiteKey<string>(size_t i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "user:%012zu", i);
+    return buf;
+}
+
+// The operations a workload needs, in the trees' spelling and std::map's.
+template<typename Tree, typename K>
+void suiteInsert(Tree& tree, const K& key, int value)
+{
+    tree.insert(make_pair(key, value));
+}
+
+template<typename K>
+void suiteInsert(map<K, int>& tree, const K& key, int value)
+{
+    tree[key] = value;
+}
+
+template<typename Tree, typename K>
+void suiteRemove(Tree& tree, const K& key)
+{
+    tree.remove(key);
+}
+
+template<typename K>
+void suiteRemove(map<K, int>& tree, const K& key)
+{
+    tree.erase(key);
+}
+
+// Draws ranks 0..n-1 with P(rank r) proportional to 1/(r+1)^theta, using
+// the method of Gray et al., "Quickly Generating Billion-Record Synthetic
+// Databases" (as in YCSB): O(n) setup, O(1) per draw.
+class ZipfGenerator
+{
+public:
+    ZipfGenerator(size_t n, double theta) :
+        n_(n),
+        theta_(theta),
+        zetan_(zeta(n, theta)),
+        alpha_(1.0 / (1.0 - theta)),
+        eta_((1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta(2, theta) / zetan_))
+    {
+    }
+
+    template<typename Gen>
+    size_t operator()(Gen& gen)
+    {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(gen);
+        double uz = u * zetan_;
+        if(uz < 1.0) {
+            return 0;
+        }
+        if(uz < 1.0 + pow(0.5, theta_)) {
+            return 1;
+        }
+        size_t rank = (size_t)(n_ * pow(eta_ * u - eta_ + 1.0, alpha_));
+        return rank < n_ ? rank : n_ - 1;
+    }
+
+private:
+    static double zeta(size_t n, double theta)
+    {
+        double sum = 0;
+        for(size_t i = 1; i <= n; ++i) {
+            sum += 1.0 / pow((double)i, theta);
+        }
+        return sum;
+    }
+
+    size_t n_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+};
+
+// A bijection on the integers below 2^bits that scatters consecutive
+// inputs: multiplying by an odd number and xoring in the high half are each
+// invertible modulo 2^bits.
+size_t scramble(size_t x, int bits)
+{
+    size_t mask = bits >= 64 ? ~(size_t)0 : ((size_t)1 << bits) - 1;
+    x = (x * 0x9E3779B97F4A7C15ull) & mask;
+    x ^= x >> (bits / 2 + 1);
+    x = (x * 0xBF58476D1CE4E5B9ull) & mask;
+    return x;
+}
+
+// One step of a workload. Keys are picked while the ops are generated, so
+// every tree replays exactly the same sequence.
+template<typename K>
+struct SuiteOp
+{
+    enum Kind { FIND, INSERT, REMOVE, SCAN } kind;
+    K key;
+};
+
+// Prints the JSON line for one run. latencies are per operation, in ns.
+void printSuiteResult(const string& tree, const string& keyType, const string& workload, size_t n,
+                      vector<uint32_t>& latencies, double seconds, long long checksum)
+{
+    size_t ops = latencies.size();
+    uint32_t p50 = 0;
+    uint32_t p99 = 0;
+    if(ops > 0) {
+        nth_element(latencies.begin(), latencies.begin() + ops / 2, latencies.end());
+        p50 = latencies[ops / 2];
+        nth_element(latencies.begin(), latencies.begin() + ops * 99 / 100, latencies.end());
+        p99 = latencies[ops * 99 / 100];
+    }
+    printf("{\"tree\": \"%s\", \"key\": \"%s\", \"workload\": \"%s\", \"n\": %zu, \"ops\": %zu, "
+           "\"ops_per_sec\": %.6g, \"p50_ns\": %u, \"p99_ns\": %u, \"peak_rss_mib\": %.1f, \"checksum\": %lld}\n",
+           tree.c_str(), keyType.c_str(), workload.c_str(), n, ops,
+           seconds > 0 ? ops / seconds : 0.0, p50, p99, peakRssMiB(), checksum);
+}
+
+// Runs workload on a Tree of n keys. Keys 2i are preloaded in random order
+// (except for "sequential", which times inserting them in ascending order);
+// inserts add odd keys that are not present yet, removes take a random
+// present key and scans read the 100 keys from a random present one on.
+// Each operation is timed on its own against the clock reading that ended
+// the one before, so the clock is read once per operation.
+template<typename Tree, typename K>
+void runSuite(const string& treeName, const string& keyType, const string& workload, size_t n)
+{
+    const size_t scanWidth = 100;
+    double findShare = 0, insertShare = 0; //the rest of the operations are removes
+    bool zipf = false;
+    bool scan = false;
+    bool sequential = false;
+    if(workload == "sequential") {
+        sequential = true;
+    }
+    else if(workload == "uniform") {
+        findShare = 1;
+    }
+    else if(workload == "zipf") {
+        findShare = 1;
+        zipf = true;
+    }
+    else if(workload == "read-heavy") {
+        findShare = 0.95, insertShare = 0.025;
+    }
+    else if(workload == "write-heavy") {
+        findShare = 0.1, insertShare = 0.45;
+    }
+    else if(workload == "delete-heavy") {
+        insertShare = 0.25;
+    }
+    else if(workload == "range") {
+        scan = true;
+    }
+    else {
+        fprintf(stderr, "unknown workload %s\n", workload.c_str());
+        exit(1);
+    }
+
+    mt19937_64 gen(12345);
+    vector<size_t> live(n); // ids present in the tree; the key of id i is suiteKey(2i)
+    for(size_t i = 0; i < n; ++i) {
+        live[i] = i;
+    }
+    if(!sequential) {
+        shuffle(live.begin(), live.end(), gen);
+    }
+
+    Tree* tree = new Tree;
+    vector<SuiteOp<K> > ops;
+    if(sequential) {
+        ops.resize(n);
+        for(size_t i = 0; i < n; ++i) {
+            ops[i].kind = SuiteOp<K>::INSERT;
+            ops[i].key = suiteKey<K>(2 * i);
+        }
+    }
+    else {
+        for(size_t i = 0; i < n; ++i) {
+            suiteInsert(*tree, suiteKey<K>(2 * live[i]), (int)live[i]);
+        }
+        // At least 100K operations so small trees still give stable
+        // percentiles, and at most 10M so huge ones finish.
+        size_t count = min(max(n, (size_t)100000), (size_t)10000000);
+        if(scan) {
+            count /= 10;
+        }
+        ops.resize(count);
+        ZipfGenerator zipfRank(zipf ? n : 2, 0.99);
+        size_t nextFresh = 0; //inserted keys are scrambled, since ascending ones would unbalance a BinarySearchTree
+        int freshBits = 1;
+        while(((size_t)1 << freshBits) < count) {
+            ++freshBits;
+        }
+        for(size_t i = 0; i < count; ++i) {
+            double pick = uniform_real_distribution<double>(0.0, 1.0)(gen);
+            if(live.empty()) {
+                pick = findShare; //nothing to find or remove, so insert
+            }
+            if(scan || pick < findShare) {
+                size_t at = zipf ? zipfRank(gen) : gen() % live.size();
+                ops[i].kind = scan ? SuiteOp<K>::SCAN : SuiteOp<K>::FIND;
+                ops[i].key = suiteKey<K>(2 * live[at]);
+            }
+            else if(pick < findShare + insertShare) {
+                ops[i].kind = SuiteOp<K>::INSERT;
+                ops[i].key = suiteKey<K>(2 * scramble(nextFresh, freshBits) + 1);
+                ++nextFresh;
+            }
+            else {
+                size_t at = gen() % live.size();
+                ops[i].kind = SuiteOp<K>::REMOVE;
+                ops[i].key = suiteKey<K>(2 * live[at]);
+                live[at] = live.back();
+                live.pop_back();
+            }
+        }
+    }
+
+    vector<uint32_t> latencies(ops.size());
+    long long checksum = 0;
+    Clock::time_point begin = Clock::now();
+    Clock::time_point last = begin;
+    for(size_t i = 0; i < ops.size(); ++i) {
+        const SuiteOp<K>& op = ops[i];
+        switch(op.kind) {
+        case SuiteOp<K>::FIND: {
+            typename Tree::iterator it = tree->find(op.key);
+            checksum += it != tree->end() ? it->second : -1;
+            break;
+        }
+        case SuiteOp<K>::INSERT:
+            suiteInsert(*tree, op.key, (int)i);
+            break;
+        case SuiteOp<K>::REMOVE:
+            suiteRemove(*tree, op.key);
+            break;
+        case SuiteOp<K>::SCAN: {
+            typename Tree::iterator it = tree->lower_bound(op.key);
+            for(size_t j = 0; j < scanWidth && it != tree->end(); ++j, ++it) {
+                checksum += it->second;
+            }
+            break;
+        }
+        }
+        Clock::time_point now = Clock::now();
+        latencies[i] = (uint32_t)min<long long>(chrono::duration_cast<chrono::nanoseconds>(now - last).count(), UINT32_MAX);
+        last = now;
+    }
+    double seconds = chrono::duration<double>(last - begin).count();
+    printSuiteResult(treeName, keyType, workload, n, latencies, seconds, checksum);
+    delete tree;
+}
+
+// Picks the tree and key type for runSuite by name. Sorted inserts turn a
+// BinarySearchTree into a list, so "sequential" on one is only run up to a
+// size that finishes; beyond it the line says it was skipped.
+int runSuiteByName(const string& tree, const string& keyType, const string& workload, size_t n)
+{
+    const size_t sequentialBstLimit = 20000;
+    if(tree == "bst" && workload == "sequential" && n > sequentialBstLimit) {
+        printf("{\"tree\": \"BinarySearchTree\", \"key\": \"%s\", \"workload\": \"%s\", \"n\": %zu, "
+               "\"skipped\": \"quadratic: sorted inserts degrade an unbalanced tree to a list\"}\n",
+               keyType.c_str(), workload.c_str(), n);
+        return 0;
+    }
+    if(keyType != "int" && keyType != "string") {
+        fprintf(stderr, "unknown key type %s\n", keyType.c_str());
+        return 1;
+    }
+    bool intKeys = keyType == "int";
+    if(tree == "bst") {
+        if(intKeys) runSuite<BinarySearchTree<int, int>, int>("BinarySearchTree", keyType, workload, n);
+        else runSuite<BinarySearchTree<string, int>, string>("BinarySearchTree", keyType, workload, n);
+    }
+    else if(tree == "avl") {
+        if(intKeys) runSuite<AVLTree<int, int>, int>("AVLTree", keyType, workload, n);
+        else runSuite<AVLTree<string, int>, string>("AVLTree", keyType, workload, n);
+    }
+    else if(tree == "map") {
+        if(intKeys) runSuite<map<int, int>, int>("std::map", keyType, workload, n);
+        else runSuite<map<string, int>, string>("std::map", keyType, workload, n);
+    }
+    else {
+        fprintf(stderr, "unknown tree %s\n", tree.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+// Saves an AVLTree of n keys to a snapshot file and loads it back, next to
+// rebuilding the same tree from a sorted vector already in memory, which
+// is the most a load can hope for. Then the same for string keys.
+template<typename K>
+void runSaveLoadFor(const char* label, size_t n)
+{
+    vector<pair<K, int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(suiteKey<K>(i), (int)i);
+    }
+    sort(items.begin(), items.end());
+    AVLTree<K, int> tree;
+    Clock::time_point start = Clock::now();
+    tree.build(items.begin(), items.end());
+    double buildSecs = secondsSince(start);
+
+    const char* path = "bst-bench.snap";
+    start = Clock::now();
+    tree.save(path);
+    double saveSecs = secondsSince(start);
+    tree.clear();
+
+    start = Clock::now();
+    tree.load(path);
+    double loadSecs = secondsSince(start);
+
+    FILE* file = fopen(path, "rb");
+    fseek(file, 0, SEEK_END);
+    double fileMiB = ftell(file) / (1024.0 * 1024.0);
+    fclose(file);
+    remove(path);
+
+    cout << label << " n=" << n << " file=" << fileMiB << "MiB"
+         << " save=" << saveSecs * 1e3 << "ms (" << fileMiB / saveSecs << "MiB/s)"
+         << " load=" << loadSecs * 1e3 << "ms (" << fileMiB / loadSecs << "MiB/s)"
+         << " build from memory=" << buildSecs * 1e3 << "ms"
+         << " valid=" << tree.validate().valid << endl;
+}
+
+void runSaveLoad(size_t n)
+{
+    runSaveLoadFor<int>("AVLTree<int,int>", n);
+    runSaveLoadFor<string>("AVLTree<string,int>", n);
+}
+
+int main(int argc, char *argv[])
+{
+    // Each workload runs in its own process so peak RSS is not shared between them.
+    if(argc < 2) {
+        cout << "usage: " << argv[0] << " new|slab|string|build|batch|split|rank|range|latest|pbuild|concurrent|snapshot|rcu|freeze|simd|compact|stack|packed|teardown|rebalance|stats|validate|save [n], or suite ..." << endl;
+        return 1;
+    }
+    string mode = argv[1];
+    if(mode == "suite") {
+        if(argc != 6) {
+            cout << "usage: " << argv[0] << " suite bst|avl|map int|string "
+                 << "sequential|uniform|zipf|read-heavy|write-heavy|delete-heavy|range n" << endl;
+            return 1;
+        }
+        return runSuiteByName(argv[2], argv[3], argv[4], strtoul(argv[5], NULL, 10));
+    }
+    size_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+
+    if(mode == "new") {
+        runInsertFindClear<AVLTree<int, int> >("AVLTree/new", n);
+    }
+    else if(mode == "slab") {
+        runInsertFindClear<AVLTree<int, int, less<int>, SlabAllocator<pair<const int, int> > > >("AVLTree/slab", n);
+    }
+    else if(mode == "string") {
+        runStringKeys(n);
+    }
+    else if(mode == "build") {
+        runSortedLoad(n);
+    }
+    else if(mode == "batch") {
+        runBatchIngest(n);
+    }
+    else if(mode == "split") {
+        runSplitJoin(n);
+    }
+    else if(mode == "rank") {
+        runRankSelect(n);
+    }
+    else if(mode == "range") {
+        runRangeScan(n);
+    }
+    else if(mode == "latest") {
+        runLatestEntries(n);
+    }
+    else if(mode == "pbuild") {
+        runParallelBuild(n);
+    }
+    else if(mode == "concurrent") {
+        runConcurrent(n);
+    }
+    else if(mode == "snapshot") {
+        runSnapshots(n);
+    }
+    else if(mode == "rcu") {
+        runReadMostly(n);
+    }
+    else if(mode == "freeze") {
+        runFrozenLookup(n);
+    }
+    else if(mode == "simd") {
+        runSimdLookup(n);
+    }
+    else if(mode == "compact") {
+        runInsertFindClear<CompactAVLTree<int, int> >("AVLTree/compact", n);
+    }
+    else if(mode == "packed") {
+        // Compare with "slab" for memory and with "new" for lookups; as with
+        // "stack", malloc would round both node sizes to the same chunk.
+        runInsertFindClear<PackedAVLTree<int, int, less<int>, SlabAllocator<pair<const int, int> > > >("PackedAVLTree/slab", n);
+        runInsertFindClear<PackedAVLTree<int, int> >("PackedAVLTree/new", n);
+    }
+    else if(mode == "rebalance") {
+        runRebalance(n);
+    }
+    else if(mode == "save") {
+        runSaveLoad(n);
+    }
+    else if(mode == "validate") {
+        runValidate(n);
+    }
+    else if(mode == "stats") {
+        runStatistics(n);
+    }
+    else if(mode == "teardown") {
+        runTeardown(n);
+    }
+    else if(mode == "stack") {
+        // Compare with "slab": malloc rounds 32 and 40 byte nodes to the same
+        // chunk, so the smaller node only shows up under SlabAllocator.
+        runInsertFindClear<StackAVLTree<int, int, less<int>, SlabAllocator<pair<const int, int> > > >("StackAVLTree/slab", n);
+        runRemoveAll<AVLTree<int, int> >("AVLTree/new", n);
+        runRemoveAll<StackAVLTree<int, int> >("StackAVLTree/new", n);
+    }
+    else {
+        cout << "unknown mode " << mode << endl;
+        return 1;
+    }
+    return 0;
+}
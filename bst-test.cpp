@@ -1,10 +1,53 @@
 #include <iostream>
 #include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <cstdio>
 #include "bst.h"
 #include "avlbst.h"
+#include "concurrent_avlbst.h"
+#include "persistent_avlbst.h"
+#include "rcu_avlbst.h"
+#include "simd_avlbst.h"
+#include "compact_avlbst.h"
+#include "stack_avlbst.h"
 
 using namespace std;
 
+// Each of four threads inserts its own keys into cmap, removes half of them
+// again and reads everybody's keys meanwhile.
+template<typename Map>
+void stressConcurrent(Map& cmap, const char* label)
+{
+    const int writers = 4;
+    const int perThread = 5000;
+    vector<thread> workers;
+    for(int t = 0; t < writers; ++t) {
+        workers.push_back(thread([&cmap, t, perThread, writers]() {
+            for(int i = 0; i < perThread; ++i) {
+                cmap.insert(std::make_pair(t * perThread + i, i));
+            }
+            for(int i = 0; i < perThread; i += 2) {
+                cmap.remove(t * perThread + i);
+            }
+            int value = 0;
+            for(int i = 0; i < writers * perThread; ++i) {
+                cmap.find(i, value);
+            }
+        }));
+    }
+    for(size_t t = 0; t < workers.size(); ++t) {
+        workers[t].join();
+    }
+    long long valueSum = 0;
+    cmap.for_each([&valueSum](const int& key, const int& value) { valueSum += value; });
+    cout << "\n" << label << " size after stress: " << cmap.size() << endl;
+    cout << label << " value sum: " << valueSum << endl;
+    cout << label << " contains 3 and not 4: " << (cmap.contains(3) && !cmap.contains(4)) << endl;
+}
+
 
 int main(int argc, char *argv[])
 {
@@ -44,5 +87,392 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    // Random removal tests
+    AVLTree<int,int> rt;
+    for(int i = 0; i < 1000; ++i) {
+        rt.insert(std::make_pair(i * 7919 % 1000, i));
+    }
+    for(int i = 0; i < 1000; i += 2) {
+        rt.remove(i * 104729 % 1000);
+    }
+    int kept = 0;
+    bool inOrder = true;
+    int previous = -1;
+    for(AVLTree<int,int>::iterator it = rt.begin(); it != rt.end(); ++it) {
+        inOrder = inOrder && previous < it->first && rt.find(it->first) == it;
+        previous = it->first;
+        ++kept;
+    }
+    cout << "\nRandom removals kept " << kept << " keys, in order: " << inOrder << endl;
+
+    // Slab allocated AVL Tree tests
+    AVLTree<int,int,std::less<int>,SlabAllocator<std::pair<const int,int> > > st;
+    for(int i = 0; i < 100; ++i) {
+        st.insert(std::make_pair(i, i * i));
+    }
+    cout << "\nSlab AVLTree value at 9: " << st[9] << endl;
+    cout << "Clearing slab AVLTree" << endl;
+    st.clear();
+    cout << "Slab AVLTree empty: " << st.empty() << endl;
+
+    // Slab release tests: clear() drops the whole arena once the tree owns
+    // everything live in it, even while other allocators and trees share it
+    typedef SlabAllocator<std::pair<const int,int> > PairSlab;
+    typedef AVLTree<int,int,std::less<int>,PairSlab> SlabTree;
+    PairSlab keptAlloc;
+    SlabAllocator<AVLNode<int,int> > keptNodes(keptAlloc); //sees the node pool's slabs
+    SlabTree sk(std::less<int>(), keptAlloc);
+    for(int i = 0; i < 10000; ++i) {
+        sk.insert(std::make_pair(i, i));
+    }
+    sk.clear();
+    cout << "Slabs after clear with the allocator kept: " << keptNodes.slabCount() << endl;
+    for(int i = 0; i < 10000; ++i) {
+        sk.insert(std::make_pair(i, i));
+    }
+    SlabTree moved(std::move(sk));
+    moved.clear();
+    cout << "Slabs after clear of a moved-to tree: " << keptNodes.slabCount() << endl;
+    for(int i = 0; i < 10000; ++i) {
+        sk.insert(std::make_pair(i, i));
+    }
+    std::pair<SlabTree, SlabTree> slabHalves = sk.split(5000);
+    slabHalves.first.clear();
+    cout << "Slabs kept while one split half is live: " << (keptNodes.slabCount() > 0) << endl;
+    slabHalves.second.clear();
+    cout << "Slabs after clear of both split halves: " << keptNodes.slabCount() << endl;
+    for(int i = 0; i < 10000; ++i) {
+        sk.insert(std::make_pair(i, i));
+    }
+    slabHalves = sk.split(5000);
+    SlabTree rejoined = SlabTree::join(std::move(slabHalves.first), std::move(slabHalves.second));
+    rejoined.clear();
+    cout << "Slabs after clear of a joined tree: " << keptNodes.slabCount() << endl;
+
+    // Emplace tests
+    AVLTree<string,string> et;
+    et.try_emplace("k", "first");
+    cout << "\ntry_emplace on existing key inserted: " << et.try_emplace("k", "second").second << endl;
+    cout << "Value at k: " << et["k"] << endl;
+    et.insert_or_assign("k", "third");
+    cout << "Value at k after insert_or_assign: " << et["k"] << endl;
+    et.emplace("m", "fourth");
+    et.insert(std::make_pair(string("n"), string("fifth")));
+    for(AVLTree<string,string>::iterator it = et.begin(); it != et.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+
+    // Comparator tests
+    AVLTree<int,int,std::greater<int> > gt;
+    for(int i = 0; i < 5; ++i) {
+        gt.insert(std::make_pair(i, i));
+    }
+    cout << "\nAVLTree with std::greater contents:";
+    for(AVLTree<int,int,std::greater<int> >::iterator it = gt.begin(); it != gt.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    AVLTree<string,int,std::less<> > ht;
+    ht.insert(std::make_pair(string("apple"), 1));
+    ht.insert(std::make_pair(string("banana"), 2));
+    if(ht.find(string_view("banana")) != ht.end()) {
+        cout << "Found banana by string_view" << endl;
+    }
+    else {
+        cout << "Did not find banana by string_view" << endl;
+    }
+
+    // Bulk build tests
+    vector<pair<int,int> > sortedItems;
+    for(int i = 1; i <= 7; ++i) {
+        sortedItems.push_back(std::make_pair(i, i * 10));
+    }
+    AVLTree<int,int> bat(sortedItems.begin(), sortedItems.end());
+    cout << "\nAVLTree built from sorted range:" << endl;
+    bat.print();
+    vector<pair<int,int> > unsortedItems;
+    unsortedItems.push_back(std::make_pair(3, 1));
+    unsortedItems.push_back(std::make_pair(1, 2));
+    unsortedItems.push_back(std::make_pair(3, 3));
+    bat.build(unsortedItems.begin(), unsortedItems.end());
+    cout << "AVLTree rebuilt from unsorted range:";
+    for(AVLTree<int,int>::iterator it = bat.begin(); it != bat.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl;
+
+    // Batch insert tests
+    vector<pair<int,int> > batch;
+    for(int i = 10; i > 0; --i) {
+        batch.push_back(std::make_pair(i, i * 100));
+    }
+    bat.insert_batch(batch.begin(), batch.end());
+    cout << "AVLTree after insert_batch:";
+    for(AVLTree<int,int>::iterator it = bat.begin(); it != bat.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl;
+    bat.print();
+
+    // Split and join tests
+    pair<AVLTree<int,int>, AVLTree<int,int> > halves = bat.split(4);
+    cout << "Split at 4, lower half:";
+    for(AVLTree<int,int>::iterator it = halves.first.begin(); it != halves.first.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl << "Split at 4, upper half:";
+    for(AVLTree<int,int>::iterator it = halves.second.begin(); it != halves.second.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    bat = AVLTree<int,int>::join(std::move(halves.first), std::move(halves.second));
+    cout << "Joined back together:";
+    for(AVLTree<int,int>::iterator it = bat.begin(); it != bat.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // Order statistic tests
+    CountedAVLTree<int,int> ct;
+    for(int i = 1; i <= 20; ++i) {
+        ct.insert(std::make_pair(i * 5, i));
+    }
+    ct.remove(50);
+    ct.remove(5);
+    cout << "\nCountedAVLTree size: " << ct.size() << endl;
+    cout << "Key at rank 0: " << ct.select(0)->first << endl;
+    cout << "Key at rank 9: " << ct.select(9)->first << endl;
+    cout << "Rank of 42: " << ct.rank(42) << endl;
+    cout << "Keys in [20, 60): " << ct.count_range(20, 60) << endl;
+
+    // Ordered query tests
+    cout << "\nlower_bound(42): " << ct.lower_bound(42)->first << endl;
+    cout << "upper_bound(45): " << ct.upper_bound(45)->first << endl;
+    cout << "floor(42): " << ct.floor(42)->first << endl;
+    cout << "ceiling(45): " << ct.ceiling(45)->first << endl;
+    pair<CountedAVLTree<int,int>::iterator, CountedAVLTree<int,int>::iterator> eq = ct.equal_range(60);
+    cout << "equal_range(60):";
+    for(CountedAVLTree<int,int>::iterator it = eq.first; it != eq.second; ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl << "Scan from lower_bound(32) to upper_bound(70):";
+    for(CountedAVLTree<int,int>::iterator it = ct.lower_bound(32); it != ct.upper_bound(70); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    cout << "floor(1) is end: " << (ct.floor(1) == ct.end()) << endl;
+    AVLTree<int,int> emptyTree;
+    cout << "Empty tree begin is end: " << (emptyTree.begin() == emptyTree.end()) << endl;
+
+    // Bidirectional iterator tests
+    cout << "\nCountedAVLTree in reverse:";
+    for(CountedAVLTree<int,int>::reverse_iterator it = ct.rbegin(); it != ct.rend(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    CountedAVLTree<int,int>::iterator last = ct.end();
+    --last;
+    cout << "Largest key: " << last->first << endl;
+    cout << "Three keys before 45:";
+    CountedAVLTree<int,int>::const_iterator cit = ct.find(45);
+    for(int i = 0; i < 3; ++i) {
+        cit--;
+        cout << " " << cit->first;
+    }
+    cout << endl;
+
+    // Parallel build tests
+    vector<pair<int,int> > manyItems;
+    for(int i = 0; i < 20000; ++i) {
+        manyItems.push_back(std::make_pair(i, -i));
+    }
+    CountedAVLTree<int,int> pt;
+    pt.parallel_build(manyItems.begin(), manyItems.end(), 4);
+    cout << "\nParallel built tree size: " << pt.size() << endl;
+    cout << "Parallel built tree value at 12345: " << pt[12345] << endl;
+    cout << "Parallel built tree is balanced: " << pt.isBalanced() << endl;
+
+    // Concurrent tree stress tests, with the default allocator and with a
+    // slab allocator, which every shard must get its own instance of
+    ConcurrentAVLTree<int,int> cmap(16);
+    stressConcurrent(cmap, "Concurrent tree");
+    cout << "Concurrent tree removes 1 once: " << (cmap.remove(1) && !cmap.remove(1)) << endl;
+    typedef SlabAllocator<std::pair<const int,int> > SlabAlloc;
+    int slabShards = 0;
+    ConcurrentAVLTree<int,int,std::less<int>,std::hash<int>,SlabAlloc> slabMap(16,
+        [&slabShards](std::size_t) { ++slabShards; return SlabAlloc(); });
+    stressConcurrent(slabMap, "Slab concurrent tree");
+    cout << "Slab concurrent tree allocators made: " << slabShards << endl;
+
+    // Persistent tree tests
+    PersistentAVLTree<int,int> ptree;
+    for(int i = 1; i <= 5; ++i) {
+        ptree.insert(std::make_pair(i, i));
+    }
+    PersistentAVLTree<int,int> before = ptree.snapshot();
+    ptree.insert(std::make_pair(3, 300));
+    ptree.insert(std::make_pair(6, 6));
+    ptree.remove(1);
+    cout << "\nPersistent tree now:";
+    for(PersistentAVLTree<int,int>::const_iterator it = ptree.begin(); it != ptree.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl << "Snapshot taken before:";
+    for(PersistentAVLTree<int,int>::const_iterator it = before.begin(); it != before.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl;
+
+    // RCU tree tests
+    RcuAVLTree<int,int> rtree;
+    RcuAVLTree<int,int>::Reader reader(rtree);
+    rtree.insert(std::make_pair(1, 10));
+    rtree.insert(std::make_pair(2, 20));
+    int rvalue = 0;
+    cout << "\nRCU tree found 2: " << reader.find(2, rvalue) << " value " << rvalue << endl;
+    {
+        RcuAVLTree<int,int>::ReadGuard guard(reader);
+        rtree.insert(std::make_pair(3, 30)); //not visible to the pinned version
+        rtree.remove(1);
+        cout << "RCU tree pinned version:";
+        for(RcuAVLTree<int,int>::const_iterator it = guard.begin(); it != guard.end(); ++it) {
+            cout << " " << it->first << "=" << it->second;
+        }
+        cout << endl << "Pinned value at 1: " << guard[1] << endl;
+    }
+    RcuAVLTree<int,int>::ReadGuard latest(reader);
+    cout << "RCU tree latest version:";
+    for(RcuAVLTree<int,int>::const_iterator it = latest.begin(); it != latest.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl;
+
+    // Frozen tree tests
+    AVLTree<int,int> ftree;
+    for(int i = 1; i <= 10; ++i) {
+        ftree.insert(std::make_pair(i * 10, i));
+    }
+    FrozenAVLTree<int,int> frozen = ftree.freeze();
+    ftree.remove(50); //the frozen copy keeps it
+    cout << "\nFrozen tree:";
+    for(FrozenAVLTree<int,int>::const_iterator it = frozen.begin(); it != frozen.end(); ++it) {
+        cout << " " << it.key() << "=" << it.value();
+    }
+    cout << endl << "Frozen value at 50: " << frozen[50] << endl;
+    cout << "Frozen lower_bound(45): " << frozen.lower_bound(45).key()
+         << " upper_bound(60): " << frozen.upper_bound(60).key()
+         << " contains(55): " << frozen.contains(55) << endl;
+
+    // SIMD search tree tests
+    AVLTree<long long,int> itree;
+    for(long long i = 1; i <= 40; ++i) {
+        itree.insert(std::make_pair(i * 3, (int)i));
+    }
+    SimdSearchTree<long long,int> simd(itree.begin(), itree.end());
+    cout << "\nSIMD search tree size " << simd.size() << " first " << simd.begin().key()
+         << " last " << (--simd.end()).key() << endl;
+    cout << "SIMD value at 60: " << simd[60] << " lower_bound(61): " << simd.lower_bound(61).key()
+         << " upper_bound(63): " << simd.upper_bound(63).key()
+         << " contains(62): " << simd.contains(62) << endl;
+
+    // Compact tree tests
+    CompactAVLTree<int,int> compact;
+    for(int i = 10; i >= 1; --i) {
+        compact.insert(std::make_pair(i, i * i));
+    }
+    compact.remove(4);
+    compact.remove(7);
+    cout << "\nCompact tree (" << sizeof(CompactAVLNode<int,int>) << " byte nodes):";
+    for(CompactAVLTree<int,int>::iterator it = compact.begin(); it != compact.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl;
+    compact.print();
+    typedef CompactNodePool<CompactAVLNode<int,int> > CompactPool;
+    CompactAVLTree<int,int> bigCompact;
+    for(int i = 0; i < 100000; ++i) {
+        bigCompact.insert(std::make_pair(i, i));
+    }
+    cout << "Compact pool grew past one chunk: " << (CompactPool::chunkCount() > 1) << endl;
+    bigCompact.clear();
+    compact.clear();
+    cout << "Compact pool chunks once no node is live: " << CompactPool::chunkCount() << endl;
+
+    // Packed balance tests
+    PackedAVLTree<int,int> packed;
+    for(int i = 1; i <= 10; ++i) {
+        packed.insert(std::make_pair(i, i * i));
+    }
+    packed.remove(4);
+    packed.remove(7);
+    cout << "\nPacked tree (" << sizeof(PackedAVLNode<int,int>) << " byte nodes, "
+         << sizeof(AVLNode<int,int>) << " unpacked):";
+    for(PackedAVLTree<int,int>::iterator it = packed.begin(); it != packed.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl;
+    packed.print();
+
+    // Parent-pointer-free tree tests
+    StackAVLTree<int,int> stack;
+    for(int i = 1; i <= 10; ++i) {
+        stack.insert(std::make_pair(i, i * i));
+    }
+    stack.remove(4);
+    stack.remove(7);
+    cout << "\nStack tree (" << sizeof(StackAVLNode<int,int>) << " byte nodes):";
+    for(StackAVLTree<int,int>::iterator it = stack.begin(); it != stack.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl;
+    StackAVLTree<int,int>::iterator stackLast = stack.end();
+    --stackLast;
+    cout << "Stack tree last " << stackLast->first << " find(5)->second " << stack.find(5)->second
+         << " contains(7): " << stack.contains(7) << endl;
+
+    // Operation counter tests (all zero unless built with -DAVLBST_STATS)
+    AVLTree<int,int> counted;
+    for(int i = 1; i <= 10; ++i) {
+        counted.insert(std::make_pair(i, i));
+    }
+    counted.find(3);
+    counted.find(11);
+    TreeStatistics stats = counted.statistics();
+    cout << "\nStatistics enabled: " << stats.enabled << " lookups: " << stats.lookups
+         << " allocations: " << stats.allocations
+         << " insert rotations: " << stats.insertSingleRotations + stats.insertDoubleRotations << endl;
+    counted.resetStatistics();
+    cout << "After reset lookups: " << counted.statistics().lookups << endl;
+
+    // Validation tests
+    AVLTree<int,int> validated;
+    for(int i = 1; i <= 10; ++i) {
+        validated.insert(std::make_pair(i, i));
+    }
+    validated.remove(4);
+    TreeShape shape = validated.validate();
+    cout << "\nValidated AVL tree: valid " << shape.valid << " balanced " << shape.balanced
+         << " nodes " << shape.nodes << " height " << shape.height
+         << " average depth " << shape.averageDepth << endl;
+    BinarySearchTree<int,int> leaning;
+    for(int i = 1; i <= 5; ++i) {
+        leaning.insert(std::make_pair(i, i));
+    }
+    shape = leaning.validate();
+    cout << "Validated chain: valid " << shape.valid << " balanced " << shape.balanced
+         << " height " << shape.height << " isBalanced " << leaning.isBalanced() << endl;
+
+
+    // Snapshot tests
+    validated.save("bst-test.snap");
+    AVLTree<int,int> restored;
+    restored.insert(std::make_pair(100, 100));
+    restored.load("bst-test.snap");
+    std::remove("bst-test.snap");
+    cout << "\nRestored from snapshot:";
+    for(AVLTree<int,int>::iterator it = restored.begin(); it != restored.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl << "Restored tree valid: " << restored.validate().valid << endl;
     return 0;
 }
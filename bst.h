@@ -3,23 +3,38 @@
 
 #include <iostream>
 #include <exception>
+#include <stdexcept>
 #include <cstdlib>
 #include <utility>
+#include <memory>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <iterator>
 #include<cmath>
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "slab_allocator.h"
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * Nothing here is virtual, so a node carries no vtable
+ * pointer. Node types for other kinds of search trees,
+ * such as Red Black trees, Splay trees, and AVL trees,
+ * derive from this and hide the parent/left/right
+ * getters with versions returning their own type; the
+ * tree is told the node type as a template parameter.
  */
 template <typename Key, typename Value>
 class Node
 {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    template<typename KeyArgs, typename ValueArgs>
+    Node(std::piecewise_construct_t, KeyArgs keyArgs, ValueArgs valueArgs, Node<Key, Value>* parent);
+    ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -27,9 +42,9 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
@@ -62,6 +77,22 @@ Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* par
 
 }
 
+/**
+* Piecewise constructor, which builds the key and value in place from
+* the arguments packed in keyArgs and valueArgs (see std::forward_as_tuple)
+* so nothing has to be copied into the node.
+*/
+template<typename Key, typename Value>
+template<typename KeyArgs, typename ValueArgs>
+Node<Key, Value>::Node(std::piecewise_construct_t, KeyArgs keyArgs, ValueArgs valueArgs, Node<Key, Value>* parent) :
+    item_(std::piecewise_construct, std::move(keyArgs), std::move(valueArgs)),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
 /**
 * Destructor, which does not need to do anything since the pointers inside of a node
 * are only used as references to existing nodes. The nodes pointed to by parent/left/right
@@ -119,7 +150,7 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const
@@ -128,7 +159,7 @@ Node<Key, Value>* Node<Key, Value>::getParent() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
@@ -137,7 +168,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
@@ -187,31 +218,253 @@ void Node<Key, Value>::setValue(const Value& value)
   ---------------------------------------
 */
 
+/**
+* Tells the tree whether a search should stop as soon as it meets an equal
+* key. For built-in keys ordered by std::less, equality is just ==, and
+* leaving early with a conditional move choosing the child beats walking
+* down to a leaf. Every other key type pays for each comparison, so the
+* descent makes one comp_ call per level and settles equality once at the
+* bottom. Specialize this for other keys whose == agrees with Compare and
+* is as cheap as an int compare.
+*/
+template <typename Key, typename Compare>
+struct EarlyExitSearch :
+    std::integral_constant<bool, std::is_arithmetic<Key>::value &&
+                                 (std::is_same<Compare, std::less<Key> >::value ||
+                                  std::is_same<Compare, std::less<> >::value)>
+{
+};
+
+/**
+* Returns node's left child if goLeft is set, else its right child. The
+* descents call this rather than choosing between two getter calls, so that
+* a node type whose links must be decoded (see CompactAVLNode) can overload
+* it to choose the raw link first and decode once: the choice then stays a
+* conditional move instead of a hard to predict branch.
+*/
+template <typename NodeType>
+NodeType* childOf(NodeType* node, bool goLeft)
+{
+    return goLeft ? node->getLeft() : node->getRight();
+}
+
+/**
+* Operation counters are compiled in only when AVLBST_STATS is defined (e.g.
+* -DAVLBST_STATS). Without it every AVLBST_STAT(...) below expands to
+* nothing, the tree carries no counters, and statistics() just reports
+* enabled == false.
+*/
+#ifdef AVLBST_STATS
+#define AVLBST_STAT(statement) statement
+#else
+#define AVLBST_STAT(statement)
+#endif
+
+/**
+* A snapshot of a tree's operation counters, returned by statistics().
+* A lookup is one descent made by find, operator[], remove or an ordered
+* query such as lower_bound; comparisons counts both comp_ calls and the
+* == tests of an early exit search. lookupDepths[d] is the number of
+* lookups that visited d nodes, with deeper ones in the last bucket.
+* Rotations are counted by the rebalancing that follows an insert or a
+* remove, a double rotation counting once. Nodes released in bulk by a
+* pool (see releaseNodes) are not counted as frees.
+*/
+struct TreeStatistics
+{
+    static const int MaxDepth = 64;
+
+    bool enabled;
+    std::uint64_t lookups;
+    std::uint64_t comparisons;
+    std::uint64_t insertSingleRotations;
+    std::uint64_t insertDoubleRotations;
+    std::uint64_t removeSingleRotations;
+    std::uint64_t removeDoubleRotations;
+    std::uint64_t allocations;
+    std::uint64_t frees;
+    std::uint64_t lookupDepths[MaxDepth + 1];
+
+    double comparisonsPerLookup() const
+    {
+        return lookups == 0 ? 0.0 : (double)comparisons / lookups;
+    }
+};
+
+#ifdef AVLBST_STATS
+/**
+* The live counters behind TreeStatistics. They are relaxed atomics so that
+* concurrent const lookups, which the trees allow, still count correctly.
+*/
+class TreeStatisticsRecorder
+{
+public:
+    TreeStatisticsRecorder()
+    {
+        reset();
+    }
+
+    void lookup(int depth, std::uint64_t comparisons)
+    {
+        lookups_.fetch_add(1, std::memory_order_relaxed);
+        comparisons_.fetch_add(comparisons, std::memory_order_relaxed);
+        depth = depth < TreeStatistics::MaxDepth ? depth : TreeStatistics::MaxDepth;
+        lookupDepths_[depth].fetch_add(1, std::memory_order_relaxed);
+    }
+    void comparison()
+    {
+        comparisons_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void insertRotation(bool isDouble)
+    {
+        (isDouble ? insertDoubleRotations_ : insertSingleRotations_).fetch_add(1, std::memory_order_relaxed);
+    }
+    void removeRotation(bool isDouble)
+    {
+        (isDouble ? removeDoubleRotations_ : removeSingleRotations_).fetch_add(1, std::memory_order_relaxed);
+    }
+    void allocation()
+    {
+        allocations_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void free()
+    {
+        frees_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    TreeStatistics snapshot() const
+    {
+        TreeStatistics stats;
+        stats.enabled = true;
+        stats.lookups = lookups_.load(std::memory_order_relaxed);
+        stats.comparisons = comparisons_.load(std::memory_order_relaxed);
+        stats.insertSingleRotations = insertSingleRotations_.load(std::memory_order_relaxed);
+        stats.insertDoubleRotations = insertDoubleRotations_.load(std::memory_order_relaxed);
+        stats.removeSingleRotations = removeSingleRotations_.load(std::memory_order_relaxed);
+        stats.removeDoubleRotations = removeDoubleRotations_.load(std::memory_order_relaxed);
+        stats.allocations = allocations_.load(std::memory_order_relaxed);
+        stats.frees = frees_.load(std::memory_order_relaxed);
+        for (int i = 0; i <= TreeStatistics::MaxDepth; ++i)
+        {
+            stats.lookupDepths[i] = lookupDepths_[i].load(std::memory_order_relaxed);
+        }
+        return stats;
+    }
+
+    void reset()
+    {
+        lookups_ = 0;
+        comparisons_ = 0;
+        insertSingleRotations_ = 0;
+        insertDoubleRotations_ = 0;
+        removeSingleRotations_ = 0;
+        removeDoubleRotations_ = 0;
+        allocations_ = 0;
+        frees_ = 0;
+        for (int i = 0; i <= TreeStatistics::MaxDepth; ++i)
+        {
+            lookupDepths_[i] = 0;
+        }
+    }
+
+private:
+    std::atomic<std::uint64_t> lookups_;
+    std::atomic<std::uint64_t> comparisons_;
+    std::atomic<std::uint64_t> insertSingleRotations_;
+    std::atomic<std::uint64_t> insertDoubleRotations_;
+    std::atomic<std::uint64_t> removeSingleRotations_;
+    std::atomic<std::uint64_t> removeDoubleRotations_;
+    std::atomic<std::uint64_t> allocations_;
+    std::atomic<std::uint64_t> frees_;
+    std::atomic<std::uint64_t> lookupDepths_[TreeStatistics::MaxDepth + 1];
+};
+#endif
+
+/**
+* True when NodeType stores an AVL balance (has getBalance), which
+* validate() then checks against the real subtree heights.
+*/
+template <typename NodeType, typename = void>
+struct KeepsBalance : std::false_type
+{
+};
+
+template <typename NodeType>
+struct KeepsBalance<NodeType, std::void_t<decltype(std::declval<const NodeType&>().getBalance())> > : std::true_type
+{
+};
+
+/**
+* What validate() found. valid is false if any key is out of order, any
+* child does not point back at its parent, or (for nodes that store a
+* balance) a stored balance is not the real height difference or is more
+* than one. problem then names the first failure. balanced tells whether
+* every node's subtrees differ in height by at most one, which is only
+* required of the balanced trees. The root is at depth 0 and a single node
+* tree has height 1.
+*/
+struct TreeShape
+{
+    bool valid;
+    bool balanced;
+    const char* problem;
+    std::size_t nodes;
+    int height;
+    double averageDepth;
+};
+
 /**
 * A templated unbalanced binary search tree.
+* Keys are ordered by Compare, a strict weak ordering like the one std::map
+* takes. If Compare declares is_transparent (std::less<> does), find also
+* accepts any type Compare can compare against Key, e.g. a string_view
+* against string keys, without building a temporary Key.
+* Nodes are obtained from Alloc (rebound to the node type), so passing a
+* SlabAllocator keeps them in large contiguous slabs instead of one heap
+* block each. NodeType is the concrete node class; balanced trees deriving
+* from this pass their own node type so every traversal is resolved at
+* compile time.
 */
-template <typename Key, typename Value>
+template <typename Key, typename Value,
+          typename Compare = std::less<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value> >,
+          typename NodeType = Node<Key, Value> >
 class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
+    explicit BinarySearchTree(const Compare& comp, const Alloc& alloc = Alloc());
+    BinarySearchTree(BinarySearchTree&& other);
+    BinarySearchTree& operator=(BinarySearchTree&& other);
     virtual ~BinarySearchTree(); //TODO
-    virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
-    virtual void remove(const Key& key); //TODO
+    void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    virtual bool remove(const Key& key); //TODO
     void clear(); //TODO
     bool isBalanced() const; //TODO
+    TreeShape validate() const;
     void print() const;
     bool empty() const;
+    TreeStatistics statistics() const;
+    void resetStatistics();
 
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+    template<typename PPKey, typename PPValue, typename PPCompare, typename PPAlloc, typename PPNode>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPCompare, PPAlloc, PPNode> & tree);
 public:
     /**
     * An internal iterator class for traversing the contents of the BST.
+    * It is bidirectional: end() is a NULL node, so the iterator also keeps
+    * the tree it belongs to in order to step back from end() to the
+    * largest item.
     */
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key,Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key,Value>* pointer;
+        typedef std::pair<const Key,Value>& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -221,40 +474,153 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class BinarySearchTree<Key, Value, Compare, Alloc, NodeType>;
+        iterator(NodeType* ptr, const BinarySearchTree* tree);
+        NodeType *current_;
+        const BinarySearchTree *tree_;
+    };
+
+    /**
+    * The read-only counterpart of iterator. Any iterator converts to it.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key,Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key,Value>* pointer;
+        typedef const std::pair<const Key,Value>& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        // Friends so that either side may be a plain iterator.
+        friend bool operator==(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs.it_ == rhs.it_;
+        }
+        friend bool operator!=(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs.it_ != rhs.it_;
+        }
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
-        Node<Key, Value> *current_;
+        iterator it_;
     };
 
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
 public:
     iterator begin() const;
     iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
     iterator find(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
+    // Ordered queries. Each is a single descent like find, and the returned
+    // iterators walk on with operator++ from there, so a range scan costs
+    // O(log n + k). floor is the last key not greater than key, ceiling the
+    // first key not less than it; both return end() when there is none.
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    iterator floor(const Key& key) const;
+    iterator ceiling(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator floor(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator ceiling(const K& key) const;
+
+    // Like insert(const pair&) these search before allocating, so a key that
+    // is already present never costs a node. insert and insert_or_assign
+    // overwrite an existing value; emplace and try_emplace leave it alone.
+    template<typename Pair, typename = typename std::enable_if<
+        std::is_constructible<std::pair<const Key, Value>, Pair&&>::value>::type>
+    void insert(Pair&& keyValuePair);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename K, typename V>
+    std::pair<iterator, bool> emplace(K&& key, V&& value);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj);
+
 protected:
     // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; // TODO
-    Node<Key, Value> *getSmallestNode() const;  // TODO
-    static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
+    template<typename K>
+    NodeType* internalFind(const K& k) const; // TODO
+    template<typename K>
+    std::pair<NodeType*, NodeType*> boundingNodes(const K& key) const;
+    template<typename K>
+    NodeType* lowerBoundNode(const K& key) const;
+    NodeType *getSmallestNode() const;  // TODO
+    NodeType* getLargestNode() const;
+    static NodeType* predecessor(NodeType* current); // TODO
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
 
     // Provided helper functions
-    virtual void printRoot (Node<Key, Value> *r) const;
-    virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
+    void printRoot (NodeType *r) const;
+    virtual void nodeSwap( NodeType* n1, NodeType* n2) ;
 
     // Add helper functions here
-    static Node<Key, Value>* successor(Node<Key, Value>* current);
-    void clearHelper(Node<Key, Value>* node);
-    int pathLength(Node<Key, Value>* node) const; 
+    static NodeType* successor(NodeType* current);
+    void clearHelper(NodeType* node);
+
+    template<typename KeyArg, typename... Args>
+    std::pair<NodeType*, bool> emplaceUnique(KeyArg&& key, Args&&... args);
+    virtual void afterInsert(NodeType* node);
+
+    iterator makeIterator(NodeType* node) const;
+
+    template<typename KeyArgs, typename ValueArgs>
+    NodeType* createNode(NodeType* parent, KeyArgs&& keyArgs, ValueArgs&& valueArgs);
+    void destroyNode(NodeType* node);
+    bool releaseNodes();
+    void passHold(BinarySearchTree& other);
 
 protected:
-    Node<Key, Value>* root_;
-    // You should not need other data members
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<NodeType> NodeAllocator;
+    typedef std::allocator_traits<NodeAllocator> NodeAllocatorTraits;
+
+    NodeType* root_;
+    Compare comp_;
+    NodeAllocator alloc_;
+    AVLBST_STAT(mutable TreeStatisticsRecorder stats_;) //counts even in const lookups
 };
 
 /*
@@ -264,29 +630,32 @@ Begin implementations for the BinarySearchTree::iterator class.
 */
 
 /**
-* Explicit constructor that initializes an iterator with a given node pointer.
+* Explicit constructor that initializes an iterator with a given node pointer
+* in the given tree.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::iterator(NodeType *ptr, const BinarySearchTree *tree)
 {
-    current_ = ptr; 
+    current_ = ptr;
+    tree_ = tree;
 }
 
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::iterator() 
 {
-    current_ = nullptr; 
+    current_ = nullptr;
+    tree_ = nullptr;
 }
 
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
 std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator*() const
 {
     return current_->getItem();
 }
@@ -294,9 +663,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
 std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator->() const
 {
     return &(current_->getItem());
 }
@@ -305,10 +674,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator& rhs) const
 {
     // CHECK
     if (this->current_ == rhs.current_)
@@ -322,10 +691,10 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator& rhs) const
 {
     // CHECK
     if (this->current_ != rhs.current_)
@@ -338,16 +707,59 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator&
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator++()
 {
     current_ = successor(current_); 
     return *this; //this references to the iterator being "++"
 }
 
-template<class Key, class Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current)
+/**
+* Postfix increment, returns the iterator's location before advancing
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator++(int)
+{
+    iterator before = *this;
+    current_ = successor(current_);
+    return before;
+}
+
+/**
+* Moves the iterator back to the previous item in order. Decrementing
+* end() lands on the largest item.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator&
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator--()
+{
+    if (current_ == NULL)
+    {
+        current_ = tree_->getLargestNode(); //stepping back from end()
+    }
+    else
+    {
+        current_ = predecessor(current_);
+    }
+    return *this;
+}
+
+/**
+* Postfix decrement, returns the iterator's location before moving back
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator--(int)
+{
+    iterator before = *this;
+    --(*this);
+    return before;
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::successor(NodeType* current)
 {
     //successor defined as leftmost child on right tree 
     if(current->getRight() != NULL) //I fucking hate checking for existence. So dumb. Maybe have the compiler check first so it doesn't seg fault. 
@@ -361,7 +773,7 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::successor(Node<Key, Value>* curr
     }
     else //From geeks4geeks: if right is null, "Travel up using the parent pointer until you see a node which is left child of its parent. The parent of such a node is the succ."
     {
-        Node<Key, Value>* parentCopy = current->getParent(); 
+        NodeType* parentCopy = current->getParent(); 
         while(parentCopy != NULL && parentCopy->getRight() == current) //this aims to find the first parent that has a left branch with our original node. The parent is therefor next largest to the original in BST 
         {
             current = parentCopy; 
@@ -378,6 +790,91 @@ End implementations for the BinarySearchTree::iterator class.
 -------------------------------------------------------------
 */
 
+/*
+---------------------------------------------------------------------
+Begin implementations for the BinarySearchTree::const_iterator class.
+---------------------------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::const_iterator()
+{
+}
+
+/**
+* Converts a mutable iterator into a read-only one at the same item.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::const_iterator(const iterator& it) : it_(it)
+{
+}
+
+/**
+* Provides read-only access to the item.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+const std::pair<const Key,Value> &
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::operator*() const
+{
+    return *it_;
+}
+
+/**
+* Provides the read-only address of the item.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+const std::pair<const Key,Value> *
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::operator->() const
+{
+    return it_.operator->();
+}
+
+/**
+* Steps forward and back exactly like iterator.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator&
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::operator++()
+{
+    ++it_;
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::operator++(int)
+{
+    const_iterator before = *this;
+    ++it_;
+    return before;
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator&
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::operator--()
+{
+    --it_;
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::operator--(int)
+{
+    const_iterator before = *this;
+    --it_;
+    return before;
+}
+
+/*
+-------------------------------------------------------------------
+End implementations for the BinarySearchTree::const_iterator class.
+-------------------------------------------------------------------
+*/
+
 /*
 -----------------------------------------------------
 Begin implementations for the BinarySearchTree class.
@@ -387,29 +884,104 @@ Begin implementations for the BinarySearchTree class.
 /**
 * Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::BinarySearchTree() 
 {
     root_ = NULL; 
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* Constructor taking the comparison object and the allocator to draw nodes from.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::BinarySearchTree(const Compare& comp, const Alloc& alloc) :
+    root_(NULL),
+    comp_(comp),
+    alloc_(alloc)
 {
-    clearHelper(root_); //helper function 
+
+}
+
+/**
+* Move constructor. The nodes change hands without being touched and other
+* is left empty. The allocator is copied rather than moved so other can
+* still be used, which for a SlabAllocator means both share one pool; the
+* hold on the pool (see SlabAllocator::hold) moves with the nodes.
+* Trees are not copyable.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::BinarySearchTree(BinarySearchTree&& other) :
+    root_(other.root_),
+    comp_(other.comp_),
+    alloc_(other.alloc_)
+{
+    other.root_ = NULL;
+    passHold(other);
+}
+
+/**
+* Move assignment. Frees this tree's nodes and takes over other's, along
+* with its comparator and allocator (the nodes must go back to the
+* allocator they came from).
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>&
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::operator=(BinarySearchTree&& other)
+{
+    if (this != &other)
+    {
+        clear();
+        root_ = other.root_;
+        comp_ = other.comp_;
+        alloc_ = other.alloc_;
+        other.root_ = NULL;
+        passHold(other);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::~BinarySearchTree()
+{
+    clear(); 
 }
 
 /**
  * Returns true if tree is empty
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+bool BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::empty() const
 {
     return root_ == NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+/**
+* Returns a snapshot of the operation counters (see TreeStatistics). All
+* zero, with enabled false, unless the tree was compiled with AVLBST_STATS.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+TreeStatistics BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::statistics() const
+{
+#ifdef AVLBST_STATS
+    return stats_.snapshot();
+#else
+    TreeStatistics stats = TreeStatistics();
+    stats.enabled = false;
+    return stats;
+#endif
+}
+
+/**
+* Zeroes the operation counters.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::resetStatistics()
+{
+    AVLBST_STAT(stats_.reset();)
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::print() const
 {
     printRoot(root_);
     std::cout << "\n";
@@ -418,140 +990,422 @@ void BinarySearchTree<Key, Value>::print() const
 /**
 * Returns an iterator to the "smallest" item in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::begin() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator begin(getSmallestNode(), this);
     return begin;
 }
 
 /**
 * Returns an iterator whose value means INVALID
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::end() const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator end(NULL, this);
     return end;
 }
 
+/**
+* Read-only versions of begin() and end()
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::cbegin() const
+{
+    return const_iterator(begin());
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::cend() const
+{
+    return const_iterator(end());
+}
+
+/**
+* Returns a reverse iterator to the largest item, walking down in order
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+/**
+* Returns the reverse iterator past the smallest item
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+/**
+* Read-only versions of rbegin() and rend()
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::crbegin() const
+{
+    return const_reverse_iterator(cend());
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::crend() const
+{
+    return const_reverse_iterator(cbegin());
+}
+
 /**
 * Returns an iterator to the item with the given key, k
 * or the end iterator if k does not exist in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::find(const Key & k) const
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
+    NodeType *curr = internalFind(k);
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator it(curr, this);
     return it;
 }
 
+/**
+* Heterogeneous find, only available with a transparent Compare. k is compared
+* against the stored keys directly instead of being converted to a Key.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::find(const K & k) const
+{
+    return makeIterator(internalFind(k));
+}
+
 /**
  * @precondition The key exists in the map
  * Returns the value associated with the key
  */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+Value& BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::operator[](const Key& key)
 {
-    Node<Key, Value> *curr = internalFind(key);
+    NodeType *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+Value const & BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::operator[](const Key& key) const
 {
-    Node<Key, Value> *curr = internalFind(key);
+    NodeType *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
 
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if every key is less than it.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::lower_bound(const Key& key) const
+{
+    return makeIterator(lowerBoundNode(key));
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or end() if no key is greater.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::upper_bound(const Key& key) const
+{
+    return makeIterator(boundingNodes(key).second);
+}
+
+/**
+* Returns [lower_bound(key), upper_bound(key)) from a single descent.
+* Keys are unique, so the range holds at most one item.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::equal_range(const Key& key) const
+{
+    std::pair<NodeType*, NodeType*> bounds = boundingNodes(key);
+    if (bounds.first != NULL && !comp_(bounds.first->getKey(), key)) //key is present
+    {
+        return std::make_pair(makeIterator(bounds.first), makeIterator(bounds.second));
+    }
+    return std::make_pair(makeIterator(bounds.second), makeIterator(bounds.second));
+}
+
+/**
+* Returns an iterator to the item with the greatest key not greater than
+* key, or end() if every key is greater.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::floor(const Key& key) const
+{
+    return makeIterator(boundingNodes(key).first);
+}
+
+/**
+* Returns an iterator to the item with the smallest key not less than key,
+* or end() if every key is less. The same item as lower_bound(key).
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::ceiling(const Key& key) const
+{
+    return makeIterator(lowerBoundNode(key));
+}
+
+/**
+* Heterogeneous versions of the ordered queries, only available with a
+* transparent Compare, like the heterogeneous find.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::lower_bound(const K& key) const
+{
+    return makeIterator(lowerBoundNode(key));
+}
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::upper_bound(const K& key) const
+{
+    return makeIterator(boundingNodes(key).second);
+}
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename K, typename C, typename>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::equal_range(const K& key) const
+{
+    std::pair<NodeType*, NodeType*> bounds = boundingNodes(key);
+    if (bounds.first != NULL && !comp_(bounds.first->getKey(), key))
+    {
+        return std::make_pair(makeIterator(bounds.first), makeIterator(bounds.second));
+    }
+    return std::make_pair(makeIterator(bounds.second), makeIterator(bounds.second));
+}
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::floor(const K& key) const
+{
+    return makeIterator(boundingNodes(key).first);
+}
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::ceiling(const K& key) const
+{
+    return makeIterator(lowerBoundNode(key));
+}
+
 /**
 * An insert method to insert into a Binary Search Tree.
 * The tree will not remain balanced when inserting.
 * Recall: If key is already in the tree, you should 
 * overwrite the current value with the updated value.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    insert_or_assign(keyValuePair.first, keyValuePair.second); 
+}
+
+/**
+* Inserts or overwrites like insert(const pair&), but takes the pair by
+* forwarding reference so an rvalue pair has its key and value moved in.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename Pair, typename>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert(Pair&& keyValuePair)
+{
+    insert_or_assign(std::forward<Pair>(keyValuePair).first, std::forward<Pair>(keyValuePair).second); 
+}
+
+/**
+* Inserts a key/value pair built from args unless the key is already present.
+* The pair is built on the stack first so the key can be searched for before
+* any node is allocated; its value is then moved into the new node.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::emplace(Args&&... args)
+{
+    std::pair<const Key, Value> item(std::forward<Args>(args)...);
+    return try_emplace(item.first, std::move(item.second));
+}
+
+/**
+* The common emplace(key, value) form, which skips building a temporary pair.
+* A key of some other type is converted to a Key once up front, since Compare
+* is only required to accept Keys and would otherwise convert at every level.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename K, typename V>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::emplace(K&& key, V&& value)
+{
+    typedef typename std::conditional<std::is_same<typename std::decay<K>::type, Key>::value, K&&, Key>::type KeyArg;
+    KeyArg k(std::forward<K>(key));
+    std::pair<NodeType*, bool> result = emplaceUnique(std::forward<KeyArg>(k), std::forward<V>(value));
+    return std::make_pair(makeIterator(result.first), result.second);
+}
+
+/**
+* Inserts key with a value constructed from args if key is not present.
+* If it is, nothing is constructed and args are left untouched.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::try_emplace(const Key& key, Args&&... args)
+{
+    std::pair<NodeType*, bool> result = emplaceUnique(key, std::forward<Args>(args)...);
+    return std::make_pair(makeIterator(result.first), result.second);
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::try_emplace(Key&& key, Args&&... args)
+{
+    std::pair<NodeType*, bool> result = emplaceUnique(std::move(key), std::forward<Args>(args)...);
+    return std::make_pair(makeIterator(result.first), result.second);
+}
+
+/**
+* Inserts key with obj as its value, or assigns obj over the existing value.
+* The bool in the result is true if a new node was inserted.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert_or_assign(const Key& key, M&& obj)
 {
-    //dynamic allocation of new node 
-    Node<Key, Value>* newNode = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, NULL); 
-    if(root_ == NULL) //if empty tree ~ base case. Sets root to new node with no parent and key/value pair 
+    std::pair<NodeType*, bool> result = emplaceUnique(key, std::forward<M>(obj));
+    if (!result.second)
     {
-        root_ = newNode; //sets root to newly inserted 
-        return; 
+        result.first->getValue() = std::forward<M>(obj); //obj was not consumed since no node was made 
     }
-    else //otherwise start trickling down the tree 
+    return std::make_pair(makeIterator(result.first), result.second);
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert_or_assign(Key&& key, M&& obj)
+{
+    std::pair<NodeType*, bool> result = emplaceUnique(std::move(key), std::forward<M>(obj));
+    if (!result.second)
+    {
+        result.first->getValue() = std::forward<M>(obj);
+    }
+    return std::make_pair(makeIterator(result.first), result.second);
+}
+
+/**
+* The insertion workhorse. Walks down from the root looking for key and
+* returns the existing node (and false) if it finds it. Otherwise it builds
+* a node from key and args at the empty slot it reached, links it in, lets
+* afterInsert rebalance, and returns the new node (and true).
+* Like internalFind it makes one comparison per level, or stops at an
+* equal key when EarlyExitSearch says that is cheaper.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename KeyArg, typename... Args>
+std::pair<NodeType*, bool> BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::emplaceUnique(KeyArg&& key, Args&&... args)
+{
+    NodeType* parent = NULL; 
+    NodeType* candidate = NULL; //last node whose key is not greater than key 
+    NodeType* current = root_; 
+    bool goLeft = false; 
+    while (current != NULL) //trickle down until we fall off the tree 
     {
-        Node<Key, Value>* current = root_; //copy of root 
-        while(newNode)
+        if constexpr (EarlyExitSearch<Key, Compare>::value)
         {
-            if(newNode->getKey() < current->getKey()) //going left 
-            {
-                if(current->getLeft() != NULL) //if left exists 
-                {
-                    current = current->getLeft(); //moves current comparison down left
-                }
-                else if (current->getLeft() == NULL) //if found spot for the inserted node
-                {
-                    newNode->setParent(current); //sets parent as current 
-                    (newNode->getParent())->setLeft(newNode); //sets parents left child as newNode 
-                    return; 
-                }
-            }
-            else if (newNode->getKey() > current->getKey()) //going right
-            {
-                if (current->getRight() != NULL) //if right exists
-                {
-                    current = current->getRight(); 
-                }
-                else if (current->getRight() == NULL)
-                {
-                    newNode->setParent(current); 
-                    (newNode->getParent())->setRight(newNode);
-                    return; 
-                }
-            }
-            else if (newNode->getKey() == current->getKey()) //if overwrite 
+            if (key == current->getKey())
             {
-                current->setValue(newNode->getValue()); //overwrites values
-                delete newNode; 
-                return; 
+                return std::make_pair(current, false); //already present, nothing allocated 
             }
         }
+        parent = current; 
+        goLeft = comp_(key, current->getKey()); 
+        candidate = goLeft ? candidate : current; 
+        current = childOf(current, goLeft); 
+    }
+    if (!EarlyExitSearch<Key, Compare>::value && candidate != NULL && !comp_(candidate->getKey(), key)) 
+    {
+        return std::make_pair(candidate, false); 
+    }
+
+    NodeType* newNode = createNode(parent, std::forward_as_tuple(std::forward<KeyArg>(key)),
+                                   std::forward_as_tuple(std::forward<Args>(args)...)); 
+    if (parent == NULL) //empty tree 
+    {
+        root_ = newNode; 
     }
+    else if (goLeft) 
+    {
+        parent->setLeft(newNode); 
+    }
+    else 
+    {
+        parent->setRight(newNode); 
+    }
+    afterInsert(newNode); 
+    return std::make_pair(newNode, true); 
+}
+
+/**
+* Called once a new node has been linked in. A plain BST does not rebalance.
+*/
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::afterInsert(NodeType*)
+{
+
 }
 
 /**
 * A remove method to remove a specific key from a Binary Search Tree.
 * Recall: The writeup specifies that if a node has 2 children you
 * should swap with the predecessor and then remove.
+* Returns true if key was present.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+bool BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::remove(const Key& key)
 {
-    Node<Key, Value>* target = internalFind(key); //point to node to be deleted 
+    NodeType* target = internalFind(key); //point to node to be deleted 
     if (target == NULL) 
     {
-        return;  //if not found 
+        return false;  //if not found 
     }
     if (target->getLeft() && target->getRight()) //if two children, first swap. Other cases will handle the rest 
     {
-        Node<Key, Value>* pred = predecessor(target);
+        NodeType* pred = predecessor(target);
         nodeSwap(target, pred);
     }
 
-    Node<Key, Value>* child = target->getLeft(); //defaults to left but checks right since we want the largest child
+    NodeType* child = target->getLeft(); //defaults to left but checks right since we want the largest child
     if (target->getRight() != NULL) 
     {
         child = target->getRight(); //child will either be NULL or right child. 
     }
 
-    Node<Key, Value>* parent = target->getParent();
+    NodeType* parent = target->getParent();
     if (child != NULL)
     {
         child->setParent(parent); // if there is a right child it's parent will be the target's (now swapped) parent
@@ -571,12 +1425,13 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
             parent->setRight(child); //replace as right child 
         }
     }
-    delete target; //actual deletion once everything is done. 
+    destroyNode(target); //actual deletion once everything is done. 
+    return true;
 }
 
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType*
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::predecessor(NodeType* current)
 {
     //predecessor: rightmost child on left tree 
     if(current->getLeft() != NULL) //left tree
@@ -590,7 +1445,7 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
     }
     else if (current->getLeft() == NULL) //opposite of the successor function
     {
-        Node<Key, Value>* parentCopy = current->getParent(); 
+        NodeType* parentCopy = current->getParent(); 
         while(parentCopy != NULL && parentCopy->getLeft() == current) 
         {
             current = parentCopy; 
@@ -604,25 +1459,40 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
 /**
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
+* With a SlabAllocator and trivially destructible items this takes
+* O(slabs) rather than O(n) when the tree owns everything live in the
+* arena: no other tree that shares it still has nodes, and nothing was
+* allocated from it except through trees. Copies of the allocator and
+* trees emptied by a move, split or join do not count. Otherwise the nodes
+* are freed one at a time.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear() 
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::clear() 
 {
     //this function is so dumb. The only difference is that root is now null instead of actually gone. This little detail took me 5 hours. No exaggeration. 
-    clearHelper(root_); //call on root to delete whole tree 
+    //a pooling allocator can drop all of its slabs at once, so nodes only need to be visited when their items have destructors to run
+    if (!std::is_trivially_destructible<std::pair<const Key, Value> >::value || !releaseNodes())
+    {
+        clearHelper(root_); //call on root to delete whole tree 
+    }
     root_ = NULL; 
+    unholdAllocator(alloc_);
 }
 
 
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+NodeType*
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::getSmallestNode() const
 {
     //smallest node, assuming this BST is sorted and top = max, would be the leftmost 
-    Node<Key, Value>* finder = root_; //copy of root 
+    NodeType* finder = root_; //copy of root 
+    if (finder == NULL)
+    {
+        return NULL; //empty tree, begin() == end() 
+    }
     while (finder->getLeft() != NULL) //while there is a left
     {
         finder = finder->getLeft(); //keep trickling left 
@@ -631,152 +1501,338 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
 }
 
 /**
-* Helper function to find a node with given key, k and
-* return a pointer to it or NULL if no item with that key
-* exists
+* A helper function to find the largest node in the tree, or NULL if it is
+* empty. The mirror image of getSmallestNode.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+NodeType*
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::getLargestNode() const
 {
-  Node<Key, Value>* checker = root_; //makes copy of root for iteration 
-  while (checker != NULL)
-  {
-    if (checker->getKey() == key) //if found return checker 
+    NodeType* finder = root_;
+    if (finder == NULL)
     {
-      return checker; 
+        return NULL;
     }
-    else if (checker->getKey() > key) //if current key value is greater than target key, go left
+    while (finder->getRight() != NULL) //the rightmost node is the largest
     {
-      checker = checker->getLeft(); 
+        finder = finder->getRight();
     }
-    else if (checker->getKey() < key)
+    return finder;
+}
+
+/**
+* Helper function to find a node with given key, k and
+* return a pointer to it or NULL if no item with that key
+* exists. Each level costs a single comp_ call: the walk
+* always goes down to a leaf remembering the last node
+* that was not greater than key, and one final comparison
+* decides whether that node is a match. Cheap keys (see
+* EarlyExitSearch) stop at the match instead.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::internalFind(const K& key) const
+{
+  NodeType* checker = root_; //makes copy of root for iteration
+  if constexpr (EarlyExitSearch<Key, Compare>::value)
+  {
+    AVLBST_STAT(int depth = 0;)
+    while (checker != NULL)
     {
-      checker = checker->getRight(); 
+      AVLBST_STAT(++depth;)
+      if (key == checker->getKey())
+      {
+        AVLBST_STAT(stats_.lookup(depth, 2 * depth - 1);)
+        return checker;
+      }
+      checker = childOf(checker, comp_(key, checker->getKey()));
     }
+    AVLBST_STAT(stats_.lookup(depth, 2 * depth);)
+    return NULL;
   }
+  NodeType* candidate = boundingNodes(key).first; //last node not greater than key 
+  if (candidate != NULL && !comp_(candidate->getKey(), key)) 
+  {
+    AVLBST_STAT(stats_.comparison();)
+    return candidate; 
+  }
+  AVLBST_STAT(if (candidate != NULL) stats_.comparison();)
   return NULL; //else return this if not found 
 }
 
 /**
- * Return true iff the BST is balanced.
+* The descent shared by internalFind and the ordered queries. Walks from the
+* root to a leaf with one comp_ call per level and returns the last node
+* whose key is not greater than key (the floor, where the walk last went
+* right) and the last node whose key is greater (the upper bound, where it
+* last went left). Either is NULL if there is no such node.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K>
+std::pair<NodeType*, NodeType*>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::boundingNodes(const K& key) const
+{
+  NodeType* notGreater = NULL;
+  NodeType* greater = NULL;
+  NodeType* checker = root_;
+  AVLBST_STAT(int depth = 0;)
+  while (checker != NULL)
+  {
+    AVLBST_STAT(++depth;)
+    bool goLeft = comp_(key, checker->getKey()); //if target key is less than current key value, go left
+    notGreater = goLeft ? notGreater : checker; //otherwise checker could be the match, keep looking right for a closer one 
+    greater = goLeft ? checker : greater;
+    checker = childOf(checker, goLeft); 
+  }
+  AVLBST_STAT(stats_.lookup(depth, depth);)
+  return std::make_pair(notGreater, greater);
+}
+
+/**
+* Returns the first node whose key is not less than key, or NULL. That is
+* the floor when it matches key exactly and the upper bound otherwise.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::lowerBoundNode(const K& key) const
+{
+  std::pair<NodeType*, NodeType*> bounds = boundingNodes(key);
+  AVLBST_STAT(if (bounds.first != NULL) stats_.comparison();)
+  if (bounds.first != NULL && !comp_(bounds.first->getKey(), key))
+  {
+    return bounds.first;
+  }
+  return bounds.second;
+}
+
+/**
+ * Return true iff the BST is balanced, that is every node's subtrees differ
+ * in height by at most one.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const //taken from part 1. Input is the root 
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+bool BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::isBalanced() const
 {
-    if(root_ == NULL)
-    {
-        return true; 
-    }
-    Node<Key, Value>* root = root_;
-    if (pathLength(root_) > 0 && pathLength(root->getLeft()) == pathLength(root->getRight()))
-    {
-        return true;
-    }
-    return false; 
-    /*
-    Node<Key, Value>* root = root_; //makes copy of root 
-    if (root == NULL)
+    return validate().balanced;
+}
+
+/**
+* Checks the whole tree in one O(n) walk and measures its shape (see
+* TreeShape). The walk keeps its own stack rather than recursing, so a
+* degenerate tree cannot overflow the call stack, and it follows only child
+* links, so broken parent links are reported rather than followed. Keys are
+* checked in order against their in-order predecessor, one comparison per
+* node. It only reads the tree, so it may run alongside other readers.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+TreeShape BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::validate() const
+{
+    struct Frame
     {
-        return true; //empty tree, balanced by default 
-    }
-    if (root->getLeft() != NULL && root->getRight() != NULL) //if children exist
+        NodeType* node;
+        int leftHeight;
+        bool leftDone;
+    };
+
+    TreeShape shape;
+    shape.valid = root_ == NULL || root_->getParent() == NULL;
+    shape.balanced = true;
+    shape.problem = shape.valid ? NULL : "root has a parent";
+    shape.nodes = 0;
+    shape.height = 0;
+    shape.averageDepth = 0.0;
+
+    std::vector<Frame> path;
+    std::size_t depthSum = 0;
+    NodeType* previous = NULL; //in-order predecessor of the next node visited
+    NodeType* node = root_;
+    int height = 0; //height of the subtree finished last
+    while (true)
     {
-        if (pathLength(root->getLeft()) == pathLength(root->getRight()) 
-        && abs(pathLength(root->getLeft()) - pathLength(root->getRight())) <= 1 
-        && )
+        while (node != NULL) //go down the left spine
         {
-            return true; 
+            path.push_back(Frame{node, 0, false});
+            node = node->getLeft();
         }
-        return (pathLength(root->getLeft()) == pathLength(root->getRight())); //call to helper, true if lengths equal 
+        height = 0;
+        while (!path.empty() && path.back().leftDone) //finish every node whose right subtree is done
+        {
+            Frame& frame = path.back();
+            NodeType* current = frame.node;
+            int difference = height - frame.leftHeight;
+            if (difference < -1 || difference > 1)
+            {
+                shape.balanced = false;
+            }
+            if constexpr (KeepsBalance<NodeType>::value)
+            {
+                if (shape.valid && current->getBalance() != difference)
+                {
+                    shape.valid = false;
+                    shape.problem = "stored balance does not match subtree heights";
+                }
+                if (shape.valid && !shape.balanced)
+                {
+                    shape.valid = false;
+                    shape.problem = "subtree heights differ by more than one";
+                }
+            }
+            height = std::max(frame.leftHeight, height) + 1;
+            path.pop_back();
+        }
+        if (path.empty())
+        {
+            break;
+        }
+        Frame& frame = path.back(); //its left subtree is done: visit it, then its right subtree
+        NodeType* current = frame.node;
+        frame.leftHeight = height;
+        frame.leftDone = true;
+        std::size_t depth = path.size() - 1;
+        ++shape.nodes;
+        depthSum += depth;
+        shape.height = std::max(shape.height, (int)depth + 1);
+        if (shape.valid && previous != NULL && !comp_(previous->getKey(), current->getKey()))
+        {
+            shape.valid = false;
+            shape.problem = "keys out of order";
+        }
+        NodeType* left = current->getLeft();
+        NodeType* right = current->getRight();
+        if (shape.valid && ((left != NULL && left->getParent() != current) ||
+                            (right != NULL && right->getParent() != current)))
+        {
+            shape.valid = false;
+            shape.problem = "child does not point back at its parent";
+        }
+        previous = current;
+        node = right;
     }
-    else if (root->getLeft() == NULL && root->getRight() == NULL)
+    if (shape.nodes > 0)
     {
-        return true; //if just 1 node return true  
+        shape.averageDepth = (double)depthSum / shape.nodes;
     }
-    else
-    {
-        return false; //all other options reveal false 
-    }*/
+    return shape;
 }
 
-template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::pathLength(Node<Key, Value>* node) const //helper function for isBalanced
+/**
+* Destroys the subtree rooted at node without recursing, so a tree that has
+* degenerated into a long chain cannot overflow the stack. Whenever the
+* current node has a left child it is rotated right, which moves the left
+* subtree up a level; a node without a left child is destroyed and the walk
+* carries on with its right child. Every rotation puts one more node on the
+* spine that is walked down, so the whole teardown is O(n). Parent links
+* are left stale since every node is about to go.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::clearHelper(NodeType* node)
 {
-    if (node == NULL)
-    {
-        return 0;  //halting condition
-    }
-    int leftSubtree = pathLength(node->getLeft());
-    int rightSubtree = pathLength(node->getRight());
-    if (leftSubtree == -1)
-    {
-        return -1;
-    }
-    if (rightSubtree == -1)
-    {
-        return -1;
-    }
-    if (abs(leftSubtree - rightSubtree) > 1)
-    {
-        return -1; 
-    }
-    else
+    while (node != NULL)
     {
-        return std::max(leftSubtree, rightSubtree) + 1;
+        NodeType* left = node->getLeft();
+        if (left != NULL)
+        {
+            node->setLeft(left->getRight()); //rotate right
+            left->setRight(node);
+            node = left;
+        }
+        else
+        {
+            NodeType* right = node->getRight();
+            destroyNode(node);
+            node = right;
+        }
     }
+}
 
-    /*
-    if (node->getLeft() != NULL && node->getRight() == NULL) //if node has just left subtree
-    {
-        return 1 + pathLength(node->getLeft()); //return 1 + recursive length of left subtree 
-    }
-    else if (node->getLeft() == NULL && node->getRight() != NULL) //if node has just right subtree
+/**
+* Wraps a node in an iterator, for derived trees that find nodes themselves.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::makeIterator(NodeType* node) const
+{
+    return iterator(node, this);
+}
+
+/**
+* Allocates a node from the tree's allocator and constructs its key and value
+* in place from the argument tuples.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename KeyArgs, typename ValueArgs>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::createNode(NodeType* parent, KeyArgs&& keyArgs, ValueArgs&& valueArgs)
+{
+    holdAllocator(alloc_);
+    NodeType* node = NodeAllocatorTraits::allocate(alloc_, 1);
+    try
     {
-        return 1 + pathLength(node->getRight()); 
+        NodeAllocatorTraits::construct(alloc_, node, std::piecewise_construct,
+                                       std::forward<KeyArgs>(keyArgs), std::forward<ValueArgs>(valueArgs), parent);
     }
-    else if (node->getLeft() != NULL && node->getRight() != NULL) //if node has both left and right subtrees
+    catch (...)
     {
-        return 1 + std::max(pathLength(node->getLeft()), pathLength(node->getRight())); //returns max for true depth
+        NodeAllocatorTraits::deallocate(alloc_, node, 1);
+        throw;
     }
-    return 0; //halting condition, if node has no subtrees return 0; 
-    */
+    AVLBST_STAT(stats_.allocation();)
+    return node;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clearHelper(Node<Key, Value>* node) //helper function since clear makes it difficult to directly reference 
+/**
+* Destroys a node made by createNode and hands its memory back to the allocator.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::destroyNode(NodeType* node)
 {
-    //INPUT SHOULD BE ROOT FIX NAME
-    if (node != NULL)
-    {
-        clearHelper(node->getLeft()); //recursive calls to both branches 
-        clearHelper(node->getRight()); 
-        delete node; 
-    }
-    else 
+    NodeAllocatorTraits::destroy(alloc_, node);
+    NodeAllocatorTraits::deallocate(alloc_, node, 1);
+    AVLBST_STAT(stats_.free();)
+}
+
+/**
+* Frees every node in one step without destroying them. Only succeeds when the
+* allocator is a pool in which this tree owns everything live; returns false
+* otherwise.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+bool BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::releaseNodes()
+{
+    return releaseAllocator(alloc_);
+}
+
+/**
+* Called once this tree has taken over other's nodes: the hold on the pool
+* they live in goes from other's allocator to this one's.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::passHold(BinarySearchTree& other)
+{
+    if (root_ != NULL)
     {
-        return; 
+        holdAllocator(alloc_);
     }
+    unholdAllocator(other.alloc_);
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::nodeSwap( NodeType* n1, NodeType* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
     }
-    Node<Key, Value>* n1p = n1->getParent();
-    Node<Key, Value>* n1r = n1->getRight();
-    Node<Key, Value>* n1lt = n1->getLeft();
+    NodeType* n1p = n1->getParent();
+    NodeType* n1r = n1->getRight();
+    NodeType* n1lt = n1->getLeft();
     bool n1isLeft = false;
     if(n1p != NULL && (n1 == n1p->getLeft())) n1isLeft = true;
-    Node<Key, Value>* n2p = n2->getParent();
-    Node<Key, Value>* n2r = n2->getRight();
-    Node<Key, Value>* n2lt = n2->getLeft();
+    NodeType* n2p = n2->getParent();
+    NodeType* n2r = n2->getRight();
+    NodeType* n2lt = n2->getLeft();
     bool n2isLeft = false;
     if(n2p != NULL && (n2 == n2p->getLeft())) n2isLeft = true;
 
 
-    Node<Key, Value>* temp;
+    NodeType* temp;
     temp = n1->getParent();
     n1->setParent(n2->getParent());
     n2->setParent(temp);
@@ -0,0 +1,713 @@
+#ifndef COMPACT_AVLBST_H
+#define COMPACT_AVLBST_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "avlbst.h"
+
+/**
+* The node store behind CompactAVLNode: every node of type T in the process
+* lives in one numbered array of slots, so a link between nodes can be a
+* 32 bit slot index instead of a 64 bit pointer. The array grows in aligned
+* 1 MiB chunks that do not move, so following an index is one load from a
+* static chunk table, and a node's own index is found from its address: the
+* chunk it sits in starts with the chunk's number. Index 0 is never handed
+* out and stands for NULL.
+*
+* Each thread allocates from its own cache: a run of fresh slots carved
+* from a chunk and a list of slots it has freed. The pool's mutex is only
+* taken to refill or spill a cache, Batch slots at a time, so trees on
+* different threads do not queue on it node by node. The pool counts live
+* nodes, in credits that threads take and give back Batch at a time; when
+* the count drops to zero and the pool has grown past one chunk, every
+* chunk goes back to the system, so building and dropping a large tree
+* does not keep its peak memory for the life of the process.
+*
+* Limits:
+* - There is one pool per node type for the whole process, shared by every
+*   tree with that node type on every thread. At most a little under 2^32
+*   of its nodes can be live at once.
+* - Links are indices into this process's pool, so nodes are not trivially
+*   relocatable: a tree cannot be copied as raw memory, written out and
+*   mapped back, or handed to another process.
+* - A thread keeps up to a few Batches of free slots and credits for
+*   itself until it exits, so memory goes back to the system only once
+*   every thread that used the pool has freed its nodes or exited.
+*/
+template <typename T>
+class CompactNodePool
+{
+public:
+    static T* pointer(uint32_t index);
+    static uint32_t index(const T* node);
+    static T* allocate();
+    static void deallocate(T* node);
+    static std::size_t chunkCount();
+
+private:
+    static constexpr unsigned bitsFor(std::size_t count);
+
+    static const std::size_t ChunkBytes = std::size_t(1) << 20;
+    static const std::size_t HeaderBytes = 64;
+    static const std::size_t SlotsPerChunk = (ChunkBytes - HeaderBytes) / sizeof(T);
+    static const unsigned SlotBits = bitsFor(SlotsPerChunk);
+    static const std::size_t MaxChunks = std::size_t(1) << (32 - SlotBits);
+    static const uint32_t Batch = 256;
+    static const std::size_t Releasing = ~(~std::size_t(0) >> 1); //top bit of live_
+
+    static_assert(alignof(T) <= HeaderBytes, "CompactNodePool: node alignment too large");
+    static_assert(SlotsPerChunk >= 1, "CompactNodePool: node too large for a chunk");
+    static_assert(sizeof(T) >= 3 * sizeof(uint32_t), "CompactNodePool: node too small for a free slot's links");
+
+    // Sits at the start of every chunk, ahead of its slots.
+    struct ChunkHeader
+    {
+        uint32_t number;
+    };
+
+    // One thread's slots and credits. Free slots are linked through their
+    // first word; the head of a batch on the pool's list also holds the
+    // next batch and its own length.
+    struct Cache
+    {
+        Cache();
+        ~Cache();
+        void reset();
+
+        uint32_t generation;
+        uint32_t freeList;
+        uint32_t freeCount;
+        uint32_t bump;
+        uint32_t bumpEnd;
+        std::size_t credits;
+    };
+
+    static uint32_t freeWord(uint32_t slot, unsigned word);
+    static void setFreeWord(uint32_t slot, unsigned word, uint32_t value);
+    static void refill(Cache& cache);
+    static void spill(Cache& cache, uint32_t count);
+    static void tryRelease(Cache& cache);
+
+    static T* chunks_[MaxChunks]; //first slot of each chunk; chunk 0 is unused
+    static std::mutex mutex_;
+    static std::atomic<std::size_t> chunkCount_;
+    static std::atomic<std::size_t> live_; //live nodes plus credits held by threads
+    static std::atomic<uint32_t> generation_; //bumped each time the chunks are released
+    static uint32_t freeBatches_;
+    static uint32_t bump_;
+    static uint32_t bumpEnd_;
+    static thread_local Cache cache_;
+};
+
+template <typename T>
+T* CompactNodePool<T>::chunks_[CompactNodePool<T>::MaxChunks];
+template <typename T>
+std::mutex CompactNodePool<T>::mutex_;
+template <typename T>
+std::atomic<std::size_t> CompactNodePool<T>::chunkCount_(1);
+template <typename T>
+std::atomic<std::size_t> CompactNodePool<T>::live_(0);
+template <typename T>
+std::atomic<uint32_t> CompactNodePool<T>::generation_(0);
+template <typename T>
+uint32_t CompactNodePool<T>::freeBatches_ = 0;
+template <typename T>
+uint32_t CompactNodePool<T>::bump_ = 0;
+template <typename T>
+uint32_t CompactNodePool<T>::bumpEnd_ = 0;
+template <typename T>
+thread_local typename CompactNodePool<T>::Cache CompactNodePool<T>::cache_;
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the CompactNodePool class.
+  ----------------------------------------------------
+*/
+
+/**
+* The number of bits needed to number count slots, i.e. ceil(log2(count)).
+*/
+template <typename T>
+constexpr unsigned CompactNodePool<T>::bitsFor(std::size_t count)
+{
+    return count <= 1 ? 0 : 1 + bitsFor((count + 1) / 2);
+}
+
+/**
+* Returns the node with the given index, or NULL for index 0. There is no
+* test for 0: it is slot 0 of chunk 0, whose table entry stays NULL. Without
+* a branch the tree's descent can pick the left or right index with a
+* conditional move, which matters more than anything else here.
+*/
+template <typename T>
+T* CompactNodePool<T>::pointer(uint32_t index)
+{
+    return chunks_[index >> SlotBits] + (index & ((uint32_t(1) << SlotBits) - 1));
+}
+
+/**
+* Returns the index of a node from this pool, or 0 for NULL.
+*/
+template <typename T>
+uint32_t CompactNodePool<T>::index(const T* node)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+    uintptr_t chunk = reinterpret_cast<uintptr_t>(node) & ~(uintptr_t)(ChunkBytes - 1);
+    uint32_t number = reinterpret_cast<const ChunkHeader*>(chunk)->number;
+    std::size_t slot = node - reinterpret_cast<const T*>(chunk + HeaderBytes);
+    return (number << SlotBits) | (uint32_t)slot;
+}
+
+/**
+* Hands out storage for one node from this thread's cache, preferring
+* recycled slots. A thread without credits first takes Batch of them; if
+* that finds the chunks being released, or released since its cache was
+* filled, it waits for the release and starts over with an empty cache.
+* Throws std::bad_alloc once every index is in use.
+*/
+template <typename T>
+T* CompactNodePool<T>::allocate()
+{
+    Cache& cache = cache_;
+    if (cache.credits == 0)
+    {
+        if (live_.fetch_add(Batch, std::memory_order_acquire) & Releasing)
+        {
+            std::lock_guard<std::mutex> wait(mutex_); //held until the release is done
+        }
+        cache.credits = Batch;
+        if (cache.generation != generation_.load(std::memory_order_relaxed))
+        {
+            cache.reset();
+        }
+    }
+    if (cache.freeList == 0 && cache.bump == cache.bumpEnd)
+    {
+        refill(cache);
+    }
+    uint32_t slot = cache.freeList;
+    if (slot != 0)
+    {
+        cache.freeList = freeWord(slot, 0);
+        --cache.freeCount;
+    }
+    else
+    {
+        slot = cache.bump++;
+    }
+    --cache.credits;
+    return pointer(slot);
+}
+
+/**
+* Puts a node's slot on this thread's free list, passing Batch slots to the
+* pool once the list is long and Batch credits back once it holds many.
+* If that leaves no live nodes anywhere, releases the chunks.
+*/
+template <typename T>
+void CompactNodePool<T>::deallocate(T* node)
+{
+    Cache& cache = cache_;
+    if (cache.credits == 0 && cache.generation != generation_.load(std::memory_order_relaxed))
+    {
+        cache.reset();
+    }
+    uint32_t slot = index(node);
+    setFreeWord(slot, 0, cache.freeList);
+    cache.freeList = slot;
+    ++cache.freeCount;
+    ++cache.credits;
+    if (cache.freeCount >= 3 * Batch)
+    {
+        spill(cache, Batch);
+    }
+    if (cache.credits >= 3 * Batch)
+    {
+        live_.fetch_sub(Batch, std::memory_order_release);
+        cache.credits -= Batch;
+    }
+    if (chunkCount_.load(std::memory_order_relaxed) > 2 &&
+        live_.load(std::memory_order_relaxed) == cache.credits)
+    {
+        tryRelease(cache);
+    }
+}
+
+/**
+* The number of chunks the pool holds, for tests and benchmarks.
+*/
+template <typename T>
+std::size_t CompactNodePool<T>::chunkCount()
+{
+    return chunkCount_.load(std::memory_order_relaxed) - 1;
+}
+
+template <typename T>
+uint32_t CompactNodePool<T>::freeWord(uint32_t slot, unsigned word)
+{
+    uint32_t value;
+    std::memcpy(&value, reinterpret_cast<char*>(pointer(slot)) + word * sizeof(uint32_t), sizeof(uint32_t));
+    return value;
+}
+
+template <typename T>
+void CompactNodePool<T>::setFreeWord(uint32_t slot, unsigned word, uint32_t value)
+{
+    std::memcpy(reinterpret_cast<char*>(pointer(slot)) + word * sizeof(uint32_t), &value, sizeof(uint32_t));
+}
+
+/**
+* Gives an empty cache a batch of freed slots from the pool, or else a run
+* of up to Batch fresh slots, opening a new chunk if the last one is used up.
+*/
+template <typename T>
+void CompactNodePool<T>::refill(Cache& cache)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (freeBatches_ != 0)
+    {
+        cache.freeList = freeBatches_;
+        cache.freeCount = freeWord(freeBatches_, 2);
+        freeBatches_ = freeWord(freeBatches_, 1);
+        return;
+    }
+    if (bump_ == bumpEnd_)
+    {
+        std::size_t number = chunkCount_.load(std::memory_order_relaxed);
+        if (number == MaxChunks - 1) //keeps bumpEnd_ within 32 bits
+        {
+            throw std::bad_alloc();
+        }
+        char* raw = static_cast<char*>(::operator new(ChunkBytes, std::align_val_t(ChunkBytes)));
+        reinterpret_cast<ChunkHeader*>(raw)->number = (uint32_t)number;
+        chunks_[number] = reinterpret_cast<T*>(raw + HeaderBytes);
+        bump_ = (uint32_t)number << SlotBits;
+        bumpEnd_ = bump_ + (uint32_t)SlotsPerChunk;
+        chunkCount_.store(number + 1, std::memory_order_relaxed);
+    }
+    uint32_t run = bumpEnd_ - bump_ < Batch ? bumpEnd_ - bump_ : Batch;
+    cache.bump = bump_;
+    cache.bumpEnd = bump_ + run;
+    bump_ += run;
+}
+
+/**
+* Moves the first count slots of the cache's free list to the pool as one
+* batch. The list is walked before the mutex is taken.
+*/
+template <typename T>
+void CompactNodePool<T>::spill(Cache& cache, uint32_t count)
+{
+    uint32_t head = cache.freeList;
+    uint32_t tail = head;
+    for (uint32_t i = 1; i < count; ++i)
+    {
+        tail = freeWord(tail, 0);
+    }
+    cache.freeList = freeWord(tail, 0);
+    cache.freeCount -= count;
+    setFreeWord(tail, 0, 0);
+    setFreeWord(head, 2, count);
+    std::lock_guard<std::mutex> lock(mutex_);
+    setFreeWord(head, 1, freeBatches_);
+    freeBatches_ = head;
+}
+
+/**
+* Gives back the cache's credits and, if no node is live and no other
+* thread holds credits, frees every chunk. live_ is marked while that
+* happens, so that a thread taking credits meanwhile waits on the mutex
+* instead of using a slot that is about to go. Every cache, this one
+* included, is stale afterwards and is emptied on its next use.
+*/
+template <typename T>
+void CompactNodePool<T>::tryRelease(Cache& cache)
+{
+    live_.fetch_sub(cache.credits, std::memory_order_release);
+    cache.credits = 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t none = 0;
+    std::size_t count = chunkCount_.load(std::memory_order_relaxed);
+    if (count <= 2 || !live_.compare_exchange_strong(none, Releasing, std::memory_order_acquire))
+    {
+        return;
+    }
+    for (std::size_t i = 1; i < count; ++i)
+    {
+        ::operator delete(reinterpret_cast<char*>(chunks_[i]) - HeaderBytes, std::align_val_t(ChunkBytes));
+        chunks_[i] = NULL;
+    }
+    chunkCount_.store(1, std::memory_order_relaxed);
+    freeBatches_ = 0;
+    bump_ = 0;
+    bumpEnd_ = 0;
+    generation_.store(generation_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    live_.fetch_sub(Releasing, std::memory_order_release);
+}
+
+template <typename T>
+CompactNodePool<T>::Cache::Cache() :
+    generation(generation_.load(std::memory_order_relaxed)),
+    freeList(0),
+    freeCount(0),
+    bump(0),
+    bumpEnd(0),
+    credits(0)
+{
+
+}
+
+/**
+* When a thread exits, its free slots and unused run go back to the pool as
+* one batch, and its credits are given back.
+*/
+template <typename T>
+CompactNodePool<T>::Cache::~Cache()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_); //no release can start while it is held
+        if (generation == generation_.load(std::memory_order_relaxed))
+        {
+            while (bump != bumpEnd)
+            {
+                setFreeWord(bump, 0, freeList);
+                freeList = bump++;
+                ++freeCount;
+            }
+            if (freeCount != 0)
+            {
+                setFreeWord(freeList, 2, freeCount);
+                setFreeWord(freeList, 1, freeBatches_);
+                freeBatches_ = freeList;
+            }
+        }
+    }
+    reset();
+    tryRelease(*this);
+}
+
+/**
+* Drops the cache's slots, which belong to chunks that have been released.
+*/
+template <typename T>
+void CompactNodePool<T>::Cache::reset()
+{
+    generation = generation_.load(std::memory_order_relaxed);
+    freeList = 0;
+    freeCount = 0;
+    bump = 0;
+    bumpEnd = 0;
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the CompactNodePool class.
+  --------------------------------------------------
+*/
+
+/**
+* A stateless allocator that takes single objects from CompactNodePool. It is
+* what lets CompactAVLNode store its links as indices, so a tree of those
+* nodes must use it (CompactAVLTree does).
+*/
+template <typename T>
+class CompactNodeAllocator
+{
+public:
+    typedef T value_type;
+
+    CompactNodeAllocator();
+    template <typename U>
+    CompactNodeAllocator(const CompactNodeAllocator<U>& other);
+
+    T* allocate(std::size_t n);
+    void deallocate(T* p, std::size_t n);
+
+    bool operator==(const CompactNodeAllocator& rhs) const;
+    bool operator!=(const CompactNodeAllocator& rhs) const;
+};
+
+/*
+  -------------------------------------------------------
+  Begin implementations for the CompactNodeAllocator class.
+  -------------------------------------------------------
+*/
+
+template <typename T>
+CompactNodeAllocator<T>::CompactNodeAllocator()
+{
+
+}
+
+template <typename T>
+template <typename U>
+CompactNodeAllocator<T>::CompactNodeAllocator(const CompactNodeAllocator<U>&)
+{
+
+}
+
+/**
+* Allocates storage for n objects. Arrays bypass the pool.
+*/
+template <typename T>
+T* CompactNodeAllocator<T>::allocate(std::size_t n)
+{
+    if (n == 1)
+    {
+        return CompactNodePool<T>::allocate();
+    }
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+}
+
+/**
+* Frees storage obtained from allocate with the same n.
+*/
+template <typename T>
+void CompactNodeAllocator<T>::deallocate(T* p, std::size_t n)
+{
+    if (n == 1)
+    {
+        CompactNodePool<T>::deallocate(p);
+        return;
+    }
+    ::operator delete(p);
+}
+
+/**
+* All CompactNodeAllocators share the one pool per type, so they are equal.
+*/
+template <typename T>
+bool CompactNodeAllocator<T>::operator==(const CompactNodeAllocator&) const
+{
+    return true;
+}
+
+template <typename T>
+bool CompactNodeAllocator<T>::operator!=(const CompactNodeAllocator&) const
+{
+    return false;
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the CompactNodeAllocator class.
+  -----------------------------------------------------
+*/
+
+/**
+* An AVL node whose parent and child links are 32 bit CompactNodePool
+* indices rather than pointers. The getters and setters still speak in
+* pointers, so AVLTree uses it unchanged as its NodeType. With int keys and
+* values a node is 24 bytes where an AVLNode is 40, and since the pool packs
+* nodes back to back there is no per-allocation malloc header either.
+* Nodes must come from CompactNodeAllocator; use CompactAVLTree.
+*/
+template <typename Key, typename Value>
+class CompactAVLNode
+{
+public:
+    CompactAVLNode(const Key& key, const Value& value, CompactAVLNode<Key, Value>* parent);
+    template<typename KeyArgs, typename ValueArgs>
+    CompactAVLNode(std::piecewise_construct_t, KeyArgs keyArgs, ValueArgs valueArgs, CompactAVLNode<Key, Value>* parent);
+
+    const std::pair<const Key, Value>& getItem() const;
+    std::pair<const Key, Value>& getItem();
+    const Key& getKey() const;
+    const Value& getValue() const;
+    Value& getValue();
+    void setValue(const Value &value);
+
+    CompactAVLNode<Key, Value>* getParent() const;
+    CompactAVLNode<Key, Value>* getLeft() const;
+    CompactAVLNode<Key, Value>* getRight() const;
+    CompactAVLNode<Key, Value>* getChild(bool goLeft) const;
+
+    void setParent(CompactAVLNode<Key, Value>* parent);
+    void setLeft(CompactAVLNode<Key, Value>* left);
+    void setRight(CompactAVLNode<Key, Value>* right);
+
+    int8_t getBalance () const;
+    void setBalance (int8_t balance);
+    void updateBalance(int8_t diff);
+
+protected:
+    typedef CompactNodePool<CompactAVLNode<Key, Value> > Pool;
+
+    std::pair<const Key, Value> item_;
+    uint32_t parent_;
+    uint32_t left_;
+    uint32_t right_;
+    int8_t balance_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the CompactAVLNode class.
+  ---------------------------------------------------
+*/
+
+template<class Key, class Value>
+CompactAVLNode<Key, Value>::CompactAVLNode(const Key& key, const Value& value, CompactAVLNode<Key, Value>* parent) :
+    item_(key, value),
+    parent_(Pool::index(parent)),
+    left_(0),
+    right_(0),
+    balance_(0)
+{
+
+}
+
+/**
+* Piecewise constructor, see Node.
+*/
+template<class Key, class Value>
+template<typename KeyArgs, typename ValueArgs>
+CompactAVLNode<Key, Value>::CompactAVLNode(std::piecewise_construct_t, KeyArgs keyArgs, ValueArgs valueArgs, CompactAVLNode<Key, Value>* parent) :
+    item_(std::piecewise_construct, std::move(keyArgs), std::move(valueArgs)),
+    parent_(Pool::index(parent)),
+    left_(0),
+    right_(0),
+    balance_(0)
+{
+
+}
+
+template<class Key, class Value>
+const std::pair<const Key, Value>& CompactAVLNode<Key, Value>::getItem() const
+{
+    return item_;
+}
+
+template<class Key, class Value>
+std::pair<const Key, Value>& CompactAVLNode<Key, Value>::getItem()
+{
+    return item_;
+}
+
+template<class Key, class Value>
+const Key& CompactAVLNode<Key, Value>::getKey() const
+{
+    return item_.first;
+}
+
+template<class Key, class Value>
+const Value& CompactAVLNode<Key, Value>::getValue() const
+{
+    return item_.second;
+}
+
+template<class Key, class Value>
+Value& CompactAVLNode<Key, Value>::getValue()
+{
+    return item_.second;
+}
+
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::setValue(const Value& value)
+{
+    item_.second = value;
+}
+
+/**
+* The link getters turn an index back into a pointer with one table load.
+*/
+template<class Key, class Value>
+CompactAVLNode<Key, Value>* CompactAVLNode<Key, Value>::getParent() const
+{
+    return Pool::pointer(parent_);
+}
+
+template<class Key, class Value>
+CompactAVLNode<Key, Value>* CompactAVLNode<Key, Value>::getLeft() const
+{
+    return Pool::pointer(left_);
+}
+
+template<class Key, class Value>
+CompactAVLNode<Key, Value>* CompactAVLNode<Key, Value>::getRight() const
+{
+    return Pool::pointer(right_);
+}
+
+/**
+* Picks the left or right index before decoding it, see childOf.
+*/
+template<class Key, class Value>
+CompactAVLNode<Key, Value>* CompactAVLNode<Key, Value>::getChild(bool goLeft) const
+{
+    return Pool::pointer(goLeft ? left_ : right_);
+}
+
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::setParent(CompactAVLNode<Key, Value>* parent)
+{
+    parent_ = Pool::index(parent);
+}
+
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::setLeft(CompactAVLNode<Key, Value>* left)
+{
+    left_ = Pool::index(left);
+}
+
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::setRight(CompactAVLNode<Key, Value>* right)
+{
+    right_ = Pool::index(right);
+}
+
+template<class Key, class Value>
+int8_t CompactAVLNode<Key, Value>::getBalance() const
+{
+    return balance_;
+}
+
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::setBalance(int8_t balance)
+{
+    balance_ = balance;
+}
+
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::updateBalance(int8_t diff)
+{
+    balance_ += diff;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the CompactAVLNode class.
+  -------------------------------------------------
+*/
+
+/**
+* The tree's descents find this through argument dependent lookup.
+*/
+template <typename Key, typename Value>
+CompactAVLNode<Key, Value>* childOf(CompactAVLNode<Key, Value>* node, bool goLeft)
+{
+    return node->getChild(goLeft);
+}
+
+/**
+* An AVLTree of CompactAVLNodes, which link by 32 bit index. All the trees
+* of one Key/Value type share a pool of a little under 2^32 nodes; see
+* CompactNodePool for what that sharing means.
+*/
+template <class Key, class Value,
+          class Compare = std::less<Key> >
+using CompactAVLTree = AVLTree<Key, Value, Compare,
+                               CompactNodeAllocator<std::pair<const Key, Value> >,
+                               CompactAVLNode<Key, Value> >;
+
+#endif
@@ -0,0 +1,303 @@
+#ifndef CONCURRENT_AVLBST_H
+#define CONCURRENT_AVLBST_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include "avlbst.h"
+
+/**
+* A map that many threads may read and write at once. Keys are spread over
+* a fixed number of shards by hash, and each shard is an ordinary AVLTree
+* behind its own reader/writer lock. Lookups take the lock shared, so they
+* never wait for each other, only for a writer working on the same shard;
+* writers only contend with operations on their own shard. Each shard sits
+* on its own cache line so that locking one never invalidates another.
+*
+* Because the tree cannot hand out iterators that stay valid while other
+* threads write, lookups copy the value out and whole-map walks (for_each)
+* go shard by shard: they see every key that stays put during the walk, but
+* are not a snapshot of one instant. Within a shard keys are visited in
+* Compare order; across shards there is no order.
+*
+* Shards allocate under their own locks only, so they must not share
+* allocator state. The constructor that takes alloc copies it to every
+* shard, and so only accepts a stateless allocator (one whose
+* is_always_equal holds). For any other kind, such as SlabAllocator, use
+* the constructor that takes makeAlloc: it is called once per shard with
+* the shard's index, and must return allocators that share no state no
+* lock covers, for instance each with its own arena.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key>,
+          typename Hash = std::hash<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value> > >
+class ConcurrentAVLTree
+{
+public:
+    explicit ConcurrentAVLTree(std::size_t shards = 64, const Compare& comp = Compare(),
+                               const Hash& hash = Hash(), const Alloc& alloc = Alloc());
+    ConcurrentAVLTree(std::size_t shards, const std::function<Alloc(std::size_t)>& makeAlloc,
+                      const Compare& comp = Compare(), const Hash& hash = Hash());
+
+    bool insert(const std::pair<const Key, Value>& keyValuePair);
+    bool remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    std::size_t size() const;
+    void clear();
+    template<typename Func>
+    void for_each(Func func) const;
+    TreeShape validate() const;
+
+private:
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+
+    struct alignas(64) Shard
+    {
+        Shard(const Compare& comp, const Alloc& alloc) : tree(comp, alloc), count(0) { }
+
+        mutable std::shared_mutex mutex;
+        AVLTree<Key, Value, Compare, Alloc> tree;
+        std::size_t count;
+    };
+
+    Shard& shardFor(const Key& key) const;
+    void makeShards(std::size_t shards, const Compare& comp,
+                    const std::function<Alloc(std::size_t)>& makeAlloc);
+
+    std::size_t mask_;
+    Hash hash_;
+    std::unique_ptr<std::unique_ptr<Shard>[]> shards_;
+};
+
+/*
+------------------------------------------------------
+Begin implementations for the ConcurrentAVLTree class.
+------------------------------------------------------
+*/
+
+/**
+* Creates an empty map with the given number of shards, rounded up to a
+* power of two. More shards than threads keeps writers apart. Every shard
+* gets a copy of alloc, which must therefore be stateless.
+*/
+template<class Key, class Value, class Compare, class Hash, class Alloc>
+ConcurrentAVLTree<Key, Value, Compare, Hash, Alloc>::ConcurrentAVLTree(std::size_t shards, const Compare& comp,
+                                                                      const Hash& hash, const Alloc& alloc) :
+    mask_(0),
+    hash_(hash)
+{
+    static_assert(std::allocator_traits<Alloc>::is_always_equal::value,
+                  "shards would share this allocator's state; pass makeAlloc to give each its own");
+    makeShards(shards, comp, [&alloc](std::size_t) { return alloc; });
+}
+
+/**
+* Creates an empty map with the given number of shards, rounded up to a
+* power of two, whose shard i allocates with makeAlloc(i).
+*/
+template<class Key, class Value, class Compare, class Hash, class Alloc>
+ConcurrentAVLTree<Key, Value, Compare, Hash, Alloc>::ConcurrentAVLTree(std::size_t shards,
+                                                                      const std::function<Alloc(std::size_t)>& makeAlloc,
+                                                                      const Compare& comp, const Hash& hash) :
+    mask_(0),
+    hash_(hash)
+{
+    makeShards(shards, comp, makeAlloc);
+}
+
+template<class Key, class Value, class Compare, class Hash, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Hash, Alloc>::makeShards(std::size_t shards, const Compare& comp,
+                                                                    const std::function<Alloc(std::size_t)>& makeAlloc)
+{
+    std::size_t count = 1;
+    while (count < shards)
+    {
+        count *= 2;
+    }
+    mask_ = count - 1;
+    shards_.reset(new std::unique_ptr<Shard>[count]);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        shards_[i].reset(new Shard(comp, makeAlloc(i)));
+    }
+}
+
+/**
+* Picks the shard that owns key. The hash is mixed first: std::hash is the
+* identity for integers, so otherwise only the key's low bits would choose
+* the shard.
+*/
+template<class Key, class Value, class Compare, class Hash, class Alloc>
+typename ConcurrentAVLTree<Key, Value, Compare, Hash, Alloc>::Shard&
+ConcurrentAVLTree<Key, Value, Compare, Hash, Alloc>::shardFor(const Key& key) const
+{
+    std::size_t h = hash_(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return *shards_[h & mask_];
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present.
+* Returns true if the key was new.
+*/
+template<class Key, class Value, class Compare, class Hash, class Alloc>
+bool ConcurrentAVLTree<Key, Value, Compare, Hash, Alloc>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Shard& shard = shardFor(keyValuePair.first);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    bool inserted = shard.tree.insert_or_assign(keyValuePair.first, keyValuePair.second).second;
+    if (inserted)
+    {
+        ++shard.count;
+    }
+    return inserted;
+}
+
+/**
+* Removes key if present. Returns true if it was.
+*/
+template<class Key, class Value, class Compare, class Hash, class Alloc>
+bool ConcurrentAVLTree<Key, Value, Compare, Hash, Alloc>::remove(const Key& key)
+{
+    Shard& shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    if (!shard.tree.remove(key))
+    {
+        return false;
+    }
+    --shard.count;
+    return true;
+}
+
+/**
+* Copies the value stored under key into value and returns true, or returns
+* false and leaves value alone if key is not present.
+*/
+template<class Key, class Value, class Compare, class Hash, class Alloc>
+bool ConcurrentAVLTree<Key, Value, Compare, Hash, Alloc>::find(const Key& key, Value& value) const
+{
+    Shard& shard = shardFor(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    typename AVLTree<Key, Value, Compare, Alloc>::iterator it = shard.tree.find(key);
+    if (it == shard.tree.end())
+    {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+/**
+* Returns true if key is present.
+*/
+template<class Key, class Value, class Compare, class Hash, class Alloc>
+bool ConcurrentAVLTree<Key, Value, Compare, Hash, Alloc>::contains(const Key& key) const
+{
+    Shard& shard = shardFor(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.tree.find(key) != shard.tree.end();
+}
+
+/**
+* Returns the number of keys. With writers running the result is only a
+* recent value, as the shards are counted one after the other.
+*/
+template<class Key, class Value, class Compare, class Hash, class Alloc>
+std::size_t ConcurrentAVLTree<Key, Value, Compare, Hash, Alloc>::size() const
+{
+    std::size_t total = 0;
+    for (std::size_t i = 0; i <= mask_; ++i)
+    {
+        std::shared_lock<std::shared_mutex> lock(shards_[i]->mutex);
+        total += shards_[i]->count;
+    }
+    return total;
+}
+
+/**
+* Removes every key, one shard at a time.
+*/
+template<class Key, class Value, class Compare, class Hash, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Hash, Alloc>::clear()
+{
+    for (std::size_t i = 0; i <= mask_; ++i)
+    {
+        std::unique_lock<std::shared_mutex> lock(shards_[i]->mutex);
+        shards_[i]->tree.clear();
+        shards_[i]->count = 0;
+    }
+}
+
+/**
+* Calls func(key, value) for every key, holding each shard's lock shared
+* while its keys are visited. func must not write to this map.
+*/
+template<class Key, class Value, class Compare, class Hash, class Alloc>
+template<typename Func>
+void ConcurrentAVLTree<Key, Value, Compare, Hash, Alloc>::for_each(Func func) const
+{
+    for (std::size_t i = 0; i <= mask_; ++i)
+    {
+        std::shared_lock<std::shared_mutex> lock(shards_[i]->mutex);
+        for (typename AVLTree<Key, Value, Compare, Alloc>::const_iterator it = shards_[i]->tree.cbegin();
+             it != shards_[i]->tree.cend(); ++it)
+        {
+            func(it->first, it->second);
+        }
+    }
+}
+
+/**
+* Validates every shard (see BinarySearchTree::validate), holding each one's
+* lock shared while it is walked, so it can run in a background thread
+* while others read and write. Also checks each shard's key count. The
+* result combines the shards: height is the tallest shard's and
+* averageDepth is over all keys.
+*/
+template<class Key, class Value, class Compare, class Hash, class Alloc>
+TreeShape ConcurrentAVLTree<Key, Value, Compare, Hash, Alloc>::validate() const
+{
+    TreeShape total = TreeShape();
+    total.valid = true;
+    total.balanced = true;
+    double depthSum = 0.0;
+    for (std::size_t i = 0; i <= mask_; ++i)
+    {
+        std::shared_lock<std::shared_mutex> lock(shards_[i]->mutex);
+        TreeShape shape = shards_[i]->tree.validate();
+        if (total.valid && shape.valid && shape.nodes != shards_[i]->count)
+        {
+            shape.valid = false;
+            shape.problem = "shard count does not match its tree";
+        }
+        if (total.valid && !shape.valid)
+        {
+            total.valid = false;
+            total.problem = shape.problem;
+        }
+        total.balanced = total.balanced && shape.balanced;
+        total.nodes += shape.nodes;
+        total.height = std::max(total.height, shape.height);
+        depthSum += shape.averageDepth * shape.nodes;
+    }
+    if (total.nodes > 0)
+    {
+        total.averageDepth = depthSum / total.nodes;
+    }
+    return total;
+}
+
+/*
+----------------------------------------------------
+End implementations for the ConcurrentAVLTree class.
+----------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,497 @@
+#ifndef FROZEN_AVLBST_H
+#define FROZEN_AVLBST_H
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+* A read-only copy of a sorted map laid out for search rather than update,
+* made by AVLTree::freeze(). The keys are stored in one contiguous array in
+* Eytzinger order, the breadth-first order of a complete binary search
+* tree: the children of position k are 2k and 2k+1 (positions count from
+* 1), so the tree needs no pointers at all. The top levels of every search
+* share the first few cache lines, and the descent is a plain index
+* computation with no branch on the comparison, so the position of the
+* next key, and of the ones a few levels further down, is known before the
+* current comparison finishes and can be prefetched. Values live in a
+* separate array in the same order, so searching never pulls them into
+* cache.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class FrozenAVLTree
+{
+public:
+    /**
+    * An iterator in key order. It is a position in the arrays; stepping to
+    * the next key walks the implicit tree with shifts. It can also step
+    * back, but since keys and values live apart, dereferencing yields a
+    * pair of references rather than a reference to a stored pair, so it
+    * only claims to be an input iterator.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef std::pair<Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef void pointer;
+        typedef std::pair<const Key&, const Value&> reference;
+
+        const_iterator();
+
+        std::pair<const Key&, const Value&> operator*() const;
+        const Key& key() const;
+        const Value& value() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class FrozenAVLTree;
+        const_iterator(const FrozenAVLTree* tree, std::size_t pos);
+        const FrozenAVLTree* tree_;
+        std::size_t pos_; //1 based Eytzinger position, 0 for end()
+    };
+
+    FrozenAVLTree();
+    template<typename ForwardIt>
+    FrozenAVLTree(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
+
+    const_iterator find(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    const_iterator upper_bound(const Key& key) const;
+    bool contains(const Key& key) const;
+    const Value& operator[](const Key& key) const;
+    const_iterator begin() const;
+    const_iterator end() const;
+    std::size_t size() const;
+    bool empty() const;
+
+protected:
+    std::size_t lowerBoundPos(const Key& key) const;
+    std::size_t upperBoundPos(const Key& key) const;
+    void prefetch(std::size_t pos) const;
+    static std::size_t firstPos(std::size_t count);
+    static std::size_t lastPos(std::size_t count);
+    static std::size_t nextPos(std::size_t pos, std::size_t count);
+    static std::size_t prevPos(std::size_t pos, std::size_t count);
+    static std::size_t dropTrailingOnes(std::size_t pos);
+    static std::size_t dropTrailingZeros(std::size_t pos);
+
+    // Position k (from 1) is stored at index k - 1.
+    std::vector<Key> keys_;
+    std::vector<Value> values_;
+    Compare comp_;
+};
+
+/*
+------------------------------------------------------------------
+Begin implementations for the FrozenAVLTree::const_iterator class.
+------------------------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class Compare>
+FrozenAVLTree<Key, Value, Compare>::const_iterator::const_iterator() :
+    tree_(NULL),
+    pos_(0)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+FrozenAVLTree<Key, Value, Compare>::const_iterator::const_iterator(const FrozenAVLTree* tree, std::size_t pos) :
+    tree_(tree),
+    pos_(pos)
+{
+
+}
+
+/**
+* Provides access to the key and value. They sit in separate arrays, so the
+* item is a pair of references rather than a stored pair.
+*/
+template<class Key, class Value, class Compare>
+std::pair<const Key&, const Value&>
+FrozenAVLTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return std::pair<const Key&, const Value&>(key(), value());
+}
+
+template<class Key, class Value, class Compare>
+const Key& FrozenAVLTree<Key, Value, Compare>::const_iterator::key() const
+{
+    return tree_->keys_[pos_ - 1];
+}
+
+template<class Key, class Value, class Compare>
+const Value& FrozenAVLTree<Key, Value, Compare>::const_iterator::value() const
+{
+    return tree_->values_[pos_ - 1];
+}
+
+template<class Key, class Value, class Compare>
+bool FrozenAVLTree<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return pos_ == rhs.pos_;
+}
+
+template<class Key, class Value, class Compare>
+bool FrozenAVLTree<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return pos_ != rhs.pos_;
+}
+
+/**
+* Advances to the next key in order.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenAVLTree<Key, Value, Compare>::const_iterator&
+FrozenAVLTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    pos_ = nextPos(pos_, tree_->keys_.size());
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenAVLTree<Key, Value, Compare>::const_iterator
+FrozenAVLTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator before = *this;
+    ++(*this);
+    return before;
+}
+
+/**
+* Moves back to the previous key in order. Decrementing end() lands on the
+* largest key.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenAVLTree<Key, Value, Compare>::const_iterator&
+FrozenAVLTree<Key, Value, Compare>::const_iterator::operator--()
+{
+    std::size_t count = tree_->keys_.size();
+    pos_ = pos_ == 0 ? lastPos(count) : prevPos(pos_, count);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenAVLTree<Key, Value, Compare>::const_iterator
+FrozenAVLTree<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator before = *this;
+    --(*this);
+    return before;
+}
+
+/*
+----------------------------------------------------------------
+End implementations for the FrozenAVLTree::const_iterator class.
+----------------------------------------------------------------
+*/
+
+/*
+--------------------------------------------------
+Begin implementations for the FrozenAVLTree class.
+--------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+FrozenAVLTree<Key, Value, Compare>::FrozenAVLTree() :
+    comp_()
+{
+
+}
+
+/**
+* Copies the items of [first, last), which must be sorted by key with no
+* repeats (as an AVLTree's are), into Eytzinger order. An in-order walk of
+* the implicit tree first records which rank belongs at each position, so
+* keys and values can then each be written once, front to back.
+*/
+template<class Key, class Value, class Compare>
+template<typename ForwardIt>
+FrozenAVLTree<Key, Value, Compare>::FrozenAVLTree(ForwardIt first, ForwardIt last, const Compare& comp) :
+    comp_(comp)
+{
+    std::vector<ForwardIt> sorted;
+    for (; first != last; ++first)
+    {
+        sorted.push_back(first);
+    }
+    std::size_t count = sorted.size();
+    std::vector<std::size_t> rank(count);
+    std::size_t pos = firstPos(count);
+    for (std::size_t r = 0; r < count; ++r)
+    {
+        rank[pos - 1] = r;
+        pos = nextPos(pos, count);
+    }
+    keys_.reserve(count);
+    values_.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        keys_.push_back(sorted[rank[i]]->first);
+        values_.push_back(sorted[rank[i]]->second);
+    }
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<class Key, class Value, class Compare>
+typename FrozenAVLTree<Key, Value, Compare>::const_iterator
+FrozenAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    std::size_t pos = lowerBoundPos(key);
+    if (pos != 0 && comp_(key, keys_[pos - 1]))
+    {
+        pos = 0;
+    }
+    return const_iterator(this, pos);
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenAVLTree<Key, Value, Compare>::const_iterator
+FrozenAVLTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return const_iterator(this, lowerBoundPos(key));
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenAVLTree<Key, Value, Compare>::const_iterator
+FrozenAVLTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return const_iterator(this, upperBoundPos(key));
+}
+
+template<class Key, class Value, class Compare>
+bool FrozenAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    return find(key) != end();
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare>
+const Value& FrozenAVLTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    const_iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it.value();
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenAVLTree<Key, Value, Compare>::const_iterator
+FrozenAVLTree<Key, Value, Compare>::begin() const
+{
+    return const_iterator(this, firstPos(keys_.size()));
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenAVLTree<Key, Value, Compare>::const_iterator
+FrozenAVLTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(this, 0);
+}
+
+template<class Key, class Value, class Compare>
+std::size_t FrozenAVLTree<Key, Value, Compare>::size() const
+{
+    return keys_.size();
+}
+
+template<class Key, class Value, class Compare>
+bool FrozenAVLTree<Key, Value, Compare>::empty() const
+{
+    return keys_.empty();
+}
+
+/**
+* The branch-free descent: at each level go to 2k, or to 2k+1 when the key
+* at k is less than key, which compiles to an add of the comparison result
+* rather than a jump. Past the bottom, the position of the lower bound is
+* the last node the walk went left from, found by dropping the trailing
+* right turns (one bits) and the final left turn. 0 means every key is
+* less than key.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenAVLTree<Key, Value, Compare>::lowerBoundPos(const Key& key) const
+{
+    std::size_t count = keys_.size();
+    std::size_t pos = 1;
+    while (pos <= count)
+    {
+        prefetch(pos);
+        pos = 2 * pos + (std::size_t)comp_(keys_[pos - 1], key);
+    }
+    return dropTrailingOnes(pos);
+}
+
+/**
+* As lowerBoundPos, going right whenever the key at k is not greater.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenAVLTree<Key, Value, Compare>::upperBoundPos(const Key& key) const
+{
+    std::size_t count = keys_.size();
+    std::size_t pos = 1;
+    while (pos <= count)
+    {
+        prefetch(pos);
+        pos = 2 * pos + (std::size_t)!comp_(key, keys_[pos - 1]);
+    }
+    return dropTrailingOnes(pos);
+}
+
+/**
+* Asks for the keys four levels below pos. Their 16 positions are
+* contiguous, so for small keys this is one cache line that will be
+* needed four iterations from now, whichever way the walk goes.
+*/
+template<class Key, class Value, class Compare>
+void FrozenAVLTree<Key, Value, Compare>::prefetch(std::size_t pos) const
+{
+#if defined(__GNUC__)
+    std::size_t ahead = 16 * pos;
+    if (ahead <= keys_.size())
+    {
+        __builtin_prefetch(&keys_[ahead - 1]);
+    }
+#else
+    (void)pos;
+#endif
+}
+
+/**
+* The smallest key is at the end of the chain of left children from the root.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenAVLTree<Key, Value, Compare>::firstPos(std::size_t count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    std::size_t pos = 1;
+    while (2 * pos <= count)
+    {
+        pos = 2 * pos;
+    }
+    return pos;
+}
+
+/**
+* The largest key is at the end of the chain of right children from the root.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenAVLTree<Key, Value, Compare>::lastPos(std::size_t count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    std::size_t pos = 1;
+    while (2 * pos + 1 <= count)
+    {
+        pos = 2 * pos + 1;
+    }
+    return pos;
+}
+
+/**
+* The in-order successor of pos: the leftmost position of the right subtree
+* if there is one, else the nearest ancestor pos is in the left subtree of,
+* which is pos with its trailing right turns and one left turn removed.
+* Returns 0 after the largest key.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenAVLTree<Key, Value, Compare>::nextPos(std::size_t pos, std::size_t count)
+{
+    if (2 * pos + 1 <= count)
+    {
+        pos = 2 * pos + 1;
+        while (2 * pos <= count)
+        {
+            pos = 2 * pos;
+        }
+        return pos;
+    }
+    return dropTrailingOnes(pos);
+}
+
+/**
+* The in-order predecessor of pos, the mirror image of nextPos. Returns 0
+* before the smallest key.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenAVLTree<Key, Value, Compare>::prevPos(std::size_t pos, std::size_t count)
+{
+    if (2 * pos <= count)
+    {
+        pos = 2 * pos;
+        while (2 * pos + 1 <= count)
+        {
+            pos = 2 * pos + 1;
+        }
+        return pos;
+    }
+    return dropTrailingZeros(pos);
+}
+
+/**
+* Climbs out of a run of right children and then once more, to the first
+* ancestor reached from its left.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenAVLTree<Key, Value, Compare>::dropTrailingOnes(std::size_t pos)
+{
+#if defined(__GNUC__)
+    return pos >> (__builtin_ctzll(~(unsigned long long)pos) + 1);
+#else
+    while (pos & 1)
+    {
+        pos >>= 1;
+    }
+    return pos >> 1;
+#endif
+}
+
+/**
+* Climbs out of a run of left children and then once more, to the first
+* ancestor reached from its right.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenAVLTree<Key, Value, Compare>::dropTrailingZeros(std::size_t pos)
+{
+#if defined(__GNUC__)
+    return pos >> (__builtin_ctzll((unsigned long long)pos) + 1);
+#else
+    while ((pos & 1) == 0)
+    {
+        pos >>= 1;
+    }
+    return pos >> 1;
+#endif
+}
+
+/*
+------------------------------------------------
+End implementations for the FrozenAVLTree class.
+------------------------------------------------
+*/
+
+#endif
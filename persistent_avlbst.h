@@ -0,0 +1,762 @@
+#ifndef PERSISTENT_AVLBST_H
+#define PERSISTENT_AVLBST_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+* A node of a PersistentAVLTree. Nodes are immutable once linked in and may
+* be shared by any number of tree versions, so unlike AVLNode there is no
+* parent pointer; instead each node counts the versions and parent nodes
+* that refer to it and is freed when the last of them lets go. The height
+* is stored rather than the balance since new nodes are always built from
+* two finished subtrees.
+*/
+template<typename Key, typename Value>
+class PersistentAVLNode
+{
+public:
+    template<typename Item>
+    PersistentAVLNode(Item&& item, const PersistentAVLNode* left, const PersistentAVLNode* right);
+
+    const std::pair<const Key, Value>& getItem() const { return item_; }
+    const Key& getKey() const { return item_.first; }
+    const PersistentAVLNode* getLeft() const { return left_; }
+    const PersistentAVLNode* getRight() const { return right_; }
+    int getHeight() const { return height_; }
+
+    static int height(const PersistentAVLNode* node) { return node == NULL ? 0 : node->height_; }
+
+protected:
+    template<typename K, typename V, typename C, typename A>
+    friend class PersistentAVLTree;
+
+    std::pair<const Key, Value> item_;
+    const PersistentAVLNode* left_;
+    const PersistentAVLNode* right_;
+    mutable std::atomic<uint32_t> refs_;
+    int8_t height_;
+};
+
+/**
+* Creates a node over two subtrees it does not take a reference to yet,
+* with a reference count of one held by the caller.
+*/
+template<typename Key, typename Value>
+template<typename Item>
+PersistentAVLNode<Key, Value>::PersistentAVLNode(Item&& item, const PersistentAVLNode* left,
+                                                 const PersistentAVLNode* right) :
+    item_(std::forward<Item>(item)),
+    left_(left),
+    right_(right),
+    refs_(1),
+    height_((int8_t)(1 + std::max(height(left), height(right))))
+{
+
+}
+
+/**
+* An AVL tree whose versions share structure. Copying a tree is O(1) and
+* gives an independent version: insert and remove on one copy build new
+* nodes only along the root-to-leaf path they change (O(log n) of them) and
+* point the rest at the nodes the versions share, so no other copy sees the
+* change. Nodes never change once built, which means a version handed to
+* another thread can be read and iterated there without any locking while
+* this one keeps being written; the reference counts are atomic, so the
+* last version to drop a node frees it, on whichever thread that happens.
+* The allocator must be safe to use from every thread that drops a version.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value> > >
+class PersistentAVLTree
+{
+public:
+    typedef PersistentAVLNode<Key, Value> Node;
+
+    /**
+    * A forward iterator over one version in key order. It keeps the path of
+    * nodes still to be visited, as there are no parent pointers to climb.
+    * It stays valid as long as the version (or a copy of it) lives.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        const_iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+
+    protected:
+        friend class PersistentAVLTree;
+        void pushLeftSpine(const Node* node);
+        std::vector<const Node*> path_;
+    };
+    typedef const_iterator iterator;
+
+    PersistentAVLTree();
+    explicit PersistentAVLTree(const Compare& comp, const Alloc& alloc = Alloc());
+    PersistentAVLTree(const PersistentAVLTree& other);
+    PersistentAVLTree(PersistentAVLTree&& other);
+    PersistentAVLTree& operator=(const PersistentAVLTree& other);
+    PersistentAVLTree& operator=(PersistentAVLTree&& other);
+    ~PersistentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    PersistentAVLTree snapshot() const;
+
+    const_iterator find(const Key& key) const;
+    bool contains(const Key& key) const;
+    const_iterator begin() const;
+    const_iterator end() const;
+    std::size_t size() const;
+    bool empty() const;
+
+protected:
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<Node> NodeAllocator;
+    typedef std::allocator_traits<NodeAllocator> NodeAllocatorTraits;
+
+    // Every helper returns a node the caller owns one reference to, and
+    // only borrows the nodes passed in.
+    template<typename Item>
+    const Node* makeNode(Item&& item, const Node* left, const Node* right);
+    const Node* balanceNode(const std::pair<const Key, Value>& item, const Node* left, const Node* right);
+    const Node* insertHelper(const Node* node, const std::pair<const Key, Value>& keyValuePair, bool& inserted);
+    const Node* removeHelper(const Node* node, const Key& key, bool& removed);
+    const Node* removeSmallest(const Node* node);
+    static const Node* retain(const Node* node);
+    void release(const Node* node);
+
+    // Lookups starting from a given root, shared with RcuAVLTree, which
+    // reads versions it only holds the root of.
+    const Node* findNode(const Node* root, const Key& key) const;
+    const_iterator findFrom(const Node* root, const Key& key) const;
+    static const_iterator beginFrom(const Node* root);
+
+    template<typename K, typename V, typename C, typename A>
+    friend class RcuAVLTree;
+
+    const Node* root_;
+    std::size_t size_;
+    Compare comp_;
+    NodeAllocator alloc_;
+};
+
+/*
+----------------------------------------------------------------------
+Begin implementations for the PersistentAVLTree::const_iterator class.
+----------------------------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to end().
+*/
+template<class Key, class Value, class Compare, class Alloc>
+PersistentAVLTree<Key, Value, Compare, Alloc>::const_iterator::const_iterator()
+{
+
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+const std::pair<const Key, Value>&
+PersistentAVLTree<Key, Value, Compare, Alloc>::const_iterator::operator*() const
+{
+    return path_.back()->getItem();
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+const std::pair<const Key, Value>*
+PersistentAVLTree<Key, Value, Compare, Alloc>::const_iterator::operator->() const
+{
+    return &(path_.back()->getItem());
+}
+
+/**
+* Two iterators are equal when they stand on the same node, or are both end().
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool PersistentAVLTree<Key, Value, Compare, Alloc>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    if (path_.empty() || rhs.path_.empty())
+    {
+        return path_.empty() == rhs.path_.empty();
+    }
+    return path_.back() == rhs.path_.back();
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+bool PersistentAVLTree<Key, Value, Compare, Alloc>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances to the next key: the smallest node of the right subtree if there
+* is one, otherwise the nearest ancestor still waiting on the path.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename PersistentAVLTree<Key, Value, Compare, Alloc>::const_iterator&
+PersistentAVLTree<Key, Value, Compare, Alloc>::const_iterator::operator++()
+{
+    const Node* current = path_.back();
+    path_.pop_back();
+    pushLeftSpine(current->getRight());
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename PersistentAVLTree<Key, Value, Compare, Alloc>::const_iterator
+PersistentAVLTree<Key, Value, Compare, Alloc>::const_iterator::operator++(int)
+{
+    const_iterator before = *this;
+    ++(*this);
+    return before;
+}
+
+/**
+* Pushes node and its chain of left children, leaving the smallest on top.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void PersistentAVLTree<Key, Value, Compare, Alloc>::const_iterator::pushLeftSpine(const Node* node)
+{
+    for (; node != NULL; node = node->getLeft())
+    {
+        path_.push_back(node);
+    }
+}
+
+/*
+--------------------------------------------------------------------
+End implementations for the PersistentAVLTree::const_iterator class.
+--------------------------------------------------------------------
+*/
+
+/*
+------------------------------------------------------
+Begin implementations for the PersistentAVLTree class.
+------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare, class Alloc>
+PersistentAVLTree<Key, Value, Compare, Alloc>::PersistentAVLTree() :
+    root_(NULL),
+    size_(0),
+    comp_(),
+    alloc_()
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+PersistentAVLTree<Key, Value, Compare, Alloc>::PersistentAVLTree(const Compare& comp, const Alloc& alloc) :
+    root_(NULL),
+    size_(0),
+    comp_(comp),
+    alloc_(alloc)
+{
+
+}
+
+/**
+* Copies are O(1): the new version shares every node with other.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+PersistentAVLTree<Key, Value, Compare, Alloc>::PersistentAVLTree(const PersistentAVLTree& other) :
+    root_(retain(other.root_)),
+    size_(other.size_),
+    comp_(other.comp_),
+    alloc_(other.alloc_)
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+PersistentAVLTree<Key, Value, Compare, Alloc>::PersistentAVLTree(PersistentAVLTree&& other) :
+    root_(other.root_),
+    size_(other.size_),
+    comp_(other.comp_),
+    alloc_(other.alloc_)
+{
+    other.root_ = NULL;
+    other.size_ = 0;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+PersistentAVLTree<Key, Value, Compare, Alloc>&
+PersistentAVLTree<Key, Value, Compare, Alloc>::operator=(const PersistentAVLTree& other)
+{
+    const Node* old = root_;
+    root_ = retain(other.root_); //retain first, other may share old's nodes
+    size_ = other.size_;
+    comp_ = other.comp_;
+    release(old);
+    alloc_ = other.alloc_;
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+PersistentAVLTree<Key, Value, Compare, Alloc>&
+PersistentAVLTree<Key, Value, Compare, Alloc>::operator=(PersistentAVLTree&& other)
+{
+    if (this != &other)
+    {
+        release(root_);
+        root_ = other.root_;
+        size_ = other.size_;
+        comp_ = other.comp_;
+        alloc_ = other.alloc_;
+        other.root_ = NULL;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+/**
+* Drops this version. Nodes shared with other versions stay alive.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+PersistentAVLTree<Key, Value, Compare, Alloc>::~PersistentAVLTree()
+{
+    release(root_);
+}
+
+/**
+* Inserts the pair into this version, overwriting the value if the key is
+* already present. Other versions are not affected.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void PersistentAVLTree<Key, Value, Compare, Alloc>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    bool inserted = false;
+    const Node* newRoot = insertHelper(root_, keyValuePair, inserted);
+    release(root_);
+    root_ = newRoot;
+    size_ += inserted ? 1 : 0;
+}
+
+/**
+* Removes key from this version if present. Other versions are not affected.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void PersistentAVLTree<Key, Value, Compare, Alloc>::remove(const Key& key)
+{
+    bool removed = false;
+    const Node* newRoot = removeHelper(root_, key, removed);
+    release(root_);
+    root_ = newRoot;
+    size_ -= removed ? 1 : 0;
+}
+
+/**
+* Empties this version.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void PersistentAVLTree<Key, Value, Compare, Alloc>::clear()
+{
+    release(root_);
+    root_ = NULL;
+    size_ = 0;
+}
+
+/**
+* Returns an immutable point-in-time copy of this version in O(1). Later
+* writes to this tree do not show up in it.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+PersistentAVLTree<Key, Value, Compare, Alloc> PersistentAVLTree<Key, Value, Compare, Alloc>::snapshot() const
+{
+    return PersistentAVLTree(*this);
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename PersistentAVLTree<Key, Value, Compare, Alloc>::const_iterator
+PersistentAVLTree<Key, Value, Compare, Alloc>::find(const Key& key) const
+{
+    return findFrom(root_, key);
+}
+
+/**
+* find within the version rooted at root. The path walked on the way down
+* is exactly the iterator's path of pending ancestors, so iteration can
+* carry on from the result.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename PersistentAVLTree<Key, Value, Compare, Alloc>::const_iterator
+PersistentAVLTree<Key, Value, Compare, Alloc>::findFrom(const Node* root, const Key& key) const
+{
+    const_iterator it;
+    const Node* node = root;
+    while (node != NULL)
+    {
+        if (comp_(key, node->getKey()))
+        {
+            it.path_.push_back(node); //visited again after the left subtree
+            node = node->getLeft();
+        }
+        else if (comp_(node->getKey(), key))
+        {
+            node = node->getRight();
+        }
+        else
+        {
+            it.path_.push_back(node);
+            return it;
+        }
+    }
+    return end();
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+bool PersistentAVLTree<Key, Value, Compare, Alloc>::contains(const Key& key) const
+{
+    return findNode(root_, key) != NULL;
+}
+
+/**
+* Returns the node holding key in the version rooted at root, or NULL.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+const typename PersistentAVLTree<Key, Value, Compare, Alloc>::Node*
+PersistentAVLTree<Key, Value, Compare, Alloc>::findNode(const Node* root, const Key& key) const
+{
+    const Node* node = root;
+    while (node != NULL)
+    {
+        if (comp_(key, node->getKey()))
+        {
+            node = node->getLeft();
+        }
+        else if (comp_(node->getKey(), key))
+        {
+            node = node->getRight();
+        }
+        else
+        {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename PersistentAVLTree<Key, Value, Compare, Alloc>::const_iterator
+PersistentAVLTree<Key, Value, Compare, Alloc>::begin() const
+{
+    return beginFrom(root_);
+}
+
+/**
+* Returns an iterator to the smallest item of the version rooted at root.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename PersistentAVLTree<Key, Value, Compare, Alloc>::const_iterator
+PersistentAVLTree<Key, Value, Compare, Alloc>::beginFrom(const Node* root)
+{
+    const_iterator it;
+    it.pushLeftSpine(root);
+    return it;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename PersistentAVLTree<Key, Value, Compare, Alloc>::const_iterator
+PersistentAVLTree<Key, Value, Compare, Alloc>::end() const
+{
+    return const_iterator();
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+std::size_t PersistentAVLTree<Key, Value, Compare, Alloc>::size() const
+{
+    return size_;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+bool PersistentAVLTree<Key, Value, Compare, Alloc>::empty() const
+{
+    return root_ == NULL;
+}
+
+/**
+* Allocates a node holding item over left and right, taking a reference to
+* each of them.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename Item>
+const typename PersistentAVLTree<Key, Value, Compare, Alloc>::Node*
+PersistentAVLTree<Key, Value, Compare, Alloc>::makeNode(Item&& item, const Node* left, const Node* right)
+{
+    Node* node = NodeAllocatorTraits::allocate(alloc_, 1);
+    try
+    {
+        NodeAllocatorTraits::construct(alloc_, node, std::forward<Item>(item), left, right);
+    }
+    catch (...)
+    {
+        NodeAllocatorTraits::deallocate(alloc_, node, 1);
+        throw;
+    }
+    retain(left);
+    retain(right);
+    return node;
+}
+
+/**
+* Builds the node holding item over left and right, whose heights differ by
+* at most two, rotating the new nodes into AVL shape when they differ by
+* two. Nodes taken apart by a rotation are copied, never changed.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+const typename PersistentAVLTree<Key, Value, Compare, Alloc>::Node*
+PersistentAVLTree<Key, Value, Compare, Alloc>::balanceNode(const std::pair<const Key, Value>& item,
+                                                           const Node* left, const Node* right)
+{
+    int leftHeight = Node::height(left);
+    int rightHeight = Node::height(right);
+    if (leftHeight > rightHeight + 1)
+    {
+        if (Node::height(left->getLeft()) >= Node::height(left->getRight())) //single right rotation
+        {
+            const Node* newRight = makeNode(item, left->getRight(), right);
+            const Node* result = makeNode(left->getItem(), left->getLeft(), newRight);
+            release(newRight);
+            return result;
+        }
+        const Node* pivot = left->getRight(); //left-right double rotation
+        const Node* newLeft = makeNode(left->getItem(), left->getLeft(), pivot->getLeft());
+        const Node* newRight = makeNode(item, pivot->getRight(), right);
+        const Node* result = makeNode(pivot->getItem(), newLeft, newRight);
+        release(newLeft);
+        release(newRight);
+        return result;
+    }
+    if (rightHeight > leftHeight + 1)
+    {
+        if (Node::height(right->getRight()) >= Node::height(right->getLeft())) //single left rotation
+        {
+            const Node* newLeft = makeNode(item, left, right->getLeft());
+            const Node* result = makeNode(right->getItem(), newLeft, right->getRight());
+            release(newLeft);
+            return result;
+        }
+        const Node* pivot = right->getLeft(); //right-left double rotation
+        const Node* newLeft = makeNode(item, left, pivot->getLeft());
+        const Node* newRight = makeNode(right->getItem(), pivot->getRight(), right->getRight());
+        const Node* result = makeNode(pivot->getItem(), newLeft, newRight);
+        release(newLeft);
+        release(newRight);
+        return result;
+    }
+    return makeNode(item, left, right);
+}
+
+/**
+* Returns a copy of the subtree at node with keyValuePair inserted. Only the
+* nodes on the path to the key are new.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+const typename PersistentAVLTree<Key, Value, Compare, Alloc>::Node*
+PersistentAVLTree<Key, Value, Compare, Alloc>::insertHelper(const Node* node, const std::pair<const Key, Value>& keyValuePair,
+                                                            bool& inserted)
+{
+    if (node == NULL)
+    {
+        inserted = true;
+        return makeNode(keyValuePair, NULL, NULL);
+    }
+    if (comp_(keyValuePair.first, node->getKey()))
+    {
+        const Node* newLeft = insertHelper(node->getLeft(), keyValuePair, inserted);
+        const Node* result = NULL;
+        try
+        {
+            result = balanceNode(node->getItem(), newLeft, node->getRight());
+        }
+        catch (...)
+        {
+            release(newLeft);
+            throw;
+        }
+        release(newLeft);
+        return result;
+    }
+    if (comp_(node->getKey(), keyValuePair.first))
+    {
+        const Node* newRight = insertHelper(node->getRight(), keyValuePair, inserted);
+        const Node* result = NULL;
+        try
+        {
+            result = balanceNode(node->getItem(), node->getLeft(), newRight);
+        }
+        catch (...)
+        {
+            release(newRight);
+            throw;
+        }
+        release(newRight);
+        return result;
+    }
+    return makeNode(keyValuePair, node->getLeft(), node->getRight()); //same key, new value
+}
+
+/**
+* Returns a copy of the subtree at node without key. If key is not there the
+* subtree itself is returned and nothing is copied.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+const typename PersistentAVLTree<Key, Value, Compare, Alloc>::Node*
+PersistentAVLTree<Key, Value, Compare, Alloc>::removeHelper(const Node* node, const Key& key, bool& removed)
+{
+    if (node == NULL)
+    {
+        return NULL;
+    }
+    bool goLeft = comp_(key, node->getKey());
+    if (goLeft || comp_(node->getKey(), key))
+    {
+        const Node* child = goLeft ? node->getLeft() : node->getRight();
+        const Node* newChild = removeHelper(child, key, removed);
+        if (!removed)
+        {
+            release(newChild);
+            return retain(node);
+        }
+        const Node* result = NULL;
+        try
+        {
+            result = goLeft ? balanceNode(node->getItem(), newChild, node->getRight())
+                            : balanceNode(node->getItem(), node->getLeft(), newChild);
+        }
+        catch (...)
+        {
+            release(newChild);
+            throw;
+        }
+        release(newChild);
+        return result;
+    }
+
+    removed = true;
+    if (node->getLeft() == NULL)
+    {
+        return retain(node->getRight());
+    }
+    if (node->getRight() == NULL)
+    {
+        return retain(node->getLeft());
+    }
+    const Node* successor = node->getRight(); //replaced by the smallest key on its right
+    while (successor->getLeft() != NULL)
+    {
+        successor = successor->getLeft();
+    }
+    const Node* newRight = removeSmallest(node->getRight());
+    const Node* result = NULL;
+    try
+    {
+        result = balanceNode(successor->getItem(), node->getLeft(), newRight);
+    }
+    catch (...)
+    {
+        release(newRight);
+        throw;
+    }
+    release(newRight);
+    return result;
+}
+
+/**
+* Returns a copy of the non-empty subtree at node without its smallest key.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+const typename PersistentAVLTree<Key, Value, Compare, Alloc>::Node*
+PersistentAVLTree<Key, Value, Compare, Alloc>::removeSmallest(const Node* node)
+{
+    if (node->getLeft() == NULL)
+    {
+        return retain(node->getRight());
+    }
+    const Node* newLeft = removeSmallest(node->getLeft());
+    const Node* result = NULL;
+    try
+    {
+        result = balanceNode(node->getItem(), newLeft, node->getRight());
+    }
+    catch (...)
+    {
+        release(newLeft);
+        throw;
+    }
+    release(newLeft);
+    return result;
+}
+
+/**
+* Takes one more reference to node, if any, and returns it.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+const typename PersistentAVLTree<Key, Value, Compare, Alloc>::Node*
+PersistentAVLTree<Key, Value, Compare, Alloc>::retain(const Node* node)
+{
+    if (node != NULL)
+    {
+        node->refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return node;
+}
+
+/**
+* Drops one reference to node, freeing it and dropping its references to
+* its children when it was the last one. The acquire/release ordering makes
+* every other thread's reads of the node happen before it is freed.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void PersistentAVLTree<Key, Value, Compare, Alloc>::release(const Node* node)
+{
+    while (node != NULL && node->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        const Node* left = node->getLeft();
+        const Node* right = node->getRight();
+        Node* dead = const_cast<Node*>(node);
+        NodeAllocatorTraits::destroy(alloc_, dead);
+        NodeAllocatorTraits::deallocate(alloc_, dead, 1);
+        release(left);
+        node = right; //loop on one side so a chain of frees does not recurse twice per level
+    }
+}
+
+/*
+----------------------------------------------------
+End implementations for the PersistentAVLTree class.
+----------------------------------------------------
+*/
+
+#endif
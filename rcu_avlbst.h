@@ -0,0 +1,388 @@
+#ifndef RCU_AVLBST_H
+#define RCU_AVLBST_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "persistent_avlbst.h"
+
+/**
+* A map for read-mostly workloads where lookups never write to memory any
+* other thread writes. Writers path-copy a PersistentAVLTree version and
+* publish its root with one atomic store; readers load that root and walk
+* immutable nodes. The version a writer replaces is retired rather than
+* dropped, and only freed once every reader that might still be looking at
+* it has moved on, tracked with epochs:
+*
+*  - each reader owns a slot (a Reader, one per thread) on its own cache
+*    line, and while reading stores the global epoch into it, then clears
+*    it again. Both are plain stores plus a fence, no read-modify-write, and
+*    no reader ever writes to a line another thread writes to;
+*  - the writer tags each retired version with the epoch current when it
+*    was unpublished, advances the epoch, and frees the versions tagged
+*    before the oldest epoch still announced by a reader.
+*
+* Writes are serialized by a mutex that readers never touch.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value> > >
+class RcuAVLTree
+{
+public:
+    typedef PersistentAVLTree<Key, Value, Compare, Alloc> Version;
+    typedef typename Version::const_iterator const_iterator;
+
+    /**
+    * A registered reader. Each thread reading the tree keeps one Reader for
+    * as long as it likes; creating and destroying one are the only reader
+    * operations that use atomic read-modify-writes.
+    */
+    class Reader
+    {
+    public:
+        explicit Reader(const RcuAVLTree& tree);
+        ~Reader();
+
+        bool find(const Key& key, Value& value);
+
+    protected:
+        friend class RcuAVLTree;
+        Reader(const Reader&);
+        Reader& operator=(const Reader&);
+
+        const RcuAVLTree& tree_;
+        std::size_t slot_;
+    };
+
+    /**
+    * Pins the currently published version for as long as the guard lives,
+    * so its items can be iterated or referenced. A reader holds at most one
+    * guard at a time.
+    */
+    class ReadGuard
+    {
+    public:
+        explicit ReadGuard(Reader& reader);
+        ~ReadGuard();
+
+        const_iterator find(const Key& key) const;
+        const_iterator begin() const;
+        const_iterator end() const;
+        const Value& operator[](const Key& key) const;
+
+    protected:
+        friend class Reader;
+        ReadGuard(const ReadGuard&);
+        ReadGuard& operator=(const ReadGuard&);
+
+        Reader& reader_;
+        const typename Version::Node* root_;
+    };
+
+    explicit RcuAVLTree(std::size_t maxReaders = 64, const Compare& comp = Compare(), const Alloc& alloc = Alloc());
+    ~RcuAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    Version snapshot() const;
+
+protected:
+    RcuAVLTree(const RcuAVLTree&);
+    RcuAVLTree& operator=(const RcuAVLTree&);
+
+    // An announced reader epoch, alone on its cache line. 0 means the
+    // reader is not reading.
+    struct alignas(64) Slot
+    {
+        Slot() : epoch(0), claimed(false) { }
+
+        std::atomic<uint64_t> epoch;
+        std::atomic<bool> claimed;
+    };
+
+    struct Retired
+    {
+        uint64_t epoch;
+        Version version;
+    };
+
+    void publish(Version& old);
+    void reclaim();
+
+    alignas(64) std::atomic<const typename Version::Node*> published_;
+    alignas(64) std::atomic<uint64_t> epoch_;
+    std::unique_ptr<Slot[]> slots_;
+    std::size_t slotCount_;
+    mutable std::mutex writeLock_;
+    Version current_;
+    std::vector<Retired> retired_;
+};
+
+/*
+-------------------------------------------------------
+Begin implementations for the RcuAVLTree::Reader class.
+-------------------------------------------------------
+*/
+
+/**
+* Claims a free reader slot, throwing std::runtime_error if all maxReaders
+* slots are taken.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+RcuAVLTree<Key, Value, Compare, Alloc>::Reader::Reader(const RcuAVLTree& tree) :
+    tree_(tree),
+    slot_(0)
+{
+    for (; slot_ < tree_.slotCount_; ++slot_)
+    {
+        bool expected = false;
+        if (tree_.slots_[slot_].claimed.compare_exchange_strong(expected, true))
+        {
+            return;
+        }
+    }
+    throw std::runtime_error("RcuAVLTree: no free reader slot");
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+RcuAVLTree<Key, Value, Compare, Alloc>::Reader::~Reader()
+{
+    tree_.slots_[slot_].claimed.store(false, std::memory_order_release);
+}
+
+/**
+* Copies the value stored under key into value and returns true, or returns
+* false if key is not present.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool RcuAVLTree<Key, Value, Compare, Alloc>::Reader::find(const Key& key, Value& value)
+{
+    ReadGuard guard(*this);
+    const typename Version::Node* node = tree_.current_.findNode(guard.root_, key);
+    if (node == NULL)
+    {
+        return false;
+    }
+    value = node->getItem().second;
+    return true;
+}
+
+/*
+-----------------------------------------------------
+End implementations for the RcuAVLTree::Reader class.
+-----------------------------------------------------
+*/
+
+/*
+----------------------------------------------------------
+Begin implementations for the RcuAVLTree::ReadGuard class.
+----------------------------------------------------------
+*/
+
+/**
+* Announces the current epoch in the reader's slot and then loads the
+* published root. The fence orders the announcement before the load: a
+* writer that misses the announcement has already published a newer root,
+* which this load is then guaranteed to see, so whatever root is loaded
+* cannot be freed until the guard is gone.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+RcuAVLTree<Key, Value, Compare, Alloc>::ReadGuard::ReadGuard(Reader& reader) :
+    reader_(reader),
+    root_(NULL)
+{
+    const RcuAVLTree& tree = reader_.tree_;
+    tree.slots_[reader_.slot_].epoch.store(tree.epoch_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    root_ = tree.published_.load(std::memory_order_acquire);
+}
+
+/**
+* Leaves the read side. Every read of the version happens before the store.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+RcuAVLTree<Key, Value, Compare, Alloc>::ReadGuard::~ReadGuard()
+{
+    reader_.tree_.slots_[reader_.slot_].epoch.store(0, std::memory_order_release);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename RcuAVLTree<Key, Value, Compare, Alloc>::const_iterator
+RcuAVLTree<Key, Value, Compare, Alloc>::ReadGuard::find(const Key& key) const
+{
+    return reader_.tree_.current_.findFrom(root_, key);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename RcuAVLTree<Key, Value, Compare, Alloc>::const_iterator
+RcuAVLTree<Key, Value, Compare, Alloc>::ReadGuard::begin() const
+{
+    return Version::beginFrom(root_);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename RcuAVLTree<Key, Value, Compare, Alloc>::const_iterator
+RcuAVLTree<Key, Value, Compare, Alloc>::ReadGuard::end() const
+{
+    return const_iterator();
+}
+
+/**
+ * @precondition The key exists in the pinned version
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare, class Alloc>
+const Value& RcuAVLTree<Key, Value, Compare, Alloc>::ReadGuard::operator[](const Key& key) const
+{
+    const typename Version::Node* node = reader_.tree_.current_.findNode(root_, key);
+    if (node == NULL) throw std::out_of_range("Invalid key");
+    return node->getItem().second;
+}
+
+/*
+--------------------------------------------------------
+End implementations for the RcuAVLTree::ReadGuard class.
+--------------------------------------------------------
+*/
+
+/*
+-----------------------------------------------
+Begin implementations for the RcuAVLTree class.
+-----------------------------------------------
+*/
+
+/**
+* Creates an empty tree that up to maxReaders Readers may read at once.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+RcuAVLTree<Key, Value, Compare, Alloc>::RcuAVLTree(std::size_t maxReaders, const Compare& comp, const Alloc& alloc) :
+    published_(NULL),
+    epoch_(1),
+    slots_(new Slot[maxReaders]),
+    slotCount_(maxReaders),
+    current_(comp, alloc)
+{
+
+}
+
+/**
+* All Readers must be gone by now, so every retired version can go.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+RcuAVLTree<Key, Value, Compare, Alloc>::~RcuAVLTree()
+{
+    retired_.clear();
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present,
+* and publishes the result.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void RcuAVLTree<Key, Value, Compare, Alloc>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::lock_guard<std::mutex> guard(writeLock_);
+    Version old = current_; //keeps the nodes readers may be on alive
+    current_.insert(keyValuePair);
+    publish(old);
+}
+
+/**
+* Removes key if present and publishes the result.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void RcuAVLTree<Key, Value, Compare, Alloc>::remove(const Key& key)
+{
+    std::lock_guard<std::mutex> guard(writeLock_);
+    Version old = current_;
+    current_.remove(key);
+    publish(old);
+}
+
+/**
+* Removes every key and publishes the empty tree.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void RcuAVLTree<Key, Value, Compare, Alloc>::clear()
+{
+    std::lock_guard<std::mutex> guard(writeLock_);
+    Version old = current_;
+    current_.clear();
+    publish(old);
+}
+
+/**
+* Returns the latest version as a PersistentAVLTree, for callers that want
+* to keep it beyond a ReadGuard. This takes the write lock.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename RcuAVLTree<Key, Value, Compare, Alloc>::Version RcuAVLTree<Key, Value, Compare, Alloc>::snapshot() const
+{
+    std::lock_guard<std::mutex> guard(writeLock_);
+    return current_.snapshot();
+}
+
+/**
+* Makes current_ visible to readers and retires old, the version it
+* replaces, under the epoch in force while old was published. If nothing
+* changed old shares the new root and costs nothing to retire.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void RcuAVLTree<Key, Value, Compare, Alloc>::publish(Version& old)
+{
+    if (old.root_ == current_.root_)
+    {
+        return; //removing an absent key published nothing new
+    }
+    published_.store(current_.root_, std::memory_order_seq_cst);
+    uint64_t unpublishedIn = epoch_.fetch_add(1, std::memory_order_seq_cst);
+    retired_.push_back(Retired{unpublishedIn, std::move(old)});
+    reclaim();
+}
+
+/**
+* Frees the retired versions no reader can still be looking at: a reader
+* announcing epoch e loaded its root after the versions retired before e
+* were unpublished.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void RcuAVLTree<Key, Value, Compare, Alloc>::reclaim()
+{
+    uint64_t oldest = epoch_.load(std::memory_order_seq_cst);
+    for (std::size_t i = 0; i < slotCount_; ++i)
+    {
+        uint64_t announced = slots_[i].epoch.load(std::memory_order_seq_cst);
+        if (announced != 0 && announced < oldest)
+        {
+            oldest = announced;
+        }
+    }
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < retired_.size(); ++i)
+    {
+        if (retired_[i].epoch >= oldest)
+        {
+            if (kept != i)
+            {
+                retired_[kept] = std::move(retired_[i]);
+            }
+            ++kept;
+        }
+    }
+    retired_.erase(retired_.begin() + kept, retired_.end());
+}
+
+/*
+---------------------------------------------
+End implementations for the RcuAVLTree class.
+---------------------------------------------
+*/
+
+#endif
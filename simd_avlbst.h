@@ -0,0 +1,587 @@
+#ifndef SIMD_AVLBST_H
+#define SIMD_AVLBST_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_AVLBST_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+* A read-only map from 32 or 64 bit signed integers, laid out so that one
+* step of a search compares the key against a whole cache line of keys at
+* once. It is a static B+ tree (an "S+ tree"): the sorted keys are cut into
+* 64 byte blocks of B keys (16 int32s or 8 int64s), and each layer above
+* holds, for every group of B + 1 blocks below, the B smallest keys of the
+* last B of them. A block's children are implicit (child i of block k is
+* block k * (B + 1) + i of the layer below), so there are no pointers, and a
+* lookup touches one cache line per layer: 5 layers cover 8M int64 keys.
+*
+* Within a block the number of keys less than the query picks the child.
+* That count is a compare and movemask over the block with AVX2 or SSE4.2,
+* or a plain loop otherwise, chosen once at run time from what the CPU
+* supports. Values are kept in sorted order in their own array and are only
+* read for the item found.
+*
+* Build one from any sorted range of pairs, such as an AVLTree:
+*     SimdSearchTree<int64_t, V> index(tree.begin(), tree.end());
+*/
+template <typename Key, typename Value>
+class SimdSearchTree
+{
+    static_assert(std::is_integral<Key>::value && std::is_signed<Key>::value &&
+                  (sizeof(Key) == 4 || sizeof(Key) == 8),
+                  "SimdSearchTree keys must be 32 or 64 bit signed integers");
+
+public:
+    // The ways a block can be searched, fastest last.
+    enum Isa { SCALAR, SSE42, AVX2 };
+
+    /**
+    * An iterator in key order; it is an index into the sorted keys. It can
+    * also step back, but dereferencing yields a pair of references rather
+    * than a reference to a stored pair, so it only claims to be an input
+    * iterator.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef std::pair<Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef void pointer;
+        typedef std::pair<const Key&, const Value&> reference;
+
+        const_iterator();
+
+        std::pair<const Key&, const Value&> operator*() const;
+        const Key& key() const;
+        const Value& value() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class SimdSearchTree;
+        const_iterator(const SimdSearchTree* tree, std::size_t index);
+        const SimdSearchTree* tree_;
+        std::size_t index_; //size() for end()
+    };
+
+    SimdSearchTree();
+    template<typename ForwardIt>
+    SimdSearchTree(ForwardIt first, ForwardIt last);
+
+    const_iterator find(Key key) const;
+    const_iterator lower_bound(Key key) const;
+    const_iterator upper_bound(Key key) const;
+    bool contains(Key key) const;
+    const Value& operator[](Key key) const;
+    const_iterator begin() const;
+    const_iterator end() const;
+    std::size_t size() const;
+    bool empty() const;
+
+    static bool supports(Isa isa);
+    Isa isa() const;
+    void useIsa(Isa isa);
+
+protected:
+    static const unsigned B = 64 / sizeof(Key);
+
+    struct alignas(64) Block
+    {
+        Key keys[B];
+    };
+
+    const Key& keyAt(std::size_t index) const;
+    const Key* blockAt(std::size_t layer, std::size_t block) const;
+    std::size_t lowerBoundIndex(Key key) const;
+
+    static unsigned rankScalar(const Key* keys, Key key);
+    std::size_t searchScalar(Key key) const;
+#if defined(SIMD_AVLBST_X86)
+    __attribute__((target("sse4.2"))) static unsigned rankSse42(const Key* keys, Key key);
+    __attribute__((target("sse4.2"))) std::size_t searchSse42(Key key) const;
+    __attribute__((target("avx2"))) static unsigned rankAvx2(const Key* keys, Key key);
+    __attribute__((target("avx2"))) std::size_t searchAvx2(Key key) const;
+#endif
+
+    // The leaf layer (the sorted keys) comes first, then each layer above
+    // it; layerStart_[h] is the index of the first block of layer h.
+    std::vector<Block> blocks_;
+    std::vector<std::size_t> layerStart_;
+    std::vector<Value> values_;
+    std::size_t count_;
+    Isa isa_;
+    std::size_t (SimdSearchTree::*search_)(Key) const;
+};
+
+/*
+-------------------------------------------------------------------
+Begin implementations for the SimdSearchTree::const_iterator class.
+-------------------------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value>
+SimdSearchTree<Key, Value>::const_iterator::const_iterator() :
+    tree_(NULL),
+    index_(0)
+{
+
+}
+
+template<class Key, class Value>
+SimdSearchTree<Key, Value>::const_iterator::const_iterator(const SimdSearchTree* tree, std::size_t index) :
+    tree_(tree),
+    index_(index)
+{
+
+}
+
+/**
+* Provides access to the key and value. They sit in separate arrays, so the
+* item is a pair of references rather than a stored pair.
+*/
+template<class Key, class Value>
+std::pair<const Key&, const Value&>
+SimdSearchTree<Key, Value>::const_iterator::operator*() const
+{
+    return std::pair<const Key&, const Value&>(key(), value());
+}
+
+template<class Key, class Value>
+const Key& SimdSearchTree<Key, Value>::const_iterator::key() const
+{
+    return tree_->keyAt(index_);
+}
+
+template<class Key, class Value>
+const Value& SimdSearchTree<Key, Value>::const_iterator::value() const
+{
+    return tree_->values_[index_];
+}
+
+template<class Key, class Value>
+bool SimdSearchTree<Key, Value>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return index_ == rhs.index_;
+}
+
+template<class Key, class Value>
+bool SimdSearchTree<Key, Value>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return index_ != rhs.index_;
+}
+
+template<class Key, class Value>
+typename SimdSearchTree<Key, Value>::const_iterator&
+SimdSearchTree<Key, Value>::const_iterator::operator++()
+{
+    ++index_;
+    return *this;
+}
+
+template<class Key, class Value>
+typename SimdSearchTree<Key, Value>::const_iterator
+SimdSearchTree<Key, Value>::const_iterator::operator++(int)
+{
+    const_iterator before = *this;
+    ++index_;
+    return before;
+}
+
+/**
+* Decrementing end() lands on the largest key.
+*/
+template<class Key, class Value>
+typename SimdSearchTree<Key, Value>::const_iterator&
+SimdSearchTree<Key, Value>::const_iterator::operator--()
+{
+    --index_;
+    return *this;
+}
+
+template<class Key, class Value>
+typename SimdSearchTree<Key, Value>::const_iterator
+SimdSearchTree<Key, Value>::const_iterator::operator--(int)
+{
+    const_iterator before = *this;
+    --index_;
+    return before;
+}
+
+/*
+-----------------------------------------------------------------
+End implementations for the SimdSearchTree::const_iterator class.
+-----------------------------------------------------------------
+*/
+
+/*
+---------------------------------------------------
+Begin implementations for the SimdSearchTree class.
+---------------------------------------------------
+*/
+
+template<class Key, class Value>
+SimdSearchTree<Key, Value>::SimdSearchTree() :
+    count_(0),
+    isa_(SCALAR),
+    search_(&SimdSearchTree::searchScalar)
+{
+    useIsa(supports(AVX2) ? AVX2 : supports(SSE42) ? SSE42 : SCALAR);
+}
+
+/**
+* Copies the items of [first, last), which must be sorted by key with no
+* repeats (as an AVLTree's are). The last leaf block is padded with the
+* largest Key, as is any separator whose subtree is empty; a padding key
+* only ever sorts after the real keys, so a search that lands on one has
+* run off the end.
+*/
+template<class Key, class Value>
+template<typename ForwardIt>
+SimdSearchTree<Key, Value>::SimdSearchTree(ForwardIt first, ForwardIt last) :
+    SimdSearchTree()
+{
+    const Key padding = std::numeric_limits<Key>::max();
+    for (; first != last; ++first)
+    {
+        if (count_ % B == 0)
+        {
+            blocks_.push_back(Block());
+            std::fill(blocks_.back().keys, blocks_.back().keys + B, padding);
+        }
+        blocks_.back().keys[count_ % B] = first->first;
+        values_.push_back(first->second);
+        ++count_;
+    }
+    if (count_ == 0)
+    {
+        return;
+    }
+
+    layerStart_.push_back(0);
+    std::size_t below = blocks_.size();
+    for (std::size_t layer = 1; below > 1; ++layer)
+    {
+        std::size_t blocks = (below + B) / (B + 1);
+        layerStart_.push_back(blocks_.size());
+        for (std::size_t k = 0; k < blocks; ++k)
+        {
+            Block block;
+            for (unsigned i = 0; i < B; ++i)
+            {
+                // The smallest key under child i + 1 is the first key of the
+                // leftmost leaf below it.
+                std::size_t leaf = k * (B + 1) + i + 1;
+                for (std::size_t h = layer - 1; h > 0; --h)
+                {
+                    leaf *= B + 1;
+                }
+                block.keys[i] = leaf * B < count_ ? keyAt(leaf * B) : padding;
+            }
+            blocks_.push_back(block);
+        }
+        below = blocks;
+    }
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<class Key, class Value>
+typename SimdSearchTree<Key, Value>::const_iterator
+SimdSearchTree<Key, Value>::find(Key key) const
+{
+    std::size_t index = lowerBoundIndex(key);
+    if (index != count_ && keyAt(index) != key)
+    {
+        index = count_;
+    }
+    return const_iterator(this, index);
+}
+
+template<class Key, class Value>
+typename SimdSearchTree<Key, Value>::const_iterator
+SimdSearchTree<Key, Value>::lower_bound(Key key) const
+{
+    return const_iterator(this, lowerBoundIndex(key));
+}
+
+/**
+* The first key greater than key is the first key not less than key + 1.
+*/
+template<class Key, class Value>
+typename SimdSearchTree<Key, Value>::const_iterator
+SimdSearchTree<Key, Value>::upper_bound(Key key) const
+{
+    if (key == std::numeric_limits<Key>::max())
+    {
+        return end();
+    }
+    return const_iterator(this, lowerBoundIndex(key + 1));
+}
+
+template<class Key, class Value>
+bool SimdSearchTree<Key, Value>::contains(Key key) const
+{
+    return find(key) != end();
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value>
+const Value& SimdSearchTree<Key, Value>::operator[](Key key) const
+{
+    const_iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it.value();
+}
+
+template<class Key, class Value>
+typename SimdSearchTree<Key, Value>::const_iterator
+SimdSearchTree<Key, Value>::begin() const
+{
+    return const_iterator(this, 0);
+}
+
+template<class Key, class Value>
+typename SimdSearchTree<Key, Value>::const_iterator
+SimdSearchTree<Key, Value>::end() const
+{
+    return const_iterator(this, count_);
+}
+
+template<class Key, class Value>
+std::size_t SimdSearchTree<Key, Value>::size() const
+{
+    return count_;
+}
+
+template<class Key, class Value>
+bool SimdSearchTree<Key, Value>::empty() const
+{
+    return count_ == 0;
+}
+
+/**
+* Returns true if this CPU can search blocks with the given instructions.
+*/
+template<class Key, class Value>
+bool SimdSearchTree<Key, Value>::supports(Isa isa)
+{
+#if defined(SIMD_AVLBST_X86)
+    if (isa == AVX2)
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (isa == SSE42)
+    {
+        return __builtin_cpu_supports("sse4.2");
+    }
+#endif
+    return isa == SCALAR;
+}
+
+/**
+* Returns the instructions lookups currently use.
+*/
+template<class Key, class Value>
+typename SimdSearchTree<Key, Value>::Isa SimdSearchTree<Key, Value>::isa() const
+{
+    return isa_;
+}
+
+/**
+* Makes lookups use the given instructions. Construction already picks the
+* best the CPU has; this is for comparing them. Throws
+* std::invalid_argument if the CPU does not support isa.
+*/
+template<class Key, class Value>
+void SimdSearchTree<Key, Value>::useIsa(Isa isa)
+{
+    if (!supports(isa))
+    {
+        throw std::invalid_argument("SimdSearchTree: instruction set not supported");
+    }
+    isa_ = isa;
+    search_ = &SimdSearchTree::searchScalar;
+#if defined(SIMD_AVLBST_X86)
+    if (isa == AVX2)
+    {
+        search_ = &SimdSearchTree::searchAvx2;
+    }
+    else if (isa == SSE42)
+    {
+        search_ = &SimdSearchTree::searchSse42;
+    }
+#endif
+}
+
+template<class Key, class Value>
+const Key& SimdSearchTree<Key, Value>::keyAt(std::size_t index) const
+{
+    return blocks_[index / B].keys[index % B];
+}
+
+template<class Key, class Value>
+const Key* SimdSearchTree<Key, Value>::blockAt(std::size_t layer, std::size_t block) const
+{
+    return blocks_[layerStart_[layer] + block].keys;
+}
+
+/**
+* Returns the index of the first key not less than key, or size().
+*/
+template<class Key, class Value>
+std::size_t SimdSearchTree<Key, Value>::lowerBoundIndex(Key key) const
+{
+    if (count_ == 0)
+    {
+        return 0;
+    }
+    std::size_t index = (this->*search_)(key);
+    return index < count_ ? index : count_;
+}
+
+/**
+* Counts the keys in a block that are less than key.
+*/
+template<class Key, class Value>
+unsigned SimdSearchTree<Key, Value>::rankScalar(const Key* keys, Key key)
+{
+    unsigned rank = 0;
+    for (unsigned i = 0; i < B; ++i)
+    {
+        rank += keys[i] < key;
+    }
+    return rank;
+}
+
+/**
+* The descent, the same for every instruction set: in each layer the rank
+* of key within the block is the child to go to, and in the leaf layer it
+* is the offset of the answer. An answer one past the end of a block is
+* the first key of the next one.
+*/
+template<class Key, class Value>
+std::size_t SimdSearchTree<Key, Value>::searchScalar(Key key) const
+{
+    std::size_t block = 0;
+    for (std::size_t layer = layerStart_.size() - 1; layer > 0; --layer)
+    {
+        block = block * (B + 1) + rankScalar(blockAt(layer, block), key);
+    }
+    return block * B + rankScalar(blockAt(0, block), key);
+}
+
+#if defined(SIMD_AVLBST_X86)
+
+/**
+* Compares key against the block 128 bits at a time and counts the lanes
+* where it is greater. 64 bit compares need SSE4.2.
+*/
+template<class Key, class Value>
+unsigned SimdSearchTree<Key, Value>::rankSse42(const Key* keys, Key key)
+{
+    unsigned mask = 0;
+    if constexpr (sizeof(Key) == 4)
+    {
+        __m128i probe = _mm_set1_epi32(key);
+        for (unsigned i = 0; i < B; i += 4)
+        {
+            __m128i lanes = _mm_load_si128((const __m128i*)(keys + i));
+            mask |= (unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(probe, lanes))) << i;
+        }
+    }
+    else
+    {
+        __m128i probe = _mm_set1_epi64x(key);
+        for (unsigned i = 0; i < B; i += 2)
+        {
+            __m128i lanes = _mm_load_si128((const __m128i*)(keys + i));
+            mask |= (unsigned)_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(probe, lanes))) << i;
+        }
+    }
+    return __builtin_popcount(mask);
+}
+
+template<class Key, class Value>
+std::size_t SimdSearchTree<Key, Value>::searchSse42(Key key) const
+{
+    std::size_t block = 0;
+    for (std::size_t layer = layerStart_.size() - 1; layer > 0; --layer)
+    {
+        block = block * (B + 1) + rankSse42(blockAt(layer, block), key);
+    }
+    return block * B + rankSse42(blockAt(0, block), key);
+}
+
+/**
+* As rankSse42, 256 bits at a time: a block is two loads.
+*/
+template<class Key, class Value>
+unsigned SimdSearchTree<Key, Value>::rankAvx2(const Key* keys, Key key)
+{
+    unsigned mask = 0;
+    if constexpr (sizeof(Key) == 4)
+    {
+        __m256i probe = _mm256_set1_epi32(key);
+        for (unsigned i = 0; i < B; i += 8)
+        {
+            __m256i lanes = _mm256_load_si256((const __m256i*)(keys + i));
+            mask |= (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(probe, lanes))) << i;
+        }
+    }
+    else
+    {
+        __m256i probe = _mm256_set1_epi64x(key);
+        for (unsigned i = 0; i < B; i += 4)
+        {
+            __m256i lanes = _mm256_load_si256((const __m256i*)(keys + i));
+            mask |= (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(probe, lanes))) << i;
+        }
+    }
+    return __builtin_popcount(mask);
+}
+
+template<class Key, class Value>
+std::size_t SimdSearchTree<Key, Value>::searchAvx2(Key key) const
+{
+    std::size_t block = 0;
+    for (std::size_t layer = layerStart_.size() - 1; layer > 0; --layer)
+    {
+        block = block * (B + 1) + rankAvx2(blockAt(layer, block), key);
+    }
+    return block * B + rankAvx2(blockAt(0, block), key);
+}
+
+#endif
+
+/*
+-------------------------------------------------
+End implementations for the SimdSearchTree class.
+-------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,565 @@
+#ifndef SLAB_ALLOCATOR_H
+#define SLAB_ALLOCATOR_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+/**
+* The backing store for a SlabAllocator. Objects of one fixed size are carved
+* out of large contiguous slabs with a bump pointer, and freed objects are
+* threaded onto a free list so the next allocation can reuse them. Slabs are
+* only handed back to the system all at once, by release() or the destructor.
+*/
+class SlabPool
+{
+public:
+    SlabPool(std::size_t objectSize, std::size_t objectAlign, std::size_t slabBytes);
+    ~SlabPool();
+
+    void* allocate();
+    void deallocate(void* p);
+    void release();
+    std::size_t slabCount() const;
+
+private:
+    SlabPool(const SlabPool&);
+    SlabPool& operator=(const SlabPool&);
+
+    // A freed object is reused to hold the link to the next free object.
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    // Every slab starts with a header linking it to the previously allocated slab.
+    struct Slab
+    {
+        Slab* next;
+    };
+
+    static std::size_t roundUp(std::size_t n, std::size_t align);
+
+    std::size_t objectSize_;
+    std::size_t objectsPerSlab_;
+    Slab* slabs_;
+    std::size_t slabCount_;
+    char* bump_;
+    char* bumpEnd_;
+    FreeSlot* freeList_;
+};
+
+/*
+  --------------------------------------------
+  Begin implementations for the SlabPool class.
+  --------------------------------------------
+*/
+
+/**
+* Rounds n up to a multiple of align.
+*/
+inline std::size_t SlabPool::roundUp(std::size_t n, std::size_t align)
+{
+    return (n + align - 1) / align * align;
+}
+
+/**
+* Creates an empty pool. No memory is reserved until the first allocation.
+* Objects are packed at their own alignment rather than the malloc alignment,
+* so a 40 byte node really takes 40 bytes.
+*/
+inline SlabPool::SlabPool(std::size_t objectSize, std::size_t objectAlign, std::size_t slabBytes) :
+    objectSize_(roundUp(objectSize < sizeof(FreeSlot) ? sizeof(FreeSlot) : objectSize,
+                        objectAlign < alignof(FreeSlot) ? alignof(FreeSlot) : objectAlign)),
+    objectsPerSlab_(0),
+    slabs_(NULL),
+    slabCount_(0),
+    bump_(NULL),
+    bumpEnd_(NULL),
+    freeList_(NULL)
+{
+    std::size_t header = roundUp(sizeof(Slab), alignof(std::max_align_t));
+    std::size_t usable = slabBytes > header ? slabBytes - header : 0;
+    objectsPerSlab_ = usable / objectSize_;
+    if (objectsPerSlab_ == 0)
+    {
+        objectsPerSlab_ = 1;
+    }
+}
+
+/**
+* Frees every slab. Objects still living in the pool are not destroyed.
+*/
+inline SlabPool::~SlabPool()
+{
+    release();
+}
+
+/**
+* Hands out one object's worth of storage, preferring recycled objects.
+*/
+inline void* SlabPool::allocate()
+{
+    if (freeList_ != NULL)
+    {
+        FreeSlot* slot = freeList_;
+        freeList_ = slot->next;
+        return slot;
+    }
+    if (bump_ == bumpEnd_)
+    {
+        std::size_t header = roundUp(sizeof(Slab), alignof(std::max_align_t));
+        char* raw = static_cast<char*>(::operator new(header + objectsPerSlab_ * objectSize_));
+        Slab* slab = reinterpret_cast<Slab*>(raw);
+        slab->next = slabs_;
+        slabs_ = slab;
+        ++slabCount_;
+        bump_ = raw + header;
+        bumpEnd_ = bump_ + objectsPerSlab_ * objectSize_;
+    }
+    void* p = bump_;
+    bump_ += objectSize_;
+    return p;
+}
+
+/**
+* Puts an object's storage on the free list. The slab itself is kept.
+*/
+inline void SlabPool::deallocate(void* p)
+{
+    FreeSlot* slot = static_cast<FreeSlot*>(p);
+    slot->next = freeList_;
+    freeList_ = slot;
+}
+
+/**
+* Returns every slab to the system in O(slabs), regardless of how many
+* objects were carved out of them.
+*/
+inline void SlabPool::release()
+{
+    while (slabs_ != NULL)
+    {
+        Slab* next = slabs_->next;
+        ::operator delete(slabs_);
+        slabs_ = next;
+    }
+    slabCount_ = 0;
+    bump_ = NULL;
+    bumpEnd_ = NULL;
+    freeList_ = NULL;
+}
+
+/**
+* Returns the number of slabs currently held.
+*/
+inline std::size_t SlabPool::slabCount() const
+{
+    return slabCount_;
+}
+
+/*
+  ------------------------------------------
+  End implementations for the SlabPool class.
+  ------------------------------------------
+*/
+
+/**
+* A set of SlabPools, one per object size and alignment, shared by a family
+* of SlabAllocators. The arena also counts who has live objects in it: the
+* holders, trees that keep nodes here (see SlabAllocator::hold), and the
+* unheld objects, those allocated through allocators that hold nothing.
+* With one holder and no unheld objects, every live object is that
+* holder's, so it may release the arena whatever other allocators share it.
+*/
+class SlabArena
+{
+public:
+    explicit SlabArena(std::size_t slabBytes);
+
+    SlabPool* pool(std::size_t objectSize, std::size_t objectAlign);
+    void release();
+    void addHolder();
+    void removeHolder();
+    void countUnheld(std::ptrdiff_t change);
+    bool soleHolder() const;
+
+private:
+    SlabArena(const SlabArena&);
+    SlabArena& operator=(const SlabArena&);
+
+    struct Entry
+    {
+        std::size_t objectSize;
+        std::size_t objectAlign;
+        std::unique_ptr<SlabPool> pool;
+    };
+
+    std::size_t slabBytes_;
+    std::vector<Entry> pools_;
+    std::size_t holders_;
+    std::ptrdiff_t unheld_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for the SlabArena class.
+  ---------------------------------------------
+*/
+
+/**
+* Creates an arena with no pools; they are made on first request.
+*/
+inline SlabArena::SlabArena(std::size_t slabBytes) :
+    slabBytes_(slabBytes),
+    holders_(0),
+    unheld_(0)
+{
+
+}
+
+/**
+* Returns the pool for objects of the given size and alignment, creating
+* it if needed. There are only ever a handful, so a linear scan will do.
+*/
+inline SlabPool* SlabArena::pool(std::size_t objectSize, std::size_t objectAlign)
+{
+    for (std::size_t i = 0; i < pools_.size(); ++i)
+    {
+        if (pools_[i].objectSize == objectSize && pools_[i].objectAlign == objectAlign)
+        {
+            return pools_[i].pool.get();
+        }
+    }
+    Entry entry;
+    entry.objectSize = objectSize;
+    entry.objectAlign = objectAlign;
+    entry.pool.reset(new SlabPool(objectSize, objectAlign, slabBytes_));
+    SlabPool* created = entry.pool.get();
+    pools_.push_back(std::move(entry));
+    return created;
+}
+
+/**
+* Releases every pool's slabs.
+*/
+inline void SlabArena::release()
+{
+    for (std::size_t i = 0; i < pools_.size(); ++i)
+    {
+        pools_[i].pool->release();
+    }
+    unheld_ = 0;
+}
+
+inline void SlabArena::addHolder()
+{
+    ++holders_;
+}
+
+inline void SlabArena::removeHolder()
+{
+    --holders_;
+}
+
+/**
+* Adds change to the count of live objects allocated through allocators
+* that hold nothing.
+*/
+inline void SlabArena::countUnheld(std::ptrdiff_t change)
+{
+    unheld_ += change;
+}
+
+/**
+* Returns true if exactly one holder has live objects here and nothing
+* else does, so that holder may release the arena.
+*/
+inline bool SlabArena::soleHolder() const
+{
+    return holders_ == 1 && unheld_ == 0;
+}
+
+/*
+  -------------------------------------------
+  End implementations for the SlabArena class.
+  -------------------------------------------
+*/
+
+/**
+* A standard-conforming allocator that serves single-object requests out of
+* a SlabPool. It is meant for node based containers. Copies of an allocator,
+* and allocators rebound from it, share one SlabArena, so every type gets
+* its own pool but anything allocated through one member of the family can
+* be freed through any other member for the same type. Two trees built from
+* the same allocator can therefore hand nodes to each other.
+*
+* A tree calls hold on its own allocator before it keeps nodes in the
+* arena and unhold once it keeps none, and passes the hold along with its
+* nodes when they move to another tree. Allocations made through an
+* allocator that is not holding are counted as unheld. That is how release
+* can tell that a tree is the arena's last owner even while copies of the
+* allocator, such as the one the tree was built from, or trees left empty
+* by a move, split or join still share the arena.
+*/
+template <typename T, std::size_t SlabBytes = 64 * 1024>
+class SlabAllocator
+{
+public:
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef SlabAllocator<U, SlabBytes> other;
+    };
+
+    SlabAllocator();
+    SlabAllocator(const SlabAllocator& other);
+    template <typename U>
+    SlabAllocator(const SlabAllocator<U, SlabBytes>& other);
+    SlabAllocator& operator=(const SlabAllocator& other);
+    ~SlabAllocator();
+
+    T* allocate(std::size_t n);
+    void deallocate(T* p, std::size_t n);
+    bool release();
+    std::size_t slabCount() const;
+    void hold();
+    void unhold();
+
+    bool operator==(const SlabAllocator& rhs) const;
+    bool operator!=(const SlabAllocator& rhs) const;
+
+private:
+    template <typename U, std::size_t B>
+    friend class SlabAllocator;
+
+    std::shared_ptr<SlabArena> arena_;
+    SlabPool* pool_;
+    bool holding_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the SlabAllocator class.
+  -------------------------------------------------
+*/
+
+/**
+* Default constructor, which starts a new, empty arena.
+*/
+template <typename T, std::size_t SlabBytes>
+SlabAllocator<T, SlabBytes>::SlabAllocator() :
+    arena_(std::make_shared<SlabArena>(SlabBytes)),
+    pool_(arena_->pool(sizeof(T), alignof(T))),
+    holding_(false)
+{
+
+}
+
+/**
+* Copy constructor. The copy shares the arena, so either one can free what
+* the other allocated. It does not share other's hold.
+*/
+template <typename T, std::size_t SlabBytes>
+SlabAllocator<T, SlabBytes>::SlabAllocator(const SlabAllocator& other) :
+    arena_(other.arena_),
+    pool_(other.pool_),
+    holding_(false)
+{
+
+}
+
+/**
+* Rebinding constructor. Joins other's arena, drawing from its pool for
+* objects the size of T.
+*/
+template <typename T, std::size_t SlabBytes>
+template <typename U>
+SlabAllocator<T, SlabBytes>::SlabAllocator(const SlabAllocator<U, SlabBytes>& other) :
+    arena_(other.arena_),
+    pool_(arena_->pool(sizeof(T), alignof(T))),
+    holding_(false)
+{
+
+}
+
+/**
+* Copy assignment. This allocator leaves its arena for other's, so it must
+* no longer own anything allocated from the old one; its hold, if any, is
+* given up.
+*/
+template <typename T, std::size_t SlabBytes>
+SlabAllocator<T, SlabBytes>& SlabAllocator<T, SlabBytes>::operator=(const SlabAllocator& other)
+{
+    unhold();
+    arena_ = other.arena_;
+    pool_ = other.pool_;
+    return *this;
+}
+
+template <typename T, std::size_t SlabBytes>
+SlabAllocator<T, SlabBytes>::~SlabAllocator()
+{
+    unhold();
+}
+
+/**
+* Allocates storage for n objects. Arrays bypass the pool.
+*/
+template <typename T, std::size_t SlabBytes>
+T* SlabAllocator<T, SlabBytes>::allocate(std::size_t n)
+{
+    if (n == 1)
+    {
+        T* p = static_cast<T*>(pool_->allocate());
+        if (!holding_)
+        {
+            arena_->countUnheld(1);
+        }
+        return p;
+    }
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+}
+
+/**
+* Frees storage obtained from allocate with the same n.
+*/
+template <typename T, std::size_t SlabBytes>
+void SlabAllocator<T, SlabBytes>::deallocate(T* p, std::size_t n)
+{
+    if (n == 1)
+    {
+        pool_->deallocate(p);
+        if (!holding_)
+        {
+            arena_->countUnheld(-1);
+        }
+        return;
+    }
+    ::operator delete(p);
+}
+
+/**
+* Drops every slab of the arena at once, invalidating everything allocated
+* from it. Only allowed when everything live in the arena is this
+* allocator's: it is the only allocator left sharing the arena, or it holds
+* and is the arena's sole holder. Refuses (and returns false) otherwise,
+* since other objects would be freed too.
+*/
+template <typename T, std::size_t SlabBytes>
+bool SlabAllocator<T, SlabBytes>::release()
+{
+    if (arena_.use_count() != 1 && !(holding_ && arena_->soleHolder()))
+    {
+        return false;
+    }
+    arena_->release();
+    return true;
+}
+
+/**
+* Returns the number of slabs held for objects of type T.
+*/
+template <typename T, std::size_t SlabBytes>
+std::size_t SlabAllocator<T, SlabBytes>::slabCount() const
+{
+    return pool_->slabCount();
+}
+
+/**
+* Marks this allocator as keeping live objects in the arena on a tree's
+* behalf. The tree must hold before it allocates its first node through
+* this allocator, and must free its nodes only through holding allocators.
+*/
+template <typename T, std::size_t SlabBytes>
+void SlabAllocator<T, SlabBytes>::hold()
+{
+    if (!holding_)
+    {
+        holding_ = true;
+        arena_->addHolder();
+    }
+}
+
+/**
+* Gives up the hold, once the tree keeps no nodes through this allocator.
+*/
+template <typename T, std::size_t SlabBytes>
+void SlabAllocator<T, SlabBytes>::unhold()
+{
+    if (holding_)
+    {
+        holding_ = false;
+        arena_->removeHolder();
+    }
+}
+
+/**
+* Two allocators are equal when they share an arena.
+*/
+template <typename T, std::size_t SlabBytes>
+bool SlabAllocator<T, SlabBytes>::operator==(const SlabAllocator& rhs) const
+{
+    return arena_ == rhs.arena_;
+}
+
+template <typename T, std::size_t SlabBytes>
+bool SlabAllocator<T, SlabBytes>::operator!=(const SlabAllocator& rhs) const
+{
+    return arena_ != rhs.arena_;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the SlabAllocator class.
+  -----------------------------------------------
+*/
+
+/**
+* Asks an allocator to free everything it handed out in one step. Returns
+* false for allocators, like std::allocator, that have no such operation.
+*/
+template <typename Alloc>
+bool releaseAllocator(Alloc&)
+{
+    return false;
+}
+
+template <typename T, std::size_t SlabBytes>
+bool releaseAllocator(SlabAllocator<T, SlabBytes>& alloc)
+{
+    return alloc.release();
+}
+
+/**
+* Tells an allocator that the tree owning it now keeps nodes through it, or
+* no longer does (see SlabAllocator::hold). Other allocators ignore this.
+*/
+template <typename Alloc>
+void holdAllocator(Alloc&)
+{
+
+}
+
+template <typename T, std::size_t SlabBytes>
+void holdAllocator(SlabAllocator<T, SlabBytes>& alloc)
+{
+    alloc.hold();
+}
+
+template <typename Alloc>
+void unholdAllocator(Alloc&)
+{
+
+}
+
+template <typename T, std::size_t SlabBytes>
+void unholdAllocator(SlabAllocator<T, SlabBytes>& alloc)
+{
+    alloc.unhold();
+}
+
+#endif
@@ -0,0 +1,434 @@
+#ifndef SNAPSHOT_AVLBST_H
+#define SNAPSHOT_AVLBST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+* The snapshot file written by AVLTree::save and read by AVLTree::load:
+*
+*   header   magic "AVLSNAP\0", then uint32 version, uint32 byte order mark
+*            (0x01020304 as written), uint32 key size and uint32 value size
+*            (sizeof each for trivially copyable types, 0 for encoded ones),
+*            uint64 item count
+*   items    each key followed by its value, in key order
+*   trailer  uint64 checksum of the items followed by the header
+*
+* Numbers are in the writer's byte order, which the mark lets a reader
+* check. A trivially copyable key or value is stored as its raw bytes, so
+* reading it back is a copy out of the read buffer; std::string is stored
+* as a uint64 length and its bytes. Other types can be supported by
+* overloading writeSnapshotField and readSnapshotField next to them.
+*/
+struct SnapshotHeader
+{
+    static const std::uint32_t Version = 1;
+    static const std::uint32_t ByteOrderMark = 0x01020304;
+
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrder;
+    std::uint32_t keySize;
+    std::uint32_t valueSize;
+    std::uint64_t count;
+};
+
+static_assert(sizeof(SnapshotHeader) == 32, "SnapshotHeader must have no padding");
+
+/**
+* A 64-bit checksum taken eight bytes at a time. It carries partial words
+* between calls, so the result depends only on the bytes and not on how
+* they were split into buffers.
+*/
+class SnapshotChecksum
+{
+public:
+    SnapshotChecksum() : hash_(0x243F6A8885A308D3ull), length_(0), pending_(0) { }
+
+    void update(const void* data, std::size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        length_ += size;
+        while (pending_ != 0 && size != 0) //top up a word left over from the last call
+        {
+            partial_[pending_++] = *bytes++;
+            --size;
+            if (pending_ == 8)
+            {
+                mixWord(partial_);
+                pending_ = 0;
+            }
+        }
+        for (; size >= 8; bytes += 8, size -= 8)
+        {
+            mixWord(bytes);
+        }
+        std::memcpy(partial_ + pending_, bytes, size);
+        pending_ += size;
+    }
+
+    std::uint64_t value() const
+    {
+        unsigned char last[8] = { 0 };
+        std::memcpy(last, partial_, pending_);
+        std::uint64_t word;
+        std::memcpy(&word, last, 8);
+        std::uint64_t hash = mix(mix(hash_, word), length_);
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+private:
+    static std::uint64_t mix(std::uint64_t hash, std::uint64_t word)
+    {
+        hash ^= word;
+        hash = (hash << 29) | (hash >> 35);
+        return hash * 0x9E3779B97F4A7C15ull;
+    }
+
+    void mixWord(const unsigned char* bytes)
+    {
+        std::uint64_t word;
+        std::memcpy(&word, bytes, 8);
+        hash_ = mix(hash_, word);
+    }
+
+    std::uint64_t hash_;
+    std::uint64_t length_;
+    std::size_t pending_;
+    unsigned char partial_[8];
+};
+
+/**
+* Writes a file through one large buffer, so that small fields cost a copy
+* and the file sees a few big writes. Pieces at least as big as the buffer
+* go straight to the file. Everything written is checksummed.
+*/
+class SnapshotWriter
+{
+public:
+    explicit SnapshotWriter(std::FILE* file, std::size_t bufferSize = 1 << 20) :
+        file_(file), buffer_(bufferSize), used_(0) { }
+
+    void write(const void* data, std::size_t size)
+    {
+        checksum_.update(data, size);
+        if (used_ + size > buffer_.size())
+        {
+            flush();
+            if (size >= buffer_.size())
+            {
+                writeFile(data, size);
+                return;
+            }
+        }
+        std::memcpy(&buffer_[used_], data, size);
+        used_ += size;
+    }
+
+    void flush()
+    {
+        writeFile(buffer_.data(), used_);
+        used_ = 0;
+    }
+
+    SnapshotChecksum& checksum()
+    {
+        return checksum_;
+    }
+
+private:
+    void writeFile(const void* data, std::size_t size)
+    {
+        if (size != 0 && std::fwrite(data, 1, size, file_) != size)
+        {
+            throw std::runtime_error("AVLTree::save: write failed");
+        }
+    }
+
+    std::FILE* file_;
+    std::vector<char> buffer_;
+    std::size_t used_;
+    SnapshotChecksum checksum_;
+};
+
+/**
+* Reads a file through one large buffer, the mirror image of SnapshotWriter.
+* It is told how many bytes the file has left, so that lengths read from
+* the file can be checked before anything is allocated for them. Running
+* out of file part way through a read throws.
+*/
+class SnapshotReader
+{
+public:
+    SnapshotReader(std::FILE* file, std::uint64_t fileBytes, std::size_t bufferSize = 1 << 20) :
+        file_(file), fileLeft_(fileBytes), buffer_(bufferSize), pos_(0), end_(0) { }
+
+    void read(void* data, std::size_t size)
+    {
+        char* out = static_cast<char*>(data);
+        std::size_t total = size;
+        while (size > end_ - pos_)
+        {
+            std::size_t available = end_ - pos_;
+            std::memcpy(out, &buffer_[pos_], available);
+            out += available;
+            size -= available;
+            pos_ = end_;
+            if (size >= buffer_.size()) //big pieces skip the buffer
+            {
+                if (size > fileLeft_ || std::fread(out, 1, size, file_) != size)
+                {
+                    throw std::runtime_error("AVLTree::load: file is truncated");
+                }
+                fileLeft_ -= size;
+                checksum_.update(data, total);
+                return;
+            }
+            fill(size);
+        }
+        std::memcpy(out, &buffer_[pos_], size);
+        pos_ += size;
+        checksum_.update(data, total);
+    }
+
+    /**
+    * Reads up to count records of recordSize bytes each, as many whole ones
+    * as the buffer holds (at least one), and returns where they start in
+    * the buffer. count is set to the number read. The run is checksummed in
+    * one go, and the records stay valid until the next read.
+    */
+    const char* readRecords(std::size_t recordSize, std::uint64_t& count)
+    {
+        if (end_ - pos_ < recordSize)
+        {
+            fill(recordSize);
+        }
+        std::uint64_t buffered = (end_ - pos_) / recordSize;
+        count = count < buffered ? count : buffered;
+        const char* records = &buffer_[pos_];
+        pos_ += count * recordSize;
+        checksum_.update(records, count * recordSize);
+        return records;
+    }
+
+    /**
+    * The number of bytes not yet read.
+    */
+    std::uint64_t remaining() const
+    {
+        return fileLeft_ + (end_ - pos_);
+    }
+
+    SnapshotChecksum& checksum()
+    {
+        return checksum_;
+    }
+
+private:
+    /**
+    * Moves the unread bytes to the front of the buffer and tops it up from
+    * the file until at least size bytes are buffered.
+    */
+    void fill(std::size_t size)
+    {
+        std::size_t kept = end_ - pos_;
+        if (size - kept > fileLeft_)
+        {
+            throw std::runtime_error("AVLTree::load: file is truncated");
+        }
+        std::memmove(buffer_.data(), &buffer_[pos_], kept);
+        pos_ = 0;
+        end_ = kept;
+        while (end_ < size)
+        {
+            std::size_t got = std::fread(&buffer_[end_], 1, buffer_.size() - end_, file_);
+            if (got == 0)
+            {
+                throw std::runtime_error("AVLTree::load: read failed");
+            }
+            end_ += got;
+            fileLeft_ -= got < fileLeft_ ? got : fileLeft_;
+        }
+    }
+
+    std::FILE* file_;
+    std::uint64_t fileLeft_;
+    std::vector<char> buffer_;
+    std::size_t pos_;
+    std::size_t end_;
+    SnapshotChecksum checksum_;
+};
+
+/**
+* The size a field type has in the header: sizeof for types stored as raw
+* bytes, 0 for encoded ones.
+*/
+template <typename T>
+struct SnapshotFieldSize :
+    std::integral_constant<std::uint32_t, std::is_trivially_copyable<T>::value ? (std::uint32_t)sizeof(T) : 0>
+{
+};
+
+/**
+* The fewest bytes a field of type T takes in a snapshot, used to check an
+* item count against the size of the file. 0 when it is not known.
+*/
+template <typename T>
+struct SnapshotFieldMinSize : std::integral_constant<std::uint32_t, SnapshotFieldSize<T>::value>
+{
+};
+
+template <>
+struct SnapshotFieldMinSize<std::string> : std::integral_constant<std::uint32_t, sizeof(std::uint64_t)>
+{
+};
+
+template <typename T>
+typename std::enable_if<std::is_trivially_copyable<T>::value>::type
+writeSnapshotField(SnapshotWriter& writer, const T& field)
+{
+    writer.write(&field, sizeof(T));
+}
+
+template <typename T>
+typename std::enable_if<std::is_trivially_copyable<T>::value>::type
+readSnapshotField(SnapshotReader& reader, T& field)
+{
+    reader.read(&field, sizeof(T));
+}
+
+inline void writeSnapshotField(SnapshotWriter& writer, const std::string& field)
+{
+    std::uint64_t size = field.size();
+    writer.write(&size, sizeof(size));
+    writer.write(field.data(), field.size());
+}
+
+inline void readSnapshotField(SnapshotReader& reader, std::string& field)
+{
+    std::uint64_t size = 0;
+    reader.read(&size, sizeof(size));
+    if (size > reader.remaining())
+    {
+        throw std::runtime_error("AVLTree::load: string length runs past the end of the file");
+    }
+    field.resize(size);
+    reader.read(&field[0], size);
+}
+
+/**
+* An input iterator over the items of a snapshot, decoding one item when it
+* is first dereferenced. AVLTree::load wraps it in a std::move_iterator and
+* hands it to the sorted build, which visits every item once, in order.
+*/
+template <typename Key, typename Value>
+class SnapshotItemIterator
+{
+public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef std::pair<Key, Value> value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef std::pair<Key, Value>* pointer;
+    typedef std::pair<Key, Value>& reference;
+
+    explicit SnapshotItemIterator(SnapshotReader& reader) : reader_(&reader), loaded_(false) { }
+
+    std::pair<Key, Value>& operator*() const
+    {
+        if (!loaded_)
+        {
+            readSnapshotField(*reader_, item_.first);
+            readSnapshotField(*reader_, item_.second);
+            loaded_ = true;
+        }
+        return item_;
+    }
+
+    SnapshotItemIterator& operator++()
+    {
+        loaded_ = false;
+        return *this;
+    }
+
+private:
+    SnapshotReader* reader_;
+    mutable std::pair<Key, Value> item_;
+    mutable bool loaded_;
+};
+
+/**
+* The iterator load uses instead when both key and value are stored as raw
+* bytes. It takes records from the read buffer a whole run at a time, so
+* each item costs two fixed-size copies and nothing else. It must be told
+* how many items there are, so as not to read into the trailer. Since a
+* key is cheap to keep, it also checks on the way that each key comes
+* after the one before under comp, and throws if not.
+*/
+template <typename Key, typename Value, typename Compare>
+class FixedSnapshotItemIterator
+{
+public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef std::pair<Key, Value> value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef std::pair<Key, Value>* pointer;
+    typedef std::pair<Key, Value>& reference;
+
+    static const std::size_t RecordSize = sizeof(Key) + sizeof(Value);
+
+    FixedSnapshotItemIterator(SnapshotReader& reader, std::uint64_t count, const Compare& comp) :
+        reader_(&reader), comp_(&comp), left_(count), next_(NULL), end_(NULL), first_(true), loaded_(false) { }
+
+    std::pair<Key, Value>& operator*() const
+    {
+        if (!loaded_)
+        {
+            if (next_ == end_)
+            {
+                std::uint64_t count = left_;
+                next_ = reader_->readRecords(RecordSize, count);
+                end_ = next_ + count * RecordSize;
+                left_ -= count;
+            }
+            Key key;
+            std::memcpy(&key, next_, sizeof(Key));
+            if (!first_ && !(*comp_)(item_.first, key))
+            {
+                throw std::runtime_error("AVLTree::load: keys are not in order");
+            }
+            item_.first = key;
+            std::memcpy(&item_.second, next_ + sizeof(Key), sizeof(Value));
+            first_ = false;
+            next_ += RecordSize;
+            loaded_ = true;
+        }
+        return item_;
+    }
+
+    FixedSnapshotItemIterator& operator++()
+    {
+        loaded_ = false;
+        return *this;
+    }
+
+private:
+    SnapshotReader* reader_;
+    const Compare* comp_;
+    mutable std::uint64_t left_; //items not yet taken from the reader
+    mutable const char* next_;
+    mutable const char* end_;
+    mutable std::pair<Key, Value> item_;
+    mutable bool first_;
+    mutable bool loaded_;
+};
+
+#endif
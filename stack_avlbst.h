@@ -0,0 +1,706 @@
+#ifndef STACK_AVLBST_H
+#define STACK_AVLBST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include "bst.h"
+
+/**
+* A node of a StackAVLTree: an AVLNode without the parent pointer. With int
+* keys and values it is 32 bytes instead of 40.
+*/
+template<typename Key, typename Value>
+class StackAVLNode
+{
+public:
+    template<typename KeyArgs, typename ValueArgs>
+    StackAVLNode(std::piecewise_construct_t, KeyArgs keyArgs, ValueArgs valueArgs) :
+        item_(std::piecewise_construct, std::move(keyArgs), std::move(valueArgs)),
+        left_(NULL),
+        right_(NULL),
+        balance_(0)
+    {
+    }
+
+    std::pair<const Key, Value>& getItem() { return item_; }
+    const Key& getKey() const { return item_.first; }
+    StackAVLNode* getLeft() const { return left_; }
+    StackAVLNode* getRight() const { return right_; }
+    int8_t getBalance() const { return balance_; }
+
+protected:
+    template<typename K, typename V, typename C, typename A>
+    friend class StackAVLTree;
+
+    std::pair<const Key, Value> item_;
+    StackAVLNode* left_;
+    StackAVLNode* right_;
+    int8_t balance_; //height of right subtree minus height of left, as in AVLNode
+};
+
+/**
+* An AVL tree whose nodes keep no parent pointer. Insert and remove record
+* the path they walk down in a fixed-size array on the stack and climb back
+* up that array to rebalance, and iterators carry the path from the root to
+* their item the same way. A rotation then only rewrites two or three child
+* links, with no parent links to keep in step.
+*
+* The arrays hold MaxHeight nodes. An AVL tree that tall needs more than
+* 10^13 nodes, so the bound is never reached in practice; an iterator is
+* about half a kilobyte as a result, so pass it by reference where it
+* matters.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value> > >
+class StackAVLTree
+{
+public:
+    typedef StackAVLNode<Key, Value> Node;
+    static const int MaxHeight = 64;
+
+    /**
+    * A bidirectional iterator in key order. It holds the path from the
+    * root down to its item, so stepping never needs a parent pointer.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        std::pair<const Key, Value>& operator*() const;
+        std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class StackAVLTree;
+        explicit iterator(const StackAVLTree* tree);
+        void pushLeftSpine(Node* node);
+        void pushRightSpine(Node* node);
+
+        const StackAVLTree* tree_;
+        Node* path_[MaxHeight];
+        int depth_; //0 for end()
+    };
+
+    StackAVLTree();
+    explicit StackAVLTree(const Compare& comp, const Alloc& alloc = Alloc());
+    ~StackAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+
+    iterator find(const Key& key) const;
+    bool contains(const Key& key) const;
+    Value& operator[](const Key& key) const;
+    iterator begin() const;
+    iterator end() const;
+    std::size_t size() const;
+    bool empty() const;
+
+protected:
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<Node> NodeAllocator;
+    typedef std::allocator_traits<NodeAllocator> NodeAllocatorTraits;
+
+    StackAVLTree(const StackAVLTree&);
+    StackAVLTree& operator=(const StackAVLTree&);
+
+    bool sameKey(const Key& key, bool goLeft, const Node* node) const;
+    Node* findNode(const Key& key) const;
+    void replaceChild(Node** path, bool* wentLeft, int depth, Node* child);
+    static Node* rotateLeft(Node* node);
+    static Node* rotateRight(Node* node);
+    static Node* rebalance(Node* node);
+    void clearHelper(Node* node);
+
+    Node* root_;
+    std::size_t count_;
+    Compare comp_;
+    NodeAllocator alloc_;
+};
+
+/*
+-------------------------------------------------------
+Begin implementations for the StackAVLTree::iterator class.
+-------------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+StackAVLTree<Key, Value, Compare, Alloc>::iterator::iterator() :
+    tree_(NULL),
+    depth_(0)
+{
+
+}
+
+/**
+* An end() iterator of the given tree.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+StackAVLTree<Key, Value, Compare, Alloc>::iterator::iterator(const StackAVLTree* tree) :
+    tree_(tree),
+    depth_(0)
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+std::pair<const Key, Value>& StackAVLTree<Key, Value, Compare, Alloc>::iterator::operator*() const
+{
+    return path_[depth_ - 1]->item_;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+std::pair<const Key, Value>* StackAVLTree<Key, Value, Compare, Alloc>::iterator::operator->() const
+{
+    return &path_[depth_ - 1]->item_;
+}
+
+/**
+* Two iterators are equal when they stand on the same item, or are both end().
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool StackAVLTree<Key, Value, Compare, Alloc>::iterator::operator==(const iterator& rhs) const
+{
+    if (depth_ == 0 || rhs.depth_ == 0)
+    {
+        return depth_ == rhs.depth_;
+    }
+    return path_[depth_ - 1] == rhs.path_[rhs.depth_ - 1];
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+bool StackAVLTree<Key, Value, Compare, Alloc>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Moves to the next item: the leftmost node of the right subtree if there
+* is one, else the nearest ancestor reached from its left.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename StackAVLTree<Key, Value, Compare, Alloc>::iterator&
+StackAVLTree<Key, Value, Compare, Alloc>::iterator::operator++()
+{
+    Node* node = path_[depth_ - 1];
+    if (node->right_ != NULL)
+    {
+        pushLeftSpine(node->right_);
+        return *this;
+    }
+    --depth_;
+    while (depth_ > 0 && path_[depth_ - 1]->right_ == node)
+    {
+        node = path_[--depth_];
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename StackAVLTree<Key, Value, Compare, Alloc>::iterator
+StackAVLTree<Key, Value, Compare, Alloc>::iterator::operator++(int)
+{
+    iterator before = *this;
+    ++(*this);
+    return before;
+}
+
+/**
+* The mirror image of operator++. Decrementing end() lands on the largest
+* item.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename StackAVLTree<Key, Value, Compare, Alloc>::iterator&
+StackAVLTree<Key, Value, Compare, Alloc>::iterator::operator--()
+{
+    if (depth_ == 0)
+    {
+        pushRightSpine(tree_->root_);
+        return *this;
+    }
+    Node* node = path_[depth_ - 1];
+    if (node->left_ != NULL)
+    {
+        pushRightSpine(node->left_);
+        return *this;
+    }
+    --depth_;
+    while (depth_ > 0 && path_[depth_ - 1]->left_ == node)
+    {
+        node = path_[--depth_];
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename StackAVLTree<Key, Value, Compare, Alloc>::iterator
+StackAVLTree<Key, Value, Compare, Alloc>::iterator::operator--(int)
+{
+    iterator before = *this;
+    --(*this);
+    return before;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void StackAVLTree<Key, Value, Compare, Alloc>::iterator::pushLeftSpine(Node* node)
+{
+    for (; node != NULL; node = node->left_)
+    {
+        path_[depth_++] = node;
+    }
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void StackAVLTree<Key, Value, Compare, Alloc>::iterator::pushRightSpine(Node* node)
+{
+    for (; node != NULL; node = node->right_)
+    {
+        path_[depth_++] = node;
+    }
+}
+
+/*
+-----------------------------------------------------
+End implementations for the StackAVLTree::iterator class.
+-----------------------------------------------------
+*/
+
+/*
+-------------------------------------------------
+Begin implementations for the StackAVLTree class.
+-------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare, class Alloc>
+StackAVLTree<Key, Value, Compare, Alloc>::StackAVLTree() :
+    root_(NULL),
+    count_(0),
+    comp_(),
+    alloc_()
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+StackAVLTree<Key, Value, Compare, Alloc>::StackAVLTree(const Compare& comp, const Alloc& alloc) :
+    root_(NULL),
+    count_(0),
+    comp_(comp),
+    alloc_(alloc)
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+StackAVLTree<Key, Value, Compare, Alloc>::~StackAVLTree()
+{
+    clear();
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present.
+* The walk down records each node and which way it went; the walk back up
+* adjusts balances until a subtree's height stops changing, rotating at
+* most once.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void StackAVLTree<Key, Value, Compare, Alloc>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Node* path[MaxHeight];
+    bool wentLeft[MaxHeight];
+    int depth = 0;
+    for (Node* current = root_; current != NULL; ++depth)
+    {
+        bool goLeft = comp_(keyValuePair.first, current->getKey());
+        if (sameKey(keyValuePair.first, goLeft, current))
+        {
+            current->item_.second = keyValuePair.second; //already present
+            return;
+        }
+        path[depth] = current;
+        wentLeft[depth] = goLeft;
+        current = childOf(current, goLeft);
+    }
+
+    Node* node = NodeAllocatorTraits::allocate(alloc_, 1);
+    try
+    {
+        NodeAllocatorTraits::construct(alloc_, node, std::piecewise_construct,
+                                       std::forward_as_tuple(keyValuePair.first),
+                                       std::forward_as_tuple(keyValuePair.second));
+    }
+    catch (...)
+    {
+        NodeAllocatorTraits::deallocate(alloc_, node, 1);
+        throw;
+    }
+    replaceChild(path, wentLeft, depth, node);
+    ++count_;
+
+    while (depth > 0)
+    {
+        --depth;
+        Node* parent = path[depth];
+        parent->balance_ += wentLeft[depth] ? -1 : 1;
+        if (parent->balance_ == 0)
+        {
+            return; //the shorter side caught up, so the height is unchanged
+        }
+        if (parent->balance_ == 2 || parent->balance_ == -2)
+        {
+            replaceChild(path, wentLeft, depth, rebalance(parent)); //restores the old height
+            return;
+        }
+    }
+}
+
+/**
+* Removes key if present. A node with two children is replaced by its
+* successor, which is found by carrying on down the same path, so the node
+* physically unlinked always has at most one child. The walk back up then
+* adjusts balances until a subtree's height stops changing, rotating as
+* often as needed.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void StackAVLTree<Key, Value, Compare, Alloc>::remove(const Key& key)
+{
+    Node* path[MaxHeight];
+    bool wentLeft[MaxHeight];
+    int depth = 0;
+    Node* target = root_;
+    while (target != NULL)
+    {
+        bool goLeft = comp_(key, target->getKey());
+        if (sameKey(key, goLeft, target))
+        {
+            break;
+        }
+        path[depth] = target;
+        wentLeft[depth] = goLeft;
+        ++depth;
+        target = childOf(target, goLeft);
+    }
+    if (target == NULL)
+    {
+        return;
+    }
+
+    int targetDepth = depth;
+    if (target->left_ != NULL && target->right_ != NULL)
+    {
+        path[depth] = target; //a placeholder for the successor, filled in below
+        wentLeft[depth] = false;
+        ++depth;
+        Node* successor = target->right_;
+        while (successor->left_ != NULL)
+        {
+            path[depth] = successor;
+            wentLeft[depth] = true;
+            ++depth;
+            successor = successor->left_;
+        }
+        // Unlink the successor from where it was, then put it where the
+        // target was, taking over the target's children and balance.
+        if (depth - 1 == targetDepth)
+        {
+            target->right_ = successor->right_;
+        }
+        else
+        {
+            path[depth - 1]->left_ = successor->right_;
+        }
+        successor->left_ = target->left_;
+        successor->right_ = target->right_;
+        successor->balance_ = target->balance_;
+        replaceChild(path, wentLeft, targetDepth, successor);
+        path[targetDepth] = successor;
+    }
+    else
+    {
+        replaceChild(path, wentLeft, depth, target->left_ != NULL ? target->left_ : target->right_);
+    }
+    NodeAllocatorTraits::destroy(alloc_, target);
+    NodeAllocatorTraits::deallocate(alloc_, target, 1);
+    --count_;
+
+    while (depth > 0)
+    {
+        --depth;
+        Node* parent = path[depth];
+        parent->balance_ += wentLeft[depth] ? 1 : -1;
+        if (parent->balance_ == 1 || parent->balance_ == -1)
+        {
+            return; //the subtree was even before, so its height is unchanged
+        }
+        if (parent->balance_ != 0)
+        {
+            Node* top = rebalance(parent);
+            replaceChild(path, wentLeft, depth, top);
+            if (top->balance_ != 0)
+            {
+                return; //the rotation kept the height
+            }
+        }
+    }
+}
+
+/**
+* Removes every key.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void StackAVLTree<Key, Value, Compare, Alloc>::clear()
+{
+    clearHelper(root_);
+    root_ = NULL;
+    count_ = 0;
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename StackAVLTree<Key, Value, Compare, Alloc>::iterator
+StackAVLTree<Key, Value, Compare, Alloc>::find(const Key& key) const
+{
+    iterator it(this);
+    Node* current = root_;
+    while (current != NULL)
+    {
+        it.path_[it.depth_++] = current;
+        bool goLeft = comp_(key, current->getKey());
+        if (sameKey(key, goLeft, current))
+        {
+            return it;
+        }
+        current = childOf(current, goLeft);
+    }
+    return end();
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+bool StackAVLTree<Key, Value, Compare, Alloc>::contains(const Key& key) const
+{
+    return findNode(key) != NULL;
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare, class Alloc>
+Value& StackAVLTree<Key, Value, Compare, Alloc>::operator[](const Key& key) const
+{
+    Node* node = findNode(key);
+    if (node == NULL) throw std::out_of_range("Invalid key");
+    return node->item_.second;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename StackAVLTree<Key, Value, Compare, Alloc>::iterator
+StackAVLTree<Key, Value, Compare, Alloc>::begin() const
+{
+    iterator it(this);
+    it.pushLeftSpine(root_);
+    return it;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename StackAVLTree<Key, Value, Compare, Alloc>::iterator
+StackAVLTree<Key, Value, Compare, Alloc>::end() const
+{
+    return iterator(this);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+std::size_t StackAVLTree<Key, Value, Compare, Alloc>::size() const
+{
+    return count_;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+bool StackAVLTree<Key, Value, Compare, Alloc>::empty() const
+{
+    return root_ == NULL;
+}
+
+/**
+* Whether node holds key, given goLeft = comp_(key, node's key). Keys that
+* EarlyExitSearch deems cheap compare with ==, which leaves the choice of
+* child a conditional move; others need the second comparison only when
+* goLeft is false.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool StackAVLTree<Key, Value, Compare, Alloc>::sameKey(const Key& key, bool goLeft, const Node* node) const
+{
+    if constexpr (EarlyExitSearch<Key, Compare>::value)
+    {
+        return key == node->getKey();
+    }
+    return !goLeft && !comp_(node->getKey(), key);
+}
+
+/**
+* A lookup that does not need the path, so it keeps none. Like
+* BinarySearchTree::internalFind it makes one comparison per level and
+* settles equality at the bottom, or stops at an equal key when
+* EarlyExitSearch says that is cheaper.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename StackAVLTree<Key, Value, Compare, Alloc>::Node*
+StackAVLTree<Key, Value, Compare, Alloc>::findNode(const Key& key) const
+{
+    Node* current = root_;
+    if constexpr (EarlyExitSearch<Key, Compare>::value)
+    {
+        while (current != NULL && !(key == current->getKey()))
+        {
+            current = childOf(current, comp_(key, current->getKey()));
+        }
+        return current;
+    }
+    Node* candidate = NULL; //last node not greater than key
+    while (current != NULL)
+    {
+        bool goLeft = comp_(key, current->getKey());
+        candidate = goLeft ? candidate : current;
+        current = childOf(current, goLeft);
+    }
+    if (candidate != NULL && !comp_(candidate->getKey(), key))
+    {
+        return candidate;
+    }
+    return NULL;
+}
+
+/**
+* Points the link that led to depth on the recorded path (the root when
+* depth is 0) at child.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void StackAVLTree<Key, Value, Compare, Alloc>::replaceChild(Node** path, bool* wentLeft, int depth, Node* child)
+{
+    if (depth == 0)
+    {
+        root_ = child;
+    }
+    else if (wentLeft[depth - 1])
+    {
+        path[depth - 1]->left_ = child;
+    }
+    else
+    {
+        path[depth - 1]->right_ = child;
+    }
+}
+
+/**
+* Rotations touch only child links and return the new subtree root; the
+* caller relinks it and fixes the balances.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename StackAVLTree<Key, Value, Compare, Alloc>::Node*
+StackAVLTree<Key, Value, Compare, Alloc>::rotateLeft(Node* node)
+{
+    Node* right = node->right_;
+    node->right_ = right->left_;
+    right->left_ = node;
+    return right;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename StackAVLTree<Key, Value, Compare, Alloc>::Node*
+StackAVLTree<Key, Value, Compare, Alloc>::rotateRight(Node* node)
+{
+    Node* left = node->left_;
+    node->left_ = left->right_;
+    left->right_ = node;
+    return left;
+}
+
+/**
+* Fixes a node whose balance has reached +2 or -2 with a single or double
+* rotation, and returns the root of the rebalanced subtree. Its balance is
+* 0 unless the taller child was itself even, which only happens after a
+* removal and leaves the subtree's height unchanged.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename StackAVLTree<Key, Value, Compare, Alloc>::Node*
+StackAVLTree<Key, Value, Compare, Alloc>::rebalance(Node* node)
+{
+    int8_t sign = node->balance_ > 0 ? 1 : -1;
+    Node* child = sign > 0 ? node->right_ : node->left_;
+    if (child->balance_ != -sign)
+    {
+        Node* top = sign > 0 ? rotateLeft(node) : rotateRight(node);
+        if (child->balance_ == 0)
+        {
+            node->balance_ = sign;
+            child->balance_ = -sign;
+        }
+        else
+        {
+            node->balance_ = 0;
+            child->balance_ = 0;
+        }
+        return top;
+    }
+    Node* grandchild = sign > 0 ? child->left_ : child->right_;
+    if (sign > 0)
+    {
+        node->right_ = rotateRight(child);
+    }
+    else
+    {
+        node->left_ = rotateLeft(child);
+    }
+    Node* top = sign > 0 ? rotateLeft(node) : rotateRight(node);
+    node->balance_ = grandchild->balance_ == sign ? -sign : 0;
+    child->balance_ = grandchild->balance_ == -sign ? sign : 0;
+    grandchild->balance_ = 0;
+    return top;
+}
+
+/**
+* Frees a subtree. The recursion is at most MaxHeight deep.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void StackAVLTree<Key, Value, Compare, Alloc>::clearHelper(Node* node)
+{
+    if (node != NULL)
+    {
+        clearHelper(node->left_);
+        clearHelper(node->right_);
+        NodeAllocatorTraits::destroy(alloc_, node);
+        NodeAllocatorTraits::deallocate(alloc_, node, 1);
+    }
+}
+
+/*
+-----------------------------------------------
+End implementations for the StackAVLTree class.
+-----------------------------------------------
+*/
+
+#endif